@@ -0,0 +1,126 @@
+#include <KoalaCompiler>
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#include "lexer/lexer.hpp"
+#include "parser/parser.hpp"
+#include "parser/parallel_parser.hpp"
+#include "translator/translator.hpp"
+#include "optimizer/block_layout.hpp"
+#include "optimizer/loop_unroll.hpp"
+#include "optimizer/optimizer.hpp"
+#include "optimizer/register_allocator.hpp"
+#include "time_trace.hpp"
+#include "ir.hpp"
+
+namespace koalac{
+
+    CompileResult compile(std::string_view source, const CompileOptions& options){
+        CompileResult result;
+
+        KoalaHostRegistry builtins;
+        const KoalaHostRegistry* host = options.Host;
+        if(!host){
+            koalaHostRegistryInit(&builtins);
+            host = &builtins;
+        }
+
+        std::vector<ParserError> errors;
+        IRProgram program = [&]{
+            if(options.Jobs > 1) return parseParallel(std::string(source), host, options.RegistersCount, options.Jobs, &errors);
+
+            TimeTraceScope trace("Parse");
+            Lexer lexer{std::string(source)};
+            lexer.SetRegistersCount(options.RegistersCount);
+            Parser parser(&lexer, host);
+            IRProgram parsed = parser.MakeProgram();
+            errors = parser.GetErrors();
+
+            trace.SetArg("lex_ns", static_cast<int64_t>(lexer.GetLexTimeNs()));
+            timeTraceCount("tokens", lexer.GetTokenCount());
+            timeTraceCount("lex_ns", lexer.GetLexTimeNs());
+            return parsed;
+        }();
+        timeTraceCount("ir_nodes", program.GetNodes().size());
+        timeTraceSampleMemory();
+
+        if(!errors.empty()){
+            for(const ParserError& err : errors) result.Errors.push_back({err.Span.Line, err.Span.Column, err.Msg});
+            return result;
+        }
+
+        //first: the optimizer's liveness only knows physical registers
+        if(usesVirtualRegisters(program.GetNodes())){
+            TimeTraceScope trace("Register allocation");
+            try{
+                AllocatorStats stats = allocateRegisters(program, options.RegistersCount);
+                result.VirtualRegisters = stats.VirtualRegisters;
+                result.SpilledRegisters = stats.Spilled;
+                result.CoalescedMoves = stats.CoalescedMoves;
+                result.Warnings.insert(result.Warnings.end(), stats.Warnings.begin(), stats.Warnings.end());
+            } catch(const std::runtime_error& e){
+                result.Errors.push_back({0, 0, e.what()});
+                return result;
+            }
+        }
+
+        if(options.Optimize){
+            TimeTraceScope trace("Optimize");
+            OptimizerStats stats = optimizeProgram(program);
+            result.UnreachableBlocks = stats.UnreachableBlocks;
+            result.DeadStores = stats.DeadStores;
+            result.ThreadedJumps = stats.ThreadedJumps;
+            result.RemovedJumps = stats.RemovedJumps;
+        }
+        if(options.Optimize && options.UnrollFactor >= 2){
+            TimeTraceScope trace("Unroll");
+            UnrollStats stats = unrollLoops(program, options.UnrollFactor);
+            result.UnrolledLoops = stats.Loops;
+            result.FullyUnrolledLoops = stats.FullyUnrolled;
+            result.RemainderLoops = stats.WithRemainder;
+            result.UnrollGrowth = stats.Growth;
+        }
+        result.RegistersUsed = registersUsed(program.GetNodes());
+
+        TranslatorOptions translatorOptions;
+        translatorOptions.Dense = options.Dense;
+        try{
+            TimeTraceScope trace("Translate");
+            result.Body = translateToBytecode(program, translatorOptions);
+        } catch(const std::runtime_error& e){ //jump to an undefined label
+            result.Errors.push_back({0, 0, e.what()});
+            return result;
+        }
+        timeTraceSampleMemory();
+
+        if(options.Profile){
+            TimeTraceScope trace("Profile layout");
+            //counts are keyed by pc, so they only apply to the bytecode they were recorded on
+            if(options.Profile->bytecodeHash != koalaBytecodeHash(result.Body.data(), result.Body.size())){
+                result.Warnings.push_back("profile was recorded on different bytecode, ignoring it");
+            } else if(layoutBlocks(program, *options.Profile)){
+                result.Body = translateToBytecode(program, translatorOptions);
+            }
+        }
+
+        return result;
+    }
+
+    Bytecode makeFile(const CompileResult& result){
+        const uint8_t header[KOALA_HEADER_SIZE] = {KOALA_MAG_0, KOALA_MAG_1, KOALA_MAG_2, KOALA_MAG_3, KOALA_MAG_4, static_cast<uint8_t>(result.RegistersUsed)};
+        Bytecode file(sizeof(header) + result.Body.size());
+        std::copy(std::begin(header), std::end(header), file.begin());
+        std::copy(result.Body.begin(), result.Body.end(), file.begin() + sizeof(header));
+        return file;
+    }
+
+    void printCompileErrors(const std::vector<CompileError>& errors){
+        for(const CompileError& err : errors){
+            if(err.Line == 0) std::cerr << std::format("[ERROR] {}\n", err.Msg);
+            else std::cerr << std::format("[ERROR(ln: {}, col: {})] {}\n", err.Line, err.Column, err.Msg);
+        }
+    }
+
+}
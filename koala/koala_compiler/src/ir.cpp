@@ -1,7 +1,42 @@
 #include "ir.hpp"
 
+#include <algorithm>
+
 namespace koalac{
 
+    static const JumpFamily JumpFamilies[] = {
+        { OpCode::_JMP_UNDEFINED, OpCode::JMP_SHORT8, OpCode::JMP_SHORT, OpCode::JMP_LONG },
+        { OpCode::_JEZ_UNDEFINED, OpCode::JEZ_SHORT8, OpCode::JEZ_SHORT, OpCode::JEZ_LONG },
+        { OpCode::_JNZ_UNDEFINED, OpCode::JNZ_SHORT8, OpCode::JNZ_SHORT, OpCode::JNZ_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JEQ_REG_SHORT,   OpCode::JEQ_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JEQ_IMM16_SHORT, OpCode::JEQ_IMM16_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JNE_REG_SHORT,   OpCode::JNE_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JNE_IMM16_SHORT, OpCode::JNE_IMM16_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLT_REG_SHORT,   OpCode::JLT_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLT_IMM16_SHORT, OpCode::JLT_IMM16_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLE_REG_SHORT,   OpCode::JLE_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLE_IMM16_SHORT, OpCode::JLE_IMM16_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLTU_REG_SHORT,   OpCode::JLTU_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLTU_IMM16_SHORT, OpCode::JLTU_IMM16_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLEU_REG_SHORT,   OpCode::JLEU_REG_LONG },
+        { OpCode::NONE,           OpCode::NONE,       OpCode::JLEU_IMM16_SHORT, OpCode::JLEU_IMM16_LONG },
+    };
+
+    const JumpFamily* findJumpFamily(OpCode op){
+        for(const JumpFamily& family : JumpFamilies){
+            if(op == family.Undefined || op == family.Short8 || op == family.Short || op == family.Long) return &family;
+        }
+        return nullptr;
+    }
+
+    size_t jumpOffsetSize(OpCode op){
+        const JumpFamily* family = findJumpFamily(op);
+        if(!family) return 0;
+        if(op == family->Short8) return 1;
+        if(op == family->Short) return 2;
+        return 8;
+    }
+
     size_t IRInstruction::GetSize(){
         size_t size = 1; //opcode is always 1 byte
 
@@ -9,27 +44,51 @@ namespace koalac{
             std::visit([this, &size](auto val){
                 using T = std::decay_t<decltype(val)>;
                 
-                if(std::is_same_v<T, uint8_t>){
+                if(std::is_same_v<T, uint8_t> || std::is_same_v<T, VirtualRegister>){
                     size += 1;
                 } else if(std::is_same_v<T, uint16_t>) {
                     size += 2;
+                } else if(std::is_same_v<T, uint32_t>) {
+                    size += 4;
                 } else if(std::is_same_v<T, uint64_t>) {
                     size += 8;
                 } else if(std::is_same_v<T, std::string>) {
-                    if(Op == OpCode::JMP_SHORT ||
-                       Op == OpCode::JEZ_SHORT ||
-                       Op == OpCode::JNZ_SHORT
-                    ){
-                        size += 2;
-                    } else {
-                        size += 8;
-                    }
+                    size += jumpOffsetSize(Op);
                 }
 
             }, arg);
         }
+        if(Op == OpCode::CALLHOST && Args.size() < CallHostOperands) size += CallHostOperands - Args.size();
 
         return size;
     }
 
-}
\ No newline at end of file
+    size_t registersUsed(const IRInstruction& instr){
+        size_t count = 0;
+        for(const auto& arg : instr.Args){
+            //parser output keeps registers, and only registers, as uint8_t
+            if(const uint8_t* reg = std::get_if<uint8_t>(&arg)) count = std::max<size_t>(count, *reg + 1u);
+        }
+        return count;
+    }
+
+    size_t registersUsed(const IRNodes& nodes){
+        size_t count = 0;
+        for(const auto& node : nodes){
+            if(const auto* instr = dynamic_cast<const IRInstruction*>(node.get())) count = std::max(count, registersUsed(*instr));
+        }
+        return count;
+    }
+
+    bool usesVirtualRegisters(const IRInstruction& instr){
+        return std::any_of(instr.Args.begin(), instr.Args.end(), [](const IRArg& arg){ return std::holds_alternative<VirtualRegister>(arg); });
+    }
+
+    bool usesVirtualRegisters(const IRNodes& nodes){
+        return std::any_of(nodes.begin(), nodes.end(), [](const auto& node){
+            const auto* instr = dynamic_cast<const IRInstruction*>(node.get());
+            return instr && usesVirtualRegisters(*instr);
+        });
+    }
+
+}
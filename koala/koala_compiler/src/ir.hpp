@@ -19,11 +19,38 @@ namespace koalac{
         virtual ~IRNode() = default;
     };
 
-    using IRArg = std::variant<uint8_t, uint16_t, uint64_t, std::string>;
+    // `v<N>` in the source. There is no limit on how many a program uses: they are
+    // mapped onto the register file by allocateRegisters before translation.
+    struct VirtualRegister{
+        uint32_t Id;
+
+        bool operator==(const VirtualRegister&) const = default;
+    };
+
+    using IRArg = std::variant<uint8_t, uint16_t, uint32_t, uint64_t, std::string, VirtualRegister>;
+
+    // Encodings of one jump, narrowest offset first. The translator starts from the
+    // narrowest allowed form and widens a jump until its target is in range.
+    struct JumpFamily{
+        OpCode Undefined; //NONE when the parser emits Short directly
+        OpCode Short8;    //NONE when there is no 8-bit form
+        OpCode Short;
+        OpCode Long;
+    };
+
+    // Family the opcode belongs to (any member), nullptr for non-jumps.
+    const JumpFamily* findJumpFamily(OpCode op);
+    // Encoded size of the label operand of a resolved jump.
+    size_t jumpOffsetSize(OpCode op);
+
+    // CALLHOST always encodes three argument registers; the parser keeps only the ones
+    // written, the translator pads the rest.
+    inline constexpr size_t CallHostOperands = 5;
 
     struct IRInstruction : public IRNode{
         OpCode Op;
         std::vector<IRArg> Args;
+        size_t Offset = 0; //position in the bytecode, set by the translator
 
         IRInstruction(OpCode op, std::vector<IRArg> args, struct Span span)
         : Op(op), Args(std::move(args)), IRNode(span)
@@ -36,9 +63,10 @@ namespace koalac{
 
     struct IRLabel : public IRNode{
         std::string Label;
+        bool Local = false; //'.name' under a global label, Label holds 'global.name'
 
-        IRLabel(const std::string& label, struct Span span)
-        : Label(label), IRNode(span)
+        IRLabel(const std::string& label, struct Span span, bool local = false)
+        : Label(label), Local(local), IRNode(span)
         {}
 
         ~IRLabel() override = default;
@@ -46,14 +74,24 @@ namespace koalac{
 
     using IRNodes = std::vector<std::unique_ptr<IRNode>>;
 
+    // Registers an instruction needs: its highest register operand + 1. Only valid on
+    // parser output, dense translation packs register pairs into one operand.
+    size_t registersUsed(const IRInstruction& instr);
+    size_t registersUsed(const IRNodes& nodes);
+    bool usesVirtualRegisters(const IRInstruction& instr);
+    bool usesVirtualRegisters(const IRNodes& nodes);
+
     class IRProgram{
     public:
         IRProgram(IRNodes nodes) : m_Nodes(std::move(nodes))
         {}
 
+        IRProgram(IRProgram&&) = default;
+        IRProgram& operator=(IRProgram&&) = default;
         ~IRProgram() = default;
 
         inline const IRNodes& GetNodes() const { return m_Nodes; }
+        inline IRNodes& GetNodes() { return m_Nodes; }
     private:
         IRNodes m_Nodes;
     };
@@ -3,10 +3,11 @@
 
 #include <vm_config.h>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <sstream>
 
-#define M_IDX_IS_VALID (m_Idx < m_ContentLength)
+#define M_IDX_IS_VALID (m_Idx < m_ContentLength || Fill(0))
 #define CUR_CHAR (m_Content[m_Idx])
 
 
@@ -28,16 +29,17 @@ bool isHex(char c){
            (c >= 'A' && c <= 'F');
 }
 
-uint64_t parseRegisterIdx(const std::string& s){
+// `registersCount` is the register file size of the target VM.
+uint64_t parseRegisterIdx(const std::string& s, size_t registersCount){
     uint64_t n = 0;
     for(size_t i = 1; i < s.size(); ++i){
         n = n * 10 + (static_cast<unsigned char>(s[i]) - '0');
-        if(n >= KOALA_CORE_VM_REGISTERS_COUNT) return UINT64_MAX;
+        if(n >= registersCount) return UINT64_MAX;
     }
     return n;
 }
 
-bool isRegister(const std::string& s){
+bool isRegister(const std::string& s, size_t registersCount){
     if(s.size() < 2) return false; //at least r0
     if(s[0] != 'r') return false;
 
@@ -45,13 +47,43 @@ bool isRegister(const std::string& s){
         if(!std::isdigit(s[i])) return false;
     }
 
-    if(parseRegisterIdx(s) == UINT64_MAX) return false;
+    if(parseRegisterIdx(s, registersCount) == UINT64_MAX) return false;
 
     return true;
 }
 
+// v<N>: any number of virtual registers, up to the 32-bit id range.
+bool isVirtualRegister(const std::string& s){
+    if(s.size() < 2 || s.size() > 11) return false; //v0 .. v4294967295
+    if(s[0] != 'v') return false;
+
+    for(size_t i = 1; i < s.size(); ++i){
+        if(!std::isdigit(s[i])) return false;
+    }
+    return std::stoull(s.substr(1)) <= UINT32_MAX;
+}
+
 namespace koalac{
 
+    bool Lexer::Fill(size_t ahead){
+        if(m_Idx + ahead < m_ContentLength) return true;
+        if(!m_Input) return false;
+
+        //everything before m_Idx is already part of a returned token or skipped
+        m_Content.erase(0, m_Idx);
+        m_Idx = 0;
+
+        while(m_Content.size() <= ahead && *m_Input){
+            size_t oldSize = m_Content.size();
+            m_Content.resize(oldSize + m_ChunkSize);
+            m_Input->read(&m_Content[oldSize], static_cast<std::streamsize>(m_ChunkSize));
+            m_Content.resize(oldSize + static_cast<size_t>(m_Input->gcount()));
+        }
+
+        m_ContentLength = m_Content.size();
+        return ahead < m_ContentLength;
+    }
+
     void Lexer::Next(){
         m_Idx += 1;
         if(M_IDX_IS_VALID){
@@ -74,6 +106,16 @@ namespace koalac{
     }
 
     Token Lexer::NextToken(){
+        m_TokenCount++;
+        if(!m_Timed) return Lex();
+
+        auto start = std::chrono::steady_clock::now();
+        Token token = Lex();
+        m_LexTimeNs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        return token;
+    }
+
+    Token Lexer::Lex(){
         SkipWhitespacesAndComments();
         
         Span startSpan = { .Line = m_CurLine, .Column = m_CurColumn };
@@ -87,7 +129,7 @@ namespace koalac{
             int radix = 10;
             bool hasPrefix = false;
 
-            if(m_Idx + 1 < m_ContentLength){
+            if(Fill(1)){
                 char nextC = m_Content[m_Idx + 1];
                 
                 switch (nextC) {
@@ -144,7 +186,8 @@ namespace koalac{
             }
             std::string ident = ss.str();
 
-            if(isRegister(ident)) return Token(TokenType::Register, startSpan, parseRegisterIdx(ident));
+            if(isRegister(ident, m_RegistersCount)) return Token(TokenType::Register, startSpan, parseRegisterIdx(ident, m_RegistersCount));
+            else if(isVirtualRegister(ident)) return Token(TokenType::VirtualRegister, startSpan, static_cast<uint64_t>(std::stoull(ident.substr(1))));
             else if(
                 ident == "mov" ||
                 ident == "inc" ||
@@ -167,7 +210,62 @@ namespace koalac{
                 ident == "jmp" ||
                 ident == "jez" ||
                 ident == "jnz" ||
-                ident == "ret"
+                ident == "jeq" ||
+                ident == "jne" ||
+                ident == "jlt" ||
+                ident == "jle" ||
+                ident == "jltu" ||
+                ident == "jleu" ||
+                ident == "jgt" ||
+                ident == "jge" ||
+                ident == "jgtu" ||
+                ident == "jgeu" ||
+                ident == "seteq" ||
+                ident == "setne" ||
+                ident == "setlt" ||
+                ident == "setle" ||
+                ident == "setltu" ||
+                ident == "setleu" ||
+                ident == "setgt" ||
+                ident == "setge" ||
+                ident == "setgtu" ||
+                ident == "setgeu" ||
+                ident == "cmov" ||
+                ident == "select" ||
+                ident == "popcnt" ||
+                ident == "clz" ||
+                ident == "ctz" ||
+                ident == "bswap" ||
+                ident == "rol" ||
+                ident == "ror" ||
+                ident == "mulhi" ||
+                ident == "mulhiu" ||
+                ident == "min" ||
+                ident == "max" ||
+                ident == "minu" ||
+                ident == "maxu" ||
+                ident == "ret" ||
+                ident == "checkpoint" ||
+                ident == "load8" ||
+                ident == "load16" ||
+                ident == "load32" ||
+                ident == "load64" ||
+                ident == "store8" ||
+                ident == "store16" ||
+                ident == "store32" ||
+                ident == "store64" ||
+                ident == "memcopy" ||
+                ident == "memfill" ||
+                ident == "callhost" ||
+                ident == "read8" ||
+                ident == "read64" ||
+                ident == "write8" ||
+                ident == "write64" ||
+                ident == "eof" ||
+                ident == "send" ||
+                ident == "recv" ||
+                ident == "tryrecv" ||
+                ident == "close"
             ) return Token(TokenType::Keyword, startSpan, ident);
             else return Token(TokenType::Identifier, startSpan, ident);
         }
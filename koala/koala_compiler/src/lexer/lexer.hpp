@@ -1,28 +1,57 @@
 #pragma once
 
 #include "lexer/token.hpp"
+#include "time_trace.hpp"
+#include <vm_config.h>
+#include <cstdint>
+#include <istream>
 #include <string>
 
 namespace koalac{
 
     class Lexer {
     public:
-        Lexer(const std::string& source)
-        : m_Content(source), m_Idx(0), m_ContentLength(m_Content.size()), m_CurLine(1), m_CurColumn(1)
+        // `firstLine` numbers the first line of `source` when it is a piece of a file.
+        Lexer(std::string source, size_t firstLine = 1)
+        : m_Content(std::move(source)), m_Idx(0), m_ContentLength(m_Content.size()), m_CurLine(firstLine), m_CurColumn(1), m_Timed(timeTraceEnabled())
+        {}
+
+        // Streaming: reads `input` in chunks of `chunkSize` bytes as tokens are consumed,
+        // keeping only the unconsumed part of the current chunk in memory.
+        Lexer(std::istream* input, size_t chunkSize)
+        : m_Input(input), m_ChunkSize(chunkSize), m_Idx(0), m_ContentLength(0), m_CurLine(1), m_CurColumn(1), m_Timed(timeTraceEnabled())
         {}
 
         ~Lexer() = default;
 
         Token NextToken();
+
+        // Register file size of the target: r0..r<count - 1> are registers, anything
+        // above lexes as an identifier. Defaults to the size koala_core was built with.
+        inline void SetRegistersCount(size_t count) { m_RegistersCount = count; }
+
+        inline uint64_t GetTokenCount() const { return m_TokenCount; }
+        // Time spent inside NextToken, only measured while tracing.
+        inline uint64_t GetLexTimeNs() const { return m_LexTimeNs; }
     private:
+        Token Lex();
         void SkipWhitespacesAndComments();
         void Next();
-        
+        // Makes m_Content[m_Idx + ahead] available if the input has it.
+        bool Fill(size_t ahead);
+
+        std::istream* m_Input = nullptr;
+        size_t m_ChunkSize = 0;
         std::string m_Content;
         size_t m_Idx;
         size_t m_ContentLength;
         size_t m_CurLine;
         size_t m_CurColumn;
+        size_t m_RegistersCount = KOALA_CORE_VM_REGISTERS_COUNT;
+
+        bool m_Timed;
+        uint64_t m_TokenCount = 0;
+        uint64_t m_LexTimeNs = 0;
     };
 
 }
\ No newline at end of file
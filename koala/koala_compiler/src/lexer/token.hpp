@@ -11,6 +11,7 @@ namespace koalac {
         Identifier, //string
         Keyword, //string
         Register, //uint64_t
+        VirtualRegister, //uint64_t
         Number, //uint64_t
 
         Colon, Comma, //monostate
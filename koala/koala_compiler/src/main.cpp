@@ -1,25 +1,162 @@
 #include <KoalaCore>
+#include <KoalaCompiler>
+#include <KoalaArgs>
 #include <iostream>
+#include <cstdio>
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <fstream>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 
 #include "lexer/lexer.hpp"
 #include "parser/parser.hpp"
 #include "translator/translator.hpp"
+#include "optimizer/loop_unroll.hpp"
+#include "time_trace.hpp"
 #include "ir.hpp"
 
+//counted for the time trace; plain malloc/free otherwise. Replaced here rather than in
+//koala_compiler so the library doesn't take over operator new in koala and embedders.
+static std::atomic<uint64_t> g_Allocations{0};
+
+void* operator new(std::size_t size){
+    g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size){ return ::operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
 const uint8_t KOALA_MAGIC_BYTES[] = {KOALA_MAG_0, KOALA_MAG_1, KOALA_MAG_2, KOALA_MAG_3, KOALA_MAG_4 };
 
+// Magic bytes, then how many registers the program needs so the VM can reject it early.
+void writeHeader(std::ostream& out, size_t registers){
+    out.write(reinterpret_cast<const char*>(KOALA_MAGIC_BYTES), static_cast<std::streamsize>(sizeof(KOALA_MAGIC_BYTES)));
+    out.put(static_cast<char>(registers));
+}
+
 void printHelp() {
     std::cout << R"(kolac <path_to_source.klasm> <args>
     
 Flags
-| -o <path> ; output save file
+| -o <path>         ; output save file
+| --dense           ; compact encoding: packed register pairs, imm8/imm32, 8-bit jumps
+| -O                ; remove unreachable code, dead stores and redundant jumps
+| -O2               ; -O, and unroll small single-block loops counted by a register
+| --unroll <n>      ; unroll factor for -O2, 1 to )" << koalac::UnrollMaxFactor << R"( (default: )" << koalac::DefaultUnrollFactor << R"()
+| --registers <n>   ; register file of the target VM: 8, 16, 32 or 64 (default: )" << KOALA_CORE_VM_REGISTERS_COUNT << R"()
+| --host <path>     ; extra host function names for 'callhost', one per line,
+|                     indexed after the builtins in file order
+| --profile-use <path> ; lay out basic blocks by a branch profile recorded with
+|                     'koala --profile-out' (same source and flags)
+| -j <threads>      ; parse a large source in that many pieces concurrently
+| --time-trace <path> ; write Chrome trace-event JSON with a span per compiler
+|                     phase and counters for tokens, IR nodes, jumps, memory
+| --stream          ; compile in constant memory: read, parse and write the output
+|                     piecewise (forward jumps stay in the long form, a local label
+|                     is only reachable before the next global label)
+
+Virtual registers: v0, v1, ... (any number) are mapped onto the register file. Registers
+the source writes keep their values to every ret, checkpoint and callhost; registers it
+only reads are free after their last read; the others end with unspecified values.
 )";
 }
 
+std::string outputPath(std::unordered_map<std::string, std::string>& args, const std::string& inputPath){
+    if(args.contains("-o")) return args["-o"];
+
+    size_t lastDot = inputPath.find_last_of(".");
+    if(lastDot != std::string::npos){
+        return inputPath.substr(0, lastDot) + ".klbc"; //klbc is Koala Bytecode
+    }
+    return inputPath + ".klbc";
+}
+
+// Numeric flag `flag` into `out` when given; a malformed or out-of-range value prints
+// the accepted range and the usage.
+static bool readCountFlag(const std::unordered_map<std::string, std::string>& args, const char* flag, uint64_t min, uint64_t max, uint64_t* out){
+    auto it = args.find(flag);
+    if(it == args.end() || koala::parseCount(it->second, min, max, out)) return true;
+
+    std::cerr << "'" << flag << "' expects a number from " << min << " to " << max << ", got '" << it->second << "'.\n";
+    printHelp();
+    return false;
+}
+
+// Source to bytecode in fixed-size pieces: the lexer reads chunks, every parsed node
+// goes straight to the translator, and the translator writes and backpatches the file.
+int compileStreaming(const std::string& sourcePath, const std::string& outName, const KoalaHostRegistry* host, size_t registersCount, const koalac::TranslatorOptions& options){
+    static constexpr size_t SourceChunkSize = 64 * 1024;
+
+    std::ifstream in(sourcePath, std::ios::in | std::ios::binary);
+    if(!in){
+        std::cerr << "Failed to open source file!\n";
+        return -1;
+    }
+
+    std::ofstream outFs(outName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!outFs){
+        std::cerr << "Failed to open output file for writting: " << outName << "\n";
+        return -1;
+    }
+    writeHeader(outFs, registersCount); //patched once the whole program was seen
+
+    koalac::TimeTraceScope trace("Stream compile");
+    koalac::Lexer lexer(&in, SourceChunkSize);
+    lexer.SetRegistersCount(registersCount);
+    koalac::Parser parser(&lexer, host);
+    koalac::StreamingTranslator translator(&outFs, options);
+
+    koalac::IRNodes nodes;
+    uint64_t nodeCount = 0;
+    size_t registersUsed = 0;
+    std::string error;
+    while(parser.ParseNext(&nodes)){
+        if(parser.IsSuccess() && koalac::usesVirtualRegisters(nodes)){
+            error = "Virtual registers need the whole program and cannot be compiled with --stream.";
+            break;
+        }
+        if(parser.IsSuccess()){
+            registersUsed = std::max(registersUsed, koalac::registersUsed(nodes));
+            for(auto& node : nodes) translator.Emit(*node);
+        }
+        nodeCount += nodes.size();
+        nodes.clear();
+    }
+
+    bool translated = parser.IsSuccess() && error.empty() && translator.Finish(&error);
+    if(translated){
+        outFs.seekp(static_cast<std::streamoff>(sizeof(KOALA_MAGIC_BYTES)));
+        outFs.put(static_cast<char>(registersUsed));
+        translated = outFs.good();
+        if(!translated) error = "Error occured while writing bytecode data.";
+    }
+    outFs.close();
+
+    trace.SetArg("lex_ns", static_cast<int64_t>(lexer.GetLexTimeNs()));
+    koalac::timeTraceCount("tokens", lexer.GetTokenCount());
+    koalac::timeTraceCount("lex_ns", lexer.GetLexTimeNs());
+    koalac::timeTraceCount("ir_nodes", nodeCount);
+
+    if(!translated){
+        if(!parser.IsSuccess()) parser.PrintErrors();
+        else std::cerr << error << "\n";
+        std::remove(outName.c_str());
+        return -1;
+    }
+
+    std::cout << "Successfully compiled and saved to " << outName << "\n";
+    return 0;
+}
+
 int main(int argc, char** argv){
     if(argc < 2){
         printHelp();
@@ -28,12 +165,17 @@ int main(int argc, char** argv){
 
     std::unordered_map<std::string, std::string> args;
     std::string source;
+    uint64_t registersCount = KOALA_CORE_VM_REGISTERS_COUNT;
+    uint64_t unrollFactor = koalac::DefaultUnrollFactor;
+    uint64_t jobs = 1;
 
     { //parsing args
         bool areArgsFine = true;
         for(size_t i = 2; i < argc; ++i){
             if(argv[i][0] == '-'){
-                if(std::strcmp(argv[i], "-o") == 0){
+                if(std::strcmp(argv[i], "--dense") == 0 || std::strcmp(argv[i], "-O") == 0 || std::strcmp(argv[i], "-O2") == 0 || std::strcmp(argv[i], "--stream") == 0){
+                    args[std::string(argv[i])] = "";
+                } else if(std::strcmp(argv[i], "-o") == 0 || std::strcmp(argv[i], "--host") == 0 || std::strcmp(argv[i], "--registers") == 0 || std::strcmp(argv[i], "--profile-use") == 0 || std::strcmp(argv[i], "-j") == 0 || std::strcmp(argv[i], "--time-trace") == 0 || std::strcmp(argv[i], "--unroll") == 0){
                     if(i + 1 >= argc || argv[i + 1][0] == '-'){
                         std::cerr << "Wrong argument format for '" << argv[i] << "'. Expected: " << argv[i] << " <arg>.\n";
                         areArgsFine = false;
@@ -48,9 +190,43 @@ int main(int argc, char** argv){
         if(!areArgsFine) {
             return -1;
         }
+
+        if(args.contains("--stream") && (args.contains("-O") || args.contains("-O2") || args.contains("--profile-use"))){
+            std::cerr << "-O, -O2 and --profile-use need the whole program and cannot be combined with --stream.\n";
+            return -1;
+        }
+        if(!readCountFlag(args, "--registers", 8, KOALA_CORE_VM_REGISTERS_MAX, &registersCount) ||
+           !readCountFlag(args, "--unroll", 1, koalac::UnrollMaxFactor, &unrollFactor) ||
+           !readCountFlag(args, "-j", 1, 1024, &jobs)){
+            return -1;
+        }
+        if(registersCount != 8 && registersCount != 16 && registersCount != 32 && registersCount != 64){
+            std::cerr << "--registers expects 8, 16, 32 or 64.\n";
+            return -1;
+        }
+        if(args.contains("--unroll") && !args.contains("-O2")){
+            std::cerr << "--unroll expects a factor from 1 to " << koalac::UnrollMaxFactor << " and -O2.\n";
+            return -1;
+        }
+    }
+
+    //written on every way out of main, failed compilations included
+    struct TimeTraceOutput{
+        std::string Path;
+        ~TimeTraceOutput(){
+            if(Path.empty()) return;
+            koalac::timeTraceCount("allocations", g_Allocations.load(std::memory_order_relaxed));
+            if(!koalac::timeTraceWrite(Path)) std::cerr << "Failed to write time trace: " << Path << "\n";
+        }
+    } timeTraceOutput;
+
+    if(args.contains("--time-trace")){
+        koalac::timeTraceInit();
+        timeTraceOutput.Path = args["--time-trace"];
     }
     
-    { // reading from file
+    if(!args.contains("--stream")){ // reading from file
+        koalac::TimeTraceScope trace("Read source");
         std::string pathToSource = argv[1];
         std::fstream fs(pathToSource);
         if(!fs){
@@ -67,34 +243,83 @@ int main(int argc, char** argv){
         fs.close();
     }
     
-    koalac::Bytecode bc;
-    { //processing source code
-        koalac::Lexer lexer(source);
-        koalac::Parser parser(&lexer);
-
-        koalac::IRProgram program = parser.MakeProgram();
-        if(!parser.IsSuccess()){
-            parser.PrintErrors();
+    KoalaHostRegistry host;
+    std::vector<std::string> hostNames;
+    { //host functions callable by name
+        koalaHostRegistryInit(&host);
+
+        if(args.contains("--host")){
+            std::ifstream fs(args["--host"]);
+            if(!fs){
+                std::cerr << "Failed to open host function list: " << args["--host"] << "\n";
+                return -1;
+            }
+
+            std::string line;
+            while(std::getline(fs, line)){
+                while(!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.pop_back();
+                if(!line.empty() && line[0] != '#') hostNames.push_back(line);
+            }
+
+            for(const std::string& name : hostNames){ //registry keeps the pointers, hostNames must not grow after this
+                if(koalaHostRegister(&host, name.c_str(), nullptr) < 0){
+                    std::cerr << "Cannot register host function '" << name << "': duplicate name or too many functions.\n";
+                    return -1;
+                }
+            }
+        }
+    }
+
+    koalac::TranslatorOptions translatorOptions;
+    translatorOptions.Dense = args.contains("--dense");
+
+    if(args.contains("--stream")){
+        return compileStreaming(argv[1], outputPath(args, argv[1]), &host, registersCount, translatorOptions);
+    }
+
+    koalac::CompileOptions compileOptions;
+    compileOptions.Dense = translatorOptions.Dense;
+    compileOptions.Optimize = args.contains("-O") || args.contains("-O2");
+    if(args.contains("-O2")) compileOptions.UnrollFactor = unrollFactor;
+    compileOptions.RegistersCount = registersCount;
+    compileOptions.Jobs = jobs;
+    compileOptions.Host = &host;
+
+    KoalaProfile profile{};
+    if(args.contains("--profile-use")){
+        if(koalaProfileRead(args["--profile-use"].c_str(), &profile) != 0){
+            std::cerr << "Failed to read profile: " << args["--profile-use"] << "\n";
             return -1;
         }
-        
-        bc = koalac::translateToBytecode(program);
+        compileOptions.Profile = &profile;
+    }
+
+    koalac::CompileResult compiled = koalac::compile(source, compileOptions);
+    if(compileOptions.Profile) koalaProfileDestroy(&profile);
+
+    if(!compiled.IsSuccess()){
+        koalac::printCompileErrors(compiled.Errors);
+        return -1;
+    }
+    for(const std::string& warning : compiled.Warnings){
+        std::cerr << "Warning: " << warning << "\n";
+    }
+    if(compileOptions.Optimize){
+        std::cout << "Optimized: " << compiled.UnreachableBlocks << " unreachable blocks, " << compiled.DeadStores << " dead stores, "
+            << compiled.ThreadedJumps << " threaded jumps, " << compiled.RemovedJumps << " fallthrough jumps removed\n";
+    }
+    if(compileOptions.UnrollFactor >= 2){
+        std::cout << "Unrolled " << compiled.UnrolledLoops << " loops (" << compiled.FullyUnrolledLoops << " fully, " << compiled.RemainderLoops
+            << " with a remainder loop), " << compiled.UnrollGrowth << " bytes added\n";
+    }
+    if(compiled.VirtualRegisters > 0){
+        std::cout << "Allocated " << compiled.VirtualRegisters << " virtual registers: " << compiled.SpilledRegisters << " spilled, "
+            << compiled.CoalescedMoves << " copies coalesced\n";
     }
 
     { //saving bytecode to file
-        std::string outName;
-
-        if(args.contains("-o")){
-            outName = args["-o"];
-        } else {
-            std::string inputPath = argv[1];
-            size_t lastDot = inputPath.find_last_of(".");
-            if(lastDot != std::string::npos){
-                outName = inputPath.substr(0, lastDot) + ".klbc"; //klbc is Koala Bytecode
-            } else {
-                outName = inputPath + ".klbc";
-            }
-        }
+        koalac::TimeTraceScope trace("Write output");
+        std::string outName = outputPath(args, argv[1]);
 
         std::ofstream outFs(outName, std::ios::out | std::ios::binary);
         if(!outFs){
@@ -102,8 +327,8 @@ int main(int argc, char** argv){
             return -1;
         }
 
-        outFs.write(reinterpret_cast<const char*>(KOALA_MAGIC_BYTES), static_cast<std::streamsize>(5));
-        outFs.write(reinterpret_cast<const char*>(bc.data()), static_cast<std::streamsize>(bc.size()));
+        writeHeader(outFs, compiled.RegistersUsed);
+        outFs.write(reinterpret_cast<const char*>(compiled.Body.data()), static_cast<std::streamsize>(compiled.Body.size()));
         if(!outFs.good()){
             std::cerr << "Error occured while writing bytecode data.\n";
             return -1;
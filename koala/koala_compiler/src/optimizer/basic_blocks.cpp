@@ -0,0 +1,120 @@
+#include "optimizer/basic_blocks.hpp"
+
+#include <format>
+#include <unordered_set>
+
+namespace koalac{
+
+    bool isJump(OpCode op){
+        return findJumpFamily(op) != nullptr;
+    }
+
+    bool isConditionalJump(OpCode op){
+        const JumpFamily* family = findJumpFamily(op);
+        return family && family->Short != OpCode::JMP_SHORT;
+    }
+
+    std::string& jumpTarget(IRInstruction& instr){
+        for(auto& arg : instr.Args){
+            if(std::holds_alternative<std::string>(arg)) return std::get<std::string>(arg);
+        }
+        throw std::runtime_error("Jump without a label operand");
+    }
+
+    IRInstruction* BasicBlock::Terminator() const{
+        if(Instructions.empty()) return nullptr;
+
+        IRInstruction* last = Instructions.back().get();
+        return last->Op == OpCode::RET || isJump(last->Op) ? last : nullptr;
+    }
+
+    bool BasicBlock::FallsThrough() const{
+        IRInstruction* terminator = Terminator();
+        return !terminator || isConditionalJump(terminator->Op);
+    }
+
+    BasicBlocks splitBasicBlocks(IRProgram& program){
+        BasicBlocks blocks;
+        bool startNew = true;
+
+        //labels synthesized by an earlier split are in the program now
+        std::unordered_set<std::string> taken;
+        for(const auto& node : program.GetNodes()){
+            if(auto* label = dynamic_cast<IRLabel*>(node.get())) taken.insert(label->Label);
+        }
+        size_t nextSynthesized = 0;
+
+        for(auto& node : program.GetNodes()){
+            if(auto* label = dynamic_cast<IRLabel*>(node.get())){
+                if(startNew || !blocks.back().Instructions.empty()){
+                    blocks.emplace_back();
+                    startNew = false;
+                }
+                blocks.back().Labels.push_back(*label);
+            } else if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
+                if(startNew){
+                    std::string name;
+                    do{
+                        name = std::format("@bb{}", nextSynthesized++);
+                    } while(taken.contains(name));
+
+                    blocks.emplace_back();
+                    blocks.back().Labels.emplace_back(name, instr->Span);
+                    startNew = false;
+                }
+
+                node.release();
+                blocks.back().Instructions.emplace_back(instr);
+                startNew = instr->Op == OpCode::RET || isJump(instr->Op);
+            }
+        }
+
+        program.GetNodes().clear();
+        return blocks;
+    }
+
+    void joinBasicBlocks(IRProgram& program, BasicBlocks& blocks){
+        IRNodes& nodes = program.GetNodes();
+        nodes.clear();
+
+        for(BasicBlock& block : blocks){
+            for(const IRLabel& label : block.Labels){
+                nodes.push_back(std::make_unique<IRLabel>(label));
+            }
+            for(auto& instr : block.Instructions){
+                nodes.push_back(std::move(instr));
+            }
+        }
+
+        blocks.clear();
+    }
+
+    std::unordered_map<std::string, size_t> blockIndex(const BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index;
+        for(size_t i = 0; i < blocks.size(); ++i){
+            for(const IRLabel& label : blocks[i].Labels) index[label.Label] = i;
+        }
+        return index;
+    }
+
+    std::vector<size_t> blockSuccessors(const BasicBlocks& blocks, const std::unordered_map<std::string, size_t>& index, size_t i){
+        std::vector<size_t> successors;
+        IRInstruction* terminator = blocks[i].Terminator();
+
+        if(terminator && terminator->Op != OpCode::RET) successors.push_back(index.at(jumpTarget(*terminator)));
+        if(blocks[i].FallsThrough() && i + 1 < blocks.size()) successors.push_back(i + 1);
+        return successors;
+    }
+
+    bool hasUndefinedLabels(const BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+
+        for(const BasicBlock& block : blocks){
+            for(const auto& instr : block.Instructions){
+                if(isJump(instr->Op) && !index.contains(jumpTarget(*instr))) return true;
+            }
+        }
+        return false;
+    }
+
+}
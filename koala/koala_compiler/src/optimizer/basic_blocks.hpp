@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ir.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace koalac{
+
+    struct BasicBlock{
+        std::vector<IRLabel> Labels; //never empty, Labels[0] names the block
+        std::vector<std::unique_ptr<IRInstruction>> Instructions;
+
+        inline const std::string& Name() const { return Labels.front().Label; }
+
+        // Last instruction when it is a jump or `ret`, nullptr when the block just
+        // runs into the next one.
+        IRInstruction* Terminator() const;
+        // Whether execution may continue with the block laid out after this one.
+        bool FallsThrough() const;
+    };
+
+    using BasicBlocks = std::vector<BasicBlock>;
+
+    bool isJump(OpCode op);
+    bool isConditionalJump(OpCode op);
+    // Label operand of a jump.
+    std::string& jumpTarget(IRInstruction& instr);
+
+    // Moves the program's nodes into basic blocks, in program order. A block starts at
+    // a label or after a jump or `ret`; blocks without a source label get a synthesized
+    // one ("@bb<N>", which the lexer cannot produce).
+    BasicBlocks splitBasicBlocks(IRProgram& program);
+    // Moves the blocks back into the program in their current order.
+    void joinBasicBlocks(IRProgram& program, BasicBlocks& blocks);
+
+    // Block index of every label.
+    std::unordered_map<std::string, size_t> blockIndex(const BasicBlocks& blocks);
+    // Blocks control may reach right after block `i`, in program order.
+    std::vector<size_t> blockSuccessors(const BasicBlocks& blocks, const std::unordered_map<std::string, size_t>& index, size_t i);
+    // Whether a jump targets a label no block has; blockSuccessors needs every target.
+    bool hasUndefinedLabels(const BasicBlocks& blocks);
+
+}
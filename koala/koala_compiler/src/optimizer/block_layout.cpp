@@ -0,0 +1,155 @@
+#include "optimizer/block_layout.hpp"
+#include "optimizer/basic_blocks.hpp"
+
+#include <algorithm>
+
+namespace koalac{
+
+    struct LayoutEdge{
+        size_t From;
+        size_t To;
+        uint64_t Weight;
+    };
+
+    // Edge the block has no say in: it runs into the next block without a jump, which
+    // would cost an extra instruction to break.
+    static constexpr uint64_t FallthroughWeight = UINT64_MAX;
+
+    // Rewrites a conditional jump to branch on the opposite condition. IMM16 ordered
+    // compares have no operand-swapped form and are left alone.
+    static bool invertCondition(IRInstruction& instr){
+        const JumpFamily* family = findJumpFamily(instr.Op);
+        bool swap = false;
+
+        switch(family->Short){
+            case OpCode::JEZ_SHORT:         instr.Op = OpCode::JNZ_SHORT; break;
+            case OpCode::JNZ_SHORT:         instr.Op = OpCode::JEZ_SHORT; break;
+            case OpCode::JEQ_REG_SHORT:     instr.Op = OpCode::JNE_REG_SHORT; break;
+            case OpCode::JNE_REG_SHORT:     instr.Op = OpCode::JEQ_REG_SHORT; break;
+            case OpCode::JEQ_IMM16_SHORT:   instr.Op = OpCode::JNE_IMM16_SHORT; break;
+            case OpCode::JNE_IMM16_SHORT:   instr.Op = OpCode::JEQ_IMM16_SHORT; break;
+            //!(a < b) == (b <= a)
+            case OpCode::JLT_REG_SHORT:     instr.Op = OpCode::JLE_REG_SHORT; swap = true; break;
+            case OpCode::JLE_REG_SHORT:     instr.Op = OpCode::JLT_REG_SHORT; swap = true; break;
+            case OpCode::JLTU_REG_SHORT:    instr.Op = OpCode::JLEU_REG_SHORT; swap = true; break;
+            case OpCode::JLEU_REG_SHORT:    instr.Op = OpCode::JLTU_REG_SHORT; swap = true; break;
+            default: return false;
+        }
+
+        if(swap) std::swap(instr.Args[0], instr.Args[1]);
+        return true;
+    }
+
+    static std::unique_ptr<IRInstruction> makeJump(const std::string& target, struct Span span){
+        return std::make_unique<IRInstruction>(OpCode::_JMP_UNDEFINED, std::vector<IRArg>{ target }, span);
+    }
+
+    bool layoutBlocks(IRProgram& program, const KoalaProfile& profile){
+        BasicBlocks blocks = splitBasicBlocks(program);
+        if(blocks.size() < 2 || blocks.back().FallsThrough()){
+            //running off the end of the bytecode has to stay where it is
+            joinBasicBlocks(program, blocks);
+            return false;
+        }
+
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        std::vector<LayoutEdge> edges;
+        std::vector<uint64_t> heat(blocks.size(), 0);
+
+        for(size_t i = 0; i < blocks.size(); ++i){
+            IRInstruction* terminator = blocks[i].Terminator();
+
+            if(!terminator){
+                edges.push_back({ i, i + 1, FallthroughWeight });
+                continue;
+            }
+            if(terminator->Op == OpCode::RET) continue;
+
+            uint64_t taken = 0, notTaken = 0;
+            if(terminator->Offset < profile.bytecodeSize){
+                taken = profile.taken[terminator->Offset];
+                notTaken = profile.notTaken[terminator->Offset];
+            }
+            heat[i] = taken + notTaken;
+
+            edges.push_back({ i, index.at(jumpTarget(*terminator)), taken });
+            if(isConditionalJump(terminator->Op)) edges.push_back({ i, i + 1, notTaken });
+        }
+
+        //blocks without a counted jump are as hot as the edges entering them
+        for(const LayoutEdge& edge : edges){
+            if(edge.Weight != FallthroughWeight && heat[edge.To] < edge.Weight) heat[edge.To] = edge.Weight;
+        }
+
+        //chain along the heaviest edges first
+        std::stable_sort(edges.begin(), edges.end(), [](const LayoutEdge& a, const LayoutEdge& b){ return a.Weight > b.Weight; });
+
+        std::vector<std::vector<size_t>> chains(blocks.size());
+        std::vector<size_t> chainOf(blocks.size());
+        for(size_t i = 0; i < blocks.size(); ++i){
+            chains[i] = { i };
+            chainOf[i] = i;
+        }
+
+        for(const LayoutEdge& edge : edges){
+            if(edge.Weight == 0 && edge.To != edge.From + 1) continue; //cold code keeps its source order
+            if(edge.To == 0) continue; //entry stays the head of its chain
+
+            size_t from = chainOf[edge.From], to = chainOf[edge.To];
+            if(from == to || chains[from].back() != edge.From || chains[to].front() != edge.To) continue;
+
+            for(size_t block : chains[to]) chainOf[block] = from;
+            chains[from].insert(chains[from].end(), chains[to].begin(), chains[to].end());
+            chains[to].clear();
+        }
+
+        //entry chain first, then hottest chains first, ties in source order
+        std::vector<size_t> chainOrder;
+        for(size_t i = 0; i < chains.size(); ++i){
+            if(!chains[i].empty() && i != chainOf[0]) chainOrder.push_back(i);
+        }
+
+        auto chainHeat = [&](size_t chain){
+            uint64_t result = 0;
+            for(size_t block : chains[chain]) result = std::max(result, heat[block]);
+            return result;
+        };
+        std::stable_sort(chainOrder.begin(), chainOrder.end(), [&](size_t a, size_t b){ return chainHeat(a) > chainHeat(b); });
+        chainOrder.insert(chainOrder.begin(), chainOf[0]);
+
+        std::vector<size_t> order;
+        for(size_t chain : chainOrder) order.insert(order.end(), chains[chain].begin(), chains[chain].end());
+
+        //make every block reach its successors from its new position
+        for(size_t k = 0; k < order.size(); ++k){
+            BasicBlock& block = blocks[order[k]];
+            size_t next = k + 1 < order.size() ? order[k + 1] : SIZE_MAX;
+            size_t fallthrough = order[k] + 1;
+            IRInstruction* terminator = block.Terminator();
+
+            if(terminator && terminator->Op == OpCode::RET) continue;
+
+            if(terminator && !isConditionalJump(terminator->Op)){
+                if(index.at(jumpTarget(*terminator)) == next) block.Instructions.pop_back();
+                continue;
+            }
+
+            if(fallthrough == next) continue;
+
+            struct Span span = block.Instructions.empty() ? block.Labels.front().Span : block.Instructions.back()->Span;
+            if(terminator && index.at(jumpTarget(*terminator)) == next && invertCondition(*terminator)){
+                jumpTarget(*terminator) = blocks[fallthrough].Name();
+            } else {
+                block.Instructions.push_back(makeJump(blocks[fallthrough].Name(), span));
+            }
+        }
+
+        BasicBlocks laidOut;
+        laidOut.reserve(blocks.size());
+        for(size_t block : order) laidOut.push_back(std::move(blocks[block]));
+
+        joinBasicBlocks(program, laidOut);
+        return true;
+    }
+
+}
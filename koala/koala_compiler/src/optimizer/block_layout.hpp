@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ir.hpp"
+#include <KoalaCore>
+
+namespace koalac{
+
+    // Profile-guided basic-block placement (Pettis-Hansen chaining): blocks joined by
+    // the hottest edges become fallthrough chains, chains are laid out hottest first
+    // with never-executed code at the end, and jumps are inverted, added or dropped to
+    // match the new order.
+    //
+    // The program must have been translated to exactly the bytecode the profile was
+    // recorded on, so that instruction offsets are the profiled pcs. Returns false and
+    // leaves the program as it was when the layout cannot be applied.
+    bool layoutBlocks(IRProgram& program, const KoalaProfile& profile);
+
+}
@@ -0,0 +1,148 @@
+#include "optimizer/liveness.hpp"
+
+namespace koalac{
+
+    static RegisterMask registerBit(const IRArg& arg){
+        if(!std::holds_alternative<uint8_t>(arg)) return 0;
+
+        uint8_t reg = std::get<uint8_t>(arg);
+        return reg < 64 ? RegisterMask(1) << reg : 0;
+    }
+
+    // Instructions whose only effect is writing their first operand.
+    static bool isPure(OpCode op){
+        switch(op){
+            case OpCode::MOV_IMM16: case OpCode::MOV_IMM64: case OpCode::MOV_REG:
+            case OpCode::INC_REG:   case OpCode::DEC_REG:
+            case OpCode::ADD_IMM16: case OpCode::ADD_REG:
+            case OpCode::SUB_IMM16: case OpCode::SUB_IMM16_R: case OpCode::SUB_REG:
+            case OpCode::MUL_IMM16: case OpCode::MUL_REG:
+            case OpCode::NEG_IMM16: case OpCode::NEG_REG:
+            case OpCode::AND_IMM16: case OpCode::AND_REG:
+            case OpCode::OR_IMM16:  case OpCode::OR_REG:
+            case OpCode::XOR_IMM16: case OpCode::XOR_REG:
+            case OpCode::NOT_IMM16: case OpCode::NOT_REG:
+            case OpCode::SHL_IMM16: case OpCode::SHL_IMM16_R: case OpCode::SHL_REG:
+            case OpCode::SHR_IMM16: case OpCode::SHR_IMM16_R: case OpCode::SHR_REG:
+            case OpCode::SAR_IMM16: case OpCode::SAR_IMM16_R: case OpCode::SAR_REG:
+            case OpCode::SETEQ_REG:  case OpCode::SETEQ_IMM16:
+            case OpCode::SETNE_REG:  case OpCode::SETNE_IMM16:
+            case OpCode::SETLT_REG:  case OpCode::SETLT_IMM16:
+            case OpCode::SETLE_REG:  case OpCode::SETLE_IMM16:
+            case OpCode::SETLTU_REG: case OpCode::SETLTU_IMM16:
+            case OpCode::SETLEU_REG: case OpCode::SETLEU_IMM16:
+            case OpCode::CMOV:      case OpCode::SELECT:
+            case OpCode::POPCNT_REG: case OpCode::CLZ_REG: case OpCode::CTZ_REG: case OpCode::BSWAP_REG:
+            case OpCode::ROL_IMM16: case OpCode::ROL_REG:
+            case OpCode::ROR_IMM16: case OpCode::ROR_REG:
+            case OpCode::MULHI_REG: case OpCode::MULHIU_REG:
+            case OpCode::MIN_IMM16: case OpCode::MIN_REG:
+            case OpCode::MAX_IMM16: case OpCode::MAX_REG:
+            case OpCode::MINU_IMM16: case OpCode::MINU_REG:
+            case OpCode::MAXU_IMM16: case OpCode::MAXU_REG:
+            case OpCode::RELOAD:
+                return true;
+
+            //division traps on zero, loads fault out of bounds
+            default:
+                return false;
+        }
+    }
+
+    static bool readsDestination(OpCode op){
+        return op == OpCode::INC_REG || op == OpCode::DEC_REG || op == OpCode::CMOV;
+    }
+
+    // Besides the pure ones: instructions writing their first operand that may also
+    // trap, touch memory or do I/O.
+    static bool writesDestination(OpCode op){
+        switch(op){
+            case OpCode::LOAD8: case OpCode::LOAD16: case OpCode::LOAD32: case OpCode::LOAD64:
+            case OpCode::IDIV_IMM16: case OpCode::IDIV_IMM16_R: case OpCode::IDIV_REG:
+            case OpCode::DIV_IMM16:  case OpCode::DIV_IMM16_R:  case OpCode::DIV_REG:
+            case OpCode::IREM_IMM16: case OpCode::IREM_IMM16_R: case OpCode::IREM_REG:
+            case OpCode::REM_IMM16:  case OpCode::REM_IMM16_R:  case OpCode::REM_REG:
+            case OpCode::READ_U8: case OpCode::READ_U64: case OpCode::READ_EOF:
+            case OpCode::CALLHOST:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    RegisterUsage registerUsage(const IRInstruction& instr){
+        RegisterUsage usage;
+
+        switch(instr.Op){
+            //the host and a snapshot see the whole register file, and it is the program result
+            case OpCode::RET:
+            case OpCode::CHECKPOINT:
+            case OpCode::CALLHOST:
+                usage.Uses = AllRegisters;
+                return usage;
+            default: break;
+        }
+
+        usage.Pure = isPure(instr.Op);
+        for(size_t i = 0; i < instr.Args.size(); ++i){
+            RegisterMask bit = registerBit(instr.Args[i]);
+            if(usage.Pure && i == 0){
+                usage.Defs |= bit;
+                if(readsDestination(instr.Op)) usage.Uses |= bit;
+            } else {
+                usage.Uses |= bit;
+            }
+        }
+        return usage;
+    }
+
+    OperandAccess operandAccess(const IRInstruction& instr){
+        OperandAccess access;
+        uint8_t operands = static_cast<uint8_t>((1u << instr.Args.size()) - 1);
+
+        //recv and tryrecv: the value and the ok flag
+        if(instr.Op == OpCode::RECV || instr.Op == OpCode::TRYRECV) access.Writes = 0b11;
+        else if(isPure(instr.Op) || writesDestination(instr.Op)) access.Writes = 0b1;
+
+        access.Reads = operands & ~access.Writes;
+        if(readsDestination(instr.Op)) access.Reads |= 0b1;
+        return access;
+    }
+
+    std::vector<BlockLiveness> computeLiveness(const BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        std::vector<BlockLiveness> liveness(blocks.size());
+
+        std::vector<std::vector<size_t>> successors(blocks.size());
+        std::vector<RegisterMask> uses(blocks.size(), 0), defs(blocks.size(), 0);
+        for(size_t i = 0; i < blocks.size(); ++i){
+            successors[i] = blockSuccessors(blocks, index, i);
+
+            //upward-exposed uses and kills of the whole block
+            for(auto it = blocks[i].Instructions.rbegin(); it != blocks[i].Instructions.rend(); ++it){
+                RegisterUsage usage = registerUsage(**it);
+                uses[i] = (uses[i] & ~usage.Defs) | usage.Uses;
+                defs[i] |= usage.Defs;
+            }
+        }
+
+        bool changed = true;
+        while(changed){
+            changed = false;
+
+            for(size_t i = blocks.size(); i-- > 0;){
+                RegisterMask liveOut = blocks[i].FallsThrough() && i + 1 == blocks.size() ? AllRegisters : 0;
+                for(size_t succ : successors[i]) liveOut |= liveness[succ].LiveIn;
+
+                RegisterMask liveIn = uses[i] | (liveOut & ~defs[i]);
+                if(liveIn != liveness[i].LiveIn || liveOut != liveness[i].LiveOut){
+                    liveness[i] = { liveIn, liveOut };
+                    changed = true;
+                }
+            }
+        }
+
+        return liveness;
+    }
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "optimizer/basic_blocks.hpp"
+#include <vm_config.h>
+#include <cstdint>
+#include <vector>
+
+namespace koalac{
+
+    // One bit per VM register.
+    using RegisterMask = uint64_t;
+
+    // Covers the largest register file, so it holds whatever --registers targets.
+    static_assert(KOALA_CORE_VM_REGISTERS_MAX <= 64, "RegisterMask holds at most 64 registers");
+    inline constexpr RegisterMask AllRegisters = ~RegisterMask(0);
+
+    struct RegisterUsage{
+        RegisterMask Uses = 0;
+        RegisterMask Defs = 0;
+        // Only writes Defs: may be dropped when none of them is read afterwards.
+        bool Pure = false;
+    };
+
+    // Registers read and written by an instruction (before dense encoding). Anything
+    // not known to be pure is assumed to read every register operand and to write
+    // none, which keeps liveness conservative.
+    RegisterUsage registerUsage(const IRInstruction& instr);
+
+    // Operands an instruction reads and writes, one bit per operand index (bits of
+    // immediates and labels mean nothing). Unlike registerUsage this is exact for every
+    // instruction, as the register allocator needs it; RET, CHECKPOINT and CALLHOST also
+    // observe the register file as a whole, which is left to the caller.
+    struct OperandAccess{
+        uint8_t Reads = 0;
+        uint8_t Writes = 0;
+    };
+
+    OperandAccess operandAccess(const IRInstruction& instr);
+
+    struct BlockLiveness{
+        RegisterMask LiveIn = 0;
+        RegisterMask LiveOut = 0;
+    };
+
+    // Backward dataflow over the blocks. Every register is live where the program ends:
+    // at `ret` and when running off the last block.
+    std::vector<BlockLiveness> computeLiveness(const BasicBlocks& blocks);
+
+}
@@ -0,0 +1,378 @@
+#include "optimizer/loop_unroll.hpp"
+#include "optimizer/basic_blocks.hpp"
+#include "optimizer/liveness.hpp"
+
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <unordered_set>
+
+namespace koalac{
+
+    using Instructions = std::vector<std::unique_ptr<IRInstruction>>;
+
+    enum class ExitTest{
+        NotEqual,       //jnz (against 0), jne
+        Below,          //jltu
+        BelowOrEqual    //jleu
+    };
+
+    // Register the exit test of a loop depends on, see unrollLoops.
+    struct LoopCounter{
+        uint8_t Register = 0;
+        size_t Update = 0;      //index of the instruction stepping it
+        uint64_t Step = 0;      //added per iteration, modulo 2^64
+        bool Fusable = false;   //the rest of the body neither reads it nor may stop the program
+        ExitTest Test = ExitTest::NotEqual;
+        std::optional<uint64_t> Bound;
+        std::optional<uint8_t> BoundRegister;
+    };
+
+    struct UnrolledLoop{
+        BasicBlocks Blocks;     //replace the loop's block, the first one keeps its labels
+        bool Full = false;
+        bool Remainder = false;
+    };
+
+    // Synthesized labels, "@unroll<N>": the lexer cannot produce them either.
+    struct LabelNames{
+        std::unordered_set<std::string> Taken;
+        size_t Next = 0;
+
+        IRLabel Make(struct Span span){
+            std::string name;
+            do{
+                name = std::format("@unroll{}", Next++);
+            } while(Taken.contains(name));
+
+            Taken.insert(name);
+            return IRLabel(name, span);
+        }
+    };
+
+    static std::optional<uint8_t> registerOf(const IRArg& arg){
+        if(!std::holds_alternative<uint8_t>(arg)) return std::nullopt;
+        return std::get<uint8_t>(arg);
+    }
+
+    // The VM sign-extends 16-bit immediates.
+    static uint64_t imm16Value(const IRArg& arg){
+        return static_cast<uint64_t>(static_cast<int64_t>(static_cast<int16_t>(std::get<uint16_t>(arg))));
+    }
+
+    static bool writesRegister(const IRInstruction& instr, uint8_t reg){
+        OperandAccess access = operandAccess(instr);
+        for(size_t i = 0; i < instr.Args.size(); ++i){
+            if(((access.Writes >> i) & 1) && registerOf(instr.Args[i]) == reg) return true;
+        }
+        return false;
+    }
+
+    static bool readsRegister(const IRInstruction& instr, uint8_t reg){
+        OperandAccess access = operandAccess(instr);
+        for(size_t i = 0; i < instr.Args.size(); ++i){
+            if(((access.Reads >> i) & 1) && registerOf(instr.Args[i]) == reg) return true;
+        }
+        return false;
+    }
+
+    static size_t codeSize(const Instructions& instructions){
+        size_t size = 0;
+        for(const auto& instr : instructions) size += instr->GetSize();
+        return size;
+    }
+
+    static bool isSelfLoop(const BasicBlock& block){
+        IRInstruction* terminator = block.Terminator();
+        if(!terminator || !isConditionalJump(terminator->Op)) return false;
+
+        const std::string& target = jumpTarget(*terminator);
+        return std::any_of(block.Labels.begin(), block.Labels.end(), [&](const IRLabel& label){ return label.Label == target; });
+    }
+
+    // Constant step of `instr` on `reg`, which it writes.
+    static std::optional<uint64_t> stepOf(const IRInstruction& instr, uint8_t reg){
+        switch(instr.Op){
+            case OpCode::INC_REG: return 1;
+            case OpCode::DEC_REG: return UINT64_MAX;
+            case OpCode::ADD_IMM16:
+                if(registerOf(instr.Args[1]) == reg && imm16Value(instr.Args[2]) != 0) return imm16Value(instr.Args[2]);
+                return std::nullopt;
+            case OpCode::SUB_IMM16:
+                if(registerOf(instr.Args[1]) == reg && imm16Value(instr.Args[2]) != 0) return 0 - imm16Value(instr.Args[2]);
+                return std::nullopt;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    static std::optional<LoopCounter> findCounter(const BasicBlock& loop){
+        const IRInstruction& exit = *loop.Instructions.back();
+        LoopCounter counter;
+
+        switch(findJumpFamily(exit.Op)->Short){
+            case OpCode::JNZ_SHORT:         counter.Test = ExitTest::NotEqual; counter.Bound = 0; break;
+            case OpCode::JNE_REG_SHORT:
+            case OpCode::JNE_IMM16_SHORT:   counter.Test = ExitTest::NotEqual; break;
+            case OpCode::JLTU_REG_SHORT:
+            case OpCode::JLTU_IMM16_SHORT:  counter.Test = ExitTest::Below; break;
+            case OpCode::JLEU_REG_SHORT:
+            case OpCode::JLEU_IMM16_SHORT:  counter.Test = ExitTest::BelowOrEqual; break;
+            default: return std::nullopt;
+        }
+
+        std::optional<uint8_t> reg = registerOf(exit.Args[0]);
+        if(!reg) return std::nullopt;
+        counter.Register = *reg;
+
+        if(!counter.Bound){
+            if(std::holds_alternative<uint16_t>(exit.Args[1])) counter.Bound = imm16Value(exit.Args[1]);
+            else counter.BoundRegister = registerOf(exit.Args[1]);
+
+            if(!counter.Bound && (!counter.BoundRegister || counter.BoundRegister == counter.Register)) return std::nullopt;
+        }
+
+        std::optional<size_t> update;
+        bool observed = false;
+        for(size_t k = 0; k + 1 < loop.Instructions.size(); ++k){
+            const IRInstruction& instr = *loop.Instructions[k];
+            if(instr.Op == OpCode::CALLHOST) return std::nullopt;
+            if(counter.BoundRegister && writesRegister(instr, *counter.BoundRegister)) return std::nullopt;
+
+            if(writesRegister(instr, counter.Register)){
+                std::optional<uint64_t> step = stepOf(instr, counter.Register);
+                if(update || !step) return std::nullopt;
+
+                update = k;
+                counter.Step = *step;
+            } else if(readsRegister(instr, counter.Register) || !registerUsage(instr).Pure){
+                observed = true; //a trap or a checkpoint shows the register file as it is
+            }
+        }
+        if(!update) return std::nullopt;
+
+        counter.Update = *update;
+        counter.Fusable = !observed;
+        return counter;
+    }
+
+    // Value `reg` has when control leaves `block`, if a mov of a constant sets it there.
+    static std::optional<uint64_t> constantAtEnd(const BasicBlock& block, uint8_t reg){
+        for(auto it = block.Instructions.rbegin(); it != block.Instructions.rend(); ++it){
+            const IRInstruction& instr = **it;
+            if(instr.Op == OpCode::CALLHOST) return std::nullopt; //the host may write any register
+            if(!writesRegister(instr, reg)) continue;
+
+            if(instr.Op == OpCode::MOV_IMM16) return imm16Value(instr.Args[1]);
+            if(instr.Op == OpCode::MOV_IMM64) return std::get<uint64_t>(instr.Args[1]);
+            return std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+    // Iterations of a loop entered with its counter at `start`. nullopt when there is no
+    // simple closed form: the counter steps past the bound or wraps around first.
+    static std::optional<uint64_t> tripCount(const LoopCounter& counter, uint64_t start, uint64_t bound){
+        bool down = static_cast<int64_t>(counter.Step) < 0;
+        uint64_t magnitude = down ? 0 - counter.Step : counter.Step;
+
+        if(counter.Test == ExitTest::NotEqual){
+            //start + n * step == bound modulo 2^64, for the smallest n
+            uint64_t distance = down ? start - bound : bound - start;
+            if(distance == 0 || distance % magnitude != 0) return std::nullopt;
+            return distance / magnitude;
+        }
+
+        if(down) return std::nullopt;
+        uint64_t trips;
+        if(counter.Test == ExitTest::Below) trips = start >= bound ? 1 : (bound - start) / magnitude + ((bound - start) % magnitude != 0);
+        else trips = start > bound ? 1 : (bound - start) / magnitude + 1;
+
+        unsigned __int128 last = static_cast<unsigned __int128>(start) + static_cast<unsigned __int128>(trips) * magnitude;
+        if(last > UINT64_MAX) return std::nullopt;
+        return trips;
+    }
+
+    // `count` iterations of the loop body without the exit test. With a fusable counter
+    // only the last copy steps it, by the amount of all of them.
+    static void appendIterations(Instructions& out, const BasicBlock& loop, const LoopCounter& counter, uint64_t count){
+        bool down = static_cast<int64_t>(counter.Step) < 0;
+        uint64_t magnitude = down ? 0 - counter.Step : counter.Step;
+        bool fuse = counter.Fusable && count > 1 && magnitude <= INT16_MAX / count;
+
+        for(uint64_t n = 0; n < count; ++n){
+            for(size_t k = 0; k + 1 < loop.Instructions.size(); ++k){
+                const IRInstruction& instr = *loop.Instructions[k];
+                if(!fuse || k != counter.Update){
+                    out.push_back(std::make_unique<IRInstruction>(instr));
+                } else if(n + 1 == count){
+                    uint16_t amount = static_cast<uint16_t>(magnitude * count);
+                    out.push_back(std::make_unique<IRInstruction>(down ? OpCode::SUB_IMM16 : OpCode::ADD_IMM16,
+                        std::vector<IRArg>{ counter.Register, counter.Register, amount }, instr.Span));
+                }
+            }
+        }
+    }
+
+    static std::unique_ptr<IRInstruction> retargeted(const IRInstruction& jump, const std::string& target){
+        auto copy = std::make_unique<IRInstruction>(jump);
+        jumpTarget(*copy) = target;
+        return copy;
+    }
+
+    // Trip count known on entry: peel the leftover iterations, then test once per round.
+    static std::optional<UnrolledLoop> unrollCounted(const BasicBlock& loop, const LoopCounter& counter, uint64_t trips, size_t factor, size_t bodySize, LabelNames& names){
+        const IRInstruction& exit = *loop.Instructions.back();
+        uint64_t rounds = trips / factor, peeled = trips % factor;
+        UnrolledLoop unrolled;
+
+        unrolled.Blocks.emplace_back();
+        unrolled.Blocks.back().Labels = loop.Labels;
+
+        if(rounds <= 1 && trips * bodySize <= UnrollMaxUnrolledSize){
+            appendIterations(unrolled.Blocks.back().Instructions, loop, counter, trips);
+            unrolled.Full = true;
+            return unrolled;
+        }
+
+        if(peeled != 0){
+            appendIterations(unrolled.Blocks.back().Instructions, loop, counter, peeled);
+            unrolled.Blocks.emplace_back();
+            unrolled.Blocks.back().Labels.push_back(names.Make(exit.Span));
+        }
+        BasicBlock& body = unrolled.Blocks.back();
+        appendIterations(body.Instructions, loop, counter, factor);
+        body.Instructions.push_back(retargeted(exit, body.Name()));
+        return unrolled;
+    }
+
+    // Trip count unknown: a guard enters the unrolled body only when the next `factor`
+    // iterations all pass the exit test but maybe the last; the original loop finishes.
+    static std::optional<UnrolledLoop> unrollGuarded(const BasicBlock& loop, const LoopCounter& counter, size_t factor, const std::string& exitLabel, LabelNames& names){
+        if(!counter.Bound || *counter.Bound > INT16_MAX) return std::nullopt;
+
+        bool down = static_cast<int64_t>(counter.Step) < 0;
+        uint64_t magnitude = down ? 0 - counter.Step : counter.Step;
+        if(magnitude > INT16_MAX) return std::nullopt;
+
+        //the counter moves by `reach` up to the last test inside the unrolled body
+        uint64_t bound = *counter.Bound, reach = (factor - 1) * magnitude;
+        OpCode guardOp;
+        uint64_t guardImm;
+        bool guardEnters; //jumps to the unrolled body, else to the remainder loop
+
+        if(down && counter.Test == ExitTest::NotEqual){
+            guardOp = OpCode::JLEU_IMM16_SHORT; guardImm = bound + reach; guardEnters = false;
+        } else if(!down && counter.Test != ExitTest::BelowOrEqual && bound > reach){
+            guardOp = OpCode::JLTU_IMM16_SHORT; guardImm = bound - reach; guardEnters = true;
+        } else if(!down && counter.Test == ExitTest::BelowOrEqual && bound >= reach){
+            guardOp = OpCode::JLEU_IMM16_SHORT; guardImm = bound - reach; guardEnters = true;
+        } else {
+            return std::nullopt;
+        }
+        if(guardImm > INT16_MAX) return std::nullopt;
+
+        const IRInstruction& exit = *loop.Instructions.back();
+        BasicBlock guard, body, remainder, leave;
+        guard.Labels = loop.Labels;
+        body.Labels.push_back(names.Make(exit.Span));
+        remainder.Labels.push_back(names.Make(exit.Span));
+        leave.Labels.push_back(names.Make(exit.Span));
+
+        guard.Instructions.push_back(std::make_unique<IRInstruction>(guardOp,
+            std::vector<IRArg>{ counter.Register, static_cast<uint16_t>(guardImm), guardEnters ? body.Name() : remainder.Name() }, exit.Span));
+
+        appendIterations(body.Instructions, loop, counter, factor);
+        body.Instructions.push_back(retargeted(exit, loop.Name()));
+
+        appendIterations(remainder.Instructions, loop, counter, 1);
+        remainder.Instructions.push_back(retargeted(exit, remainder.Name()));
+
+        leave.Instructions.push_back(std::make_unique<IRInstruction>(OpCode::_JMP_UNDEFINED, std::vector<IRArg>{ exitLabel }, exit.Span));
+
+        //whichever the guard does not jump to comes first and leaves through `leave`
+        UnrolledLoop unrolled;
+        unrolled.Remainder = true;
+        unrolled.Blocks.push_back(std::move(guard));
+        unrolled.Blocks.push_back(std::move(guardEnters ? remainder : body));
+        unrolled.Blocks.push_back(std::move(leave));
+        unrolled.Blocks.push_back(std::move(guardEnters ? body : remainder));
+        return unrolled;
+    }
+
+    UnrollStats unrollLoops(IRProgram& program, size_t factor){
+        UnrollStats stats;
+        BasicBlocks blocks = splitBasicBlocks(program);
+
+        if(factor < 2 || blocks.empty() || hasUndefinedLabels(blocks)){
+            joinBasicBlocks(program, blocks);
+            return stats;
+        }
+
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        std::vector<size_t> jumpsIn(blocks.size(), 0);
+        LabelNames names;
+        for(const BasicBlock& block : blocks){
+            for(const IRLabel& label : block.Labels) names.Taken.insert(label.Label);
+
+            IRInstruction* terminator = block.Terminator();
+            if(terminator && terminator->Op != OpCode::RET) jumpsIn[index.at(jumpTarget(*terminator))]++;
+        }
+
+        std::vector<std::optional<UnrolledLoop>> replacements(blocks.size());
+        size_t budget = UnrollMaxGrowth;
+
+        for(size_t i = 0; i < blocks.size(); ++i){
+            const BasicBlock& loop = blocks[i];
+            if(!isSelfLoop(loop)) continue;
+
+            size_t loopSize = codeSize(loop.Instructions);
+            std::optional<LoopCounter> counter = findCounter(loop);
+            if(loopSize > UnrollMaxLoopSize || !counter) continue;
+
+            size_t bodySize = std::max<size_t>(loopSize - loop.Instructions.back()->GetSize(), 1);
+            size_t loopFactor = std::min(factor, UnrollMaxUnrolledSize / bodySize);
+            if(loopFactor < 2) continue;
+
+            //only its own back edge jumps in, so the counter comes from the block before
+            std::optional<uint64_t> trips;
+            if(i > 0 && jumpsIn[i] == 1 && blocks[i - 1].FallsThrough()){
+                std::optional<uint64_t> start = constantAtEnd(blocks[i - 1], counter->Register);
+                std::optional<uint64_t> bound = counter->Bound;
+                if(counter->BoundRegister) bound = constantAtEnd(blocks[i - 1], *counter->BoundRegister);
+
+                if(start && bound) trips = tripCount(*counter, *start, *bound);
+            }
+
+            std::optional<UnrolledLoop> unrolled;
+            if(trips) unrolled = unrollCounted(loop, *counter, *trips, loopFactor, bodySize, names);
+            else if(i + 1 < blocks.size()) unrolled = unrollGuarded(loop, *counter, loopFactor, blocks[i + 1].Name(), names);
+            if(!unrolled) continue;
+
+            size_t size = 0;
+            for(const BasicBlock& block : unrolled->Blocks) size += codeSize(block.Instructions);
+            if(size > loopSize + budget) continue;
+
+            budget -= size > loopSize ? size - loopSize : 0;
+            stats.Growth += size > loopSize ? size - loopSize : 0;
+            stats.Loops++;
+            stats.FullyUnrolled += unrolled->Full;
+            stats.WithRemainder += unrolled->Remainder;
+            replacements[i] = std::move(unrolled);
+        }
+
+        BasicBlocks result;
+        result.reserve(blocks.size());
+        for(size_t i = 0; i < blocks.size(); ++i){
+            if(!replacements[i]){
+                result.push_back(std::move(blocks[i]));
+                continue;
+            }
+            for(BasicBlock& block : replacements[i]->Blocks) result.push_back(std::move(block));
+        }
+
+        joinBasicBlocks(program, result);
+        return stats;
+    }
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstddef>
+
+namespace koalac{
+
+    // Loops larger than this (bytes, before relaxation) are not unrolled at all.
+    inline constexpr size_t UnrollMaxLoopSize = 64;
+    // Cap on one unrolled loop: the factor drops until its copies fit.
+    inline constexpr size_t UnrollMaxUnrolledSize = 256;
+    // Cap on the bytes unrolling adds to the whole program.
+    inline constexpr size_t UnrollMaxGrowth = 2048;
+    inline constexpr size_t UnrollMaxFactor = 16;
+
+    struct UnrollStats{
+        size_t Loops = 0;           //loops unrolled, the ones below included
+        size_t FullyUnrolled = 0;   //loops replaced by straight-line code
+        size_t WithRemainder = 0;   //loops that keep the original as a remainder loop
+        size_t Growth = 0;          //bytes added
+    };
+
+    // Unrolls single-block loops (a block ending in a conditional jump to itself) by
+    // `factor`, for loops whose exit test is on a counter: a register stepped by a
+    // constant once per iteration and compared (jnz, jne, jltu, jleu) against a bound
+    // the loop does not write.
+    //  - a counter set by a `mov` of a constant just before the loop gives the trip
+    //    count: the leftover iterations are peeled in front and the unrolled loop tests
+    //    once per `factor` iterations; a loop of fewer than 2 * factor iterations becomes
+    //    straight-line code
+    //  - otherwise, with an immediate bound, a guard before the unrolled body checks
+    //    that `factor` more iterations cannot leave the loop early, and the original
+    //    loop runs the remaining ones
+    // The copies step the counter once by the whole amount when nothing else in the
+    // body reads it. Loops calling the host (which may write any register) are left
+    // alone, as are programs with jumps to undefined labels.
+    UnrollStats unrollLoops(IRProgram& program, size_t factor);
+
+}
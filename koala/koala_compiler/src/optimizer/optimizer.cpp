@@ -0,0 +1,155 @@
+#include "optimizer/optimizer.hpp"
+#include "optimizer/basic_blocks.hpp"
+#include "optimizer/liveness.hpp"
+
+#include <algorithm>
+
+namespace koalac{
+
+    static bool isUnconditionalJump(OpCode op){
+        return isJump(op) && !isConditionalJump(op);
+    }
+
+    // Block control actually lands on when it enters block `start`.
+    static size_t resolveTarget(const BasicBlocks& blocks, const std::unordered_map<std::string, size_t>& index, size_t start){
+        size_t block = start;
+
+        for(size_t hops = 0; hops <= blocks.size(); ++hops){
+            const auto& instructions = blocks[block].Instructions;
+
+            if(instructions.empty() && block + 1 < blocks.size()){
+                block++;
+            } else if(instructions.size() == 1 && isUnconditionalJump(instructions[0]->Op)){
+                block = index.at(jumpTarget(*instructions[0]));
+            } else {
+                return block;
+            }
+        }
+        return start; //a jmp cycle has no final target
+    }
+
+    static size_t threadJumps(BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        size_t threaded = 0;
+
+        for(BasicBlock& block : blocks){
+            IRInstruction* terminator = block.Terminator();
+            if(!terminator || terminator->Op == OpCode::RET) continue;
+
+            size_t target = index.at(jumpTarget(*terminator));
+            size_t resolved = resolveTarget(blocks, index, target);
+
+            const auto& landing = blocks[resolved].Instructions;
+            if(isUnconditionalJump(terminator->Op) && landing.size() == 1 && landing[0]->Op == OpCode::RET){
+                terminator->Op = OpCode::RET;
+                terminator->Args.clear();
+                threaded++;
+            } else if(resolved != target){
+                jumpTarget(*terminator) = blocks[resolved].Name();
+                threaded++;
+            }
+        }
+        return threaded;
+    }
+
+    static size_t removeUnreachableBlocks(BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        std::vector<bool> reachable(blocks.size(), false);
+        std::vector<size_t> worklist = { 0 };
+        reachable[0] = true;
+
+        while(!worklist.empty()){
+            size_t block = worklist.back();
+            worklist.pop_back();
+
+            for(size_t succ : blockSuccessors(blocks, index, block)){
+                if(!reachable[succ]){
+                    reachable[succ] = true;
+                    worklist.push_back(succ);
+                }
+            }
+        }
+
+        size_t removed = 0;
+        BasicBlocks kept;
+        kept.reserve(blocks.size());
+        for(size_t i = 0; i < blocks.size(); ++i){
+            if(reachable[i]) kept.push_back(std::move(blocks[i]));
+            else removed++;
+        }
+        blocks = std::move(kept);
+        return removed;
+    }
+
+    static size_t removeFallthroughJumps(BasicBlocks& blocks){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        size_t removed = 0;
+
+        for(size_t i = 0; i < blocks.size(); ++i){
+            IRInstruction* terminator = blocks[i].Terminator();
+            if(!terminator || terminator->Op == OpCode::RET) continue;
+
+            //the target is reached by falling through the empty blocks in between too
+            size_t target = index.at(jumpTarget(*terminator));
+            bool next = target > i && std::all_of(blocks.begin() + i + 1, blocks.begin() + target, [](const BasicBlock& block){
+                return block.Instructions.empty();
+            });
+
+            if(next){
+                blocks[i].Instructions.pop_back();
+                removed++;
+            }
+        }
+        return removed;
+    }
+
+    static size_t removeDeadStores(BasicBlocks& blocks){
+        std::vector<BlockLiveness> liveness = computeLiveness(blocks);
+        size_t removed = 0;
+
+        for(size_t i = 0; i < blocks.size(); ++i){
+            auto& instructions = blocks[i].Instructions;
+            RegisterMask live = liveness[i].LiveOut;
+
+            for(size_t k = instructions.size(); k-- > 0;){
+                RegisterUsage usage = registerUsage(*instructions[k]);
+
+                if(usage.Pure && (usage.Defs & live) == 0){
+                    instructions.erase(instructions.begin() + k);
+                    removed++;
+                    continue;
+                }
+                live = (live & ~usage.Defs) | usage.Uses;
+            }
+        }
+        return removed;
+    }
+
+    OptimizerStats optimizeProgram(IRProgram& program){
+        OptimizerStats stats;
+        BasicBlocks blocks = splitBasicBlocks(program);
+
+        if(blocks.empty() || hasUndefinedLabels(blocks)){
+            joinBasicBlocks(program, blocks);
+            return stats;
+        }
+
+        bool changed = true;
+        while(changed){
+            size_t threaded = threadJumps(blocks);
+            size_t unreachable = removeUnreachableBlocks(blocks);
+            size_t jumps = removeFallthroughJumps(blocks);
+            size_t deadStores = removeDeadStores(blocks);
+
+            stats.ThreadedJumps += threaded;
+            stats.UnreachableBlocks += unreachable;
+            stats.RemovedJumps += jumps;
+            stats.DeadStores += deadStores;
+            changed = threaded + unreachable + jumps + deadStores != 0;
+        }
+
+        joinBasicBlocks(program, blocks);
+        return stats;
+    }
+
+}
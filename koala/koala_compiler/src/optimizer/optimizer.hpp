@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstddef>
+
+namespace koalac{
+
+    struct OptimizerStats{
+        size_t UnreachableBlocks = 0;
+        size_t DeadStores = 0;
+        size_t ThreadedJumps = 0;
+        size_t RemovedJumps = 0;
+    };
+
+    // Runs the CFG passes until none of them changes anything:
+    //  - jump threading: a jump to a lone `jmp` goes to its target, a `jmp` to a lone
+    //    `ret` becomes `ret`
+    //  - unreachable-block removal
+    //  - removal of jumps to the block that follows anyway
+    //  - dead-store elimination of pure instructions whose result is never read
+    // Programs jumping to undefined labels are left for the translator to report.
+    OptimizerStats optimizeProgram(IRProgram& program);
+
+}
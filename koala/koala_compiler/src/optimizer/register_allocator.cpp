@@ -0,0 +1,468 @@
+#include "optimizer/register_allocator.hpp"
+#include "optimizer/basic_blocks.hpp"
+#include "optimizer/liveness.hpp"
+
+#include <vm_config.h>
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace koalac{
+
+    // Values are the physical registers 0..63, then the virtual registers in order of
+    // first appearance.
+    static constexpr size_t PhysicalValues = 64;
+    static constexpr size_t NoValue = SIZE_MAX;
+    static constexpr size_t NoRegister = SIZE_MAX;
+
+    // Bit set over values; word 0 holds the physical registers.
+    struct ValueSet{
+        std::vector<uint64_t> Words;
+
+        explicit ValueSet(size_t values = 0) : Words((values + 63) / 64, 0)
+        {}
+
+        inline void Set(size_t value) { Words[value / 64] |= uint64_t(1) << (value % 64); }
+        inline void Reset(size_t value) { Words[value / 64] &= ~(uint64_t(1) << (value % 64)); }
+
+        template<typename Fn>
+        void ForEachVirtual(Fn&& fn) const{
+            for(size_t w = 1; w < Words.size(); ++w){
+                for(uint64_t bits = Words[w]; bits != 0; bits &= bits - 1) fn(w * 64 + std::countr_zero(bits));
+            }
+        }
+
+        bool operator==(const ValueSet&) const = default;
+    };
+
+    // Register operands of an instruction as values.
+    struct ValueRefs{
+        std::vector<size_t> Reads;
+        std::vector<size_t> Writes;
+        bool Observes = false; //ret, checkpoint, callhost: the result registers as a whole
+    };
+
+    // Instruction k reads at position 2k and writes at 2k + 1.
+    struct LiveInterval{
+        size_t Start = SIZE_MAX;
+        size_t End = 0;
+        size_t Register = NoRegister;
+        size_t Slot = 0;
+        bool Spilled = false;
+        std::vector<size_t> Copies; //values on the other side of a mov
+
+        inline void Extend(size_t pos){
+            Start = std::min(Start, pos);
+            End = std::max(End, pos);
+        }
+    };
+
+    // Positions at which a physical register holds something of the source's own,
+    // sorted and disjoint once normalized.
+    struct FixedRanges{
+        std::vector<std::pair<size_t, size_t>> Ranges;
+
+        void Normalize(){
+            std::sort(Ranges.begin(), Ranges.end());
+            std::vector<std::pair<size_t, size_t>> merged;
+            for(const auto& range : Ranges){
+                if(!merged.empty() && range.first <= merged.back().second + 1) merged.back().second = std::max(merged.back().second, range.second);
+                else merged.push_back(range);
+            }
+            Ranges = std::move(merged);
+        }
+
+        bool Overlaps(size_t start, size_t end) const{
+            auto it = std::lower_bound(Ranges.begin(), Ranges.end(), start, [](const auto& range, size_t pos){ return range.second < pos; });
+            return it != Ranges.end() && it->first <= end;
+        }
+    };
+
+    struct BlockValueLiveness{
+        ValueSet LiveIn;
+        ValueSet LiveOut;
+    };
+
+    static size_t valueOf(const IRArg& arg, const std::unordered_map<uint32_t, size_t>& virtuals){
+        if(const uint8_t* reg = std::get_if<uint8_t>(&arg)) return *reg;
+        if(const VirtualRegister* vreg = std::get_if<VirtualRegister>(&arg)) return PhysicalValues + virtuals.at(vreg->Id);
+        return NoValue;
+    }
+
+    static ValueRefs valueRefs(const IRInstruction& instr, const std::unordered_map<uint32_t, size_t>& virtuals){
+        ValueRefs refs;
+        OperandAccess access = operandAccess(instr);
+
+        for(size_t i = 0; i < instr.Args.size(); ++i){
+            size_t value = valueOf(instr.Args[i], virtuals);
+            if(value == NoValue) continue;
+
+            if((access.Reads >> i) & 1) refs.Reads.push_back(value);
+            if((access.Writes >> i) & 1) refs.Writes.push_back(value);
+        }
+        refs.Observes = instr.Op == OpCode::RET || instr.Op == OpCode::CHECKPOINT || instr.Op == OpCode::CALLHOST;
+        return refs;
+    }
+
+    // Same dataflow as computeLiveness, over virtual registers too. Only the result
+    // registers are live where the program ends.
+    static std::vector<BlockValueLiveness> computeValueLiveness(const BasicBlocks& blocks, const std::vector<std::vector<ValueRefs>>& refs, size_t values, RegisterMask results){
+        std::unordered_map<std::string, size_t> index = blockIndex(blocks);
+        std::vector<BlockValueLiveness> liveness(blocks.size(), { ValueSet(values), ValueSet(values) });
+
+        std::vector<std::vector<size_t>> successors(blocks.size());
+        std::vector<ValueSet> uses(blocks.size(), ValueSet(values)), defs(blocks.size(), ValueSet(values));
+        for(size_t i = 0; i < blocks.size(); ++i){
+            successors[i] = blockSuccessors(blocks, index, i);
+
+            for(size_t k = refs[i].size(); k-- > 0;){
+                const ValueRefs& instrRefs = refs[i][k];
+                for(size_t value : instrRefs.Writes){
+                    defs[i].Set(value);
+                    uses[i].Reset(value);
+                }
+                for(size_t value : instrRefs.Reads) uses[i].Set(value);
+                if(instrRefs.Observes) uses[i].Words[0] |= results;
+            }
+        }
+
+        bool changed = true;
+        while(changed){
+            changed = false;
+
+            for(size_t i = blocks.size(); i-- > 0;){
+                ValueSet liveOut(values);
+                if(blocks[i].FallsThrough() && i + 1 == blocks.size()) liveOut.Words[0] = results;
+                for(size_t succ : successors[i]){
+                    for(size_t w = 0; w < liveOut.Words.size(); ++w) liveOut.Words[w] |= liveness[succ].LiveIn.Words[w];
+                }
+
+                ValueSet liveIn(values);
+                for(size_t w = 0; w < liveIn.Words.size(); ++w) liveIn.Words[w] = uses[i].Words[w] | (liveOut.Words[w] & ~defs[i].Words[w]);
+
+                if(!(liveIn == liveness[i].LiveIn) || !(liveOut == liveness[i].LiveOut)){
+                    liveness[i] = { std::move(liveIn), std::move(liveOut) };
+                    changed = true;
+                }
+            }
+        }
+
+        return liveness;
+    }
+
+    // Linear scan over the intervals in order of their start. A register is free for an
+    // interval when its last holder has ended and the source does not use it anywhere in
+    // between. With nothing free, whichever of the interval and the ones holding a
+    // register ends last is spilled.
+    static void linearScan(std::vector<LiveInterval>& intervals, const std::vector<FixedRanges>& fixed, const std::vector<size_t>& pool){
+        std::vector<size_t> order(intervals.size());
+        for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return intervals[a].Start < intervals[b].Start; });
+
+        std::vector<bool> inPool(PhysicalValues, false);
+        for(size_t reg : pool) inPool[reg] = true;
+        std::vector<size_t> holder(PhysicalValues, NoValue);
+
+        for(LiveInterval& interval : intervals){
+            interval.Register = NoRegister;
+            interval.Spilled = false;
+        }
+
+        for(size_t i : order){
+            LiveInterval& interval = intervals[i];
+            auto isFree = [&](size_t reg){
+                size_t held = holder[reg];
+                return inPool[reg] && (held == NoValue || intervals[held].End < interval.Start) && !fixed[reg].Overlaps(interval.Start, interval.End);
+            };
+
+            size_t chosen = NoRegister;
+            for(size_t value : interval.Copies){
+                size_t reg = value < PhysicalValues ? value : intervals[value - PhysicalValues].Register;
+                if(reg != NoRegister && isFree(reg)){
+                    chosen = reg;
+                    break;
+                }
+            }
+            for(size_t k = 0; chosen == NoRegister && k < pool.size(); ++k){
+                if(isFree(pool[k])) chosen = pool[k];
+            }
+
+            if(chosen == NoRegister){
+                //a holder ending later covers this whole interval, so its register is
+                //clear of the source's registers here too
+                size_t victim = NoValue;
+                for(size_t reg : pool){
+                    size_t held = holder[reg];
+                    if(held == NoValue || intervals[held].End < interval.Start || intervals[held].End <= interval.End) continue;
+                    if(victim == NoValue || intervals[held].End > intervals[victim].End){
+                        victim = held;
+                        chosen = reg;
+                    }
+                }
+
+                if(victim == NoValue){
+                    interval.Spilled = true;
+                    continue;
+                }
+                intervals[victim].Register = NoRegister;
+                intervals[victim].Spilled = true;
+            }
+
+            interval.Register = chosen;
+            holder[chosen] = i;
+        }
+    }
+
+    struct SpillCode{
+        size_t Scratch = 0;                //registers the busiest instruction needs
+        std::vector<size_t> Instructions;  //linear indices of the instructions with spill code
+    };
+
+    // Scratch registers spill code needs: one per spilled value an instruction reads,
+    // results reuse them as the reads come first.
+    static SpillCode spillCode(const std::vector<std::vector<ValueRefs>>& refs, const std::vector<LiveInterval>& intervals){
+        auto spilled = [&](size_t value){ return value >= PhysicalValues && intervals[value - PhysicalValues].Spilled; };
+        SpillCode code;
+        size_t linear = 0;
+
+        for(const auto& blockRefs : refs){
+            for(const ValueRefs& instrRefs : blockRefs){
+                std::vector<size_t> reads, writes;
+                for(size_t value : instrRefs.Reads){
+                    if(spilled(value) && std::find(reads.begin(), reads.end(), value) == reads.end()) reads.push_back(value);
+                }
+                for(size_t value : instrRefs.Writes){
+                    if(spilled(value) && std::find(writes.begin(), writes.end(), value) == writes.end()) writes.push_back(value);
+                }
+
+                if(!reads.empty() || !writes.empty()) code.Instructions.push_back(linear);
+                code.Scratch = std::max({ code.Scratch, reads.size(), writes.size() });
+                linear++;
+            }
+        }
+        return code;
+    }
+
+    // Whether the source leaves `reg` alone at every instruction with spill code.
+    static bool clearForSpillCode(const FixedRanges& ranges, const SpillCode& code){
+        return std::none_of(code.Instructions.begin(), code.Instructions.end(), [&](size_t k){ return ranges.Overlaps(2 * k, 2 * k + 1); });
+    }
+
+    AllocatorStats allocateRegisters(IRProgram& program, size_t registersCount){
+        AllocatorStats stats;
+
+        std::unordered_map<uint32_t, size_t> virtuals;
+        std::vector<uint32_t> virtualIds;
+        for(const auto& node : program.GetNodes()){
+            auto* instr = dynamic_cast<IRInstruction*>(node.get());
+            if(!instr) continue;
+
+            for(const IRArg& arg : instr->Args){
+                const VirtualRegister* vreg = std::get_if<VirtualRegister>(&arg);
+                if(vreg && virtuals.emplace(vreg->Id, virtualIds.size()).second) virtualIds.push_back(vreg->Id);
+            }
+        }
+        if(virtualIds.empty()) return stats;
+        stats.VirtualRegisters = virtualIds.size();
+
+        BasicBlocks blocks = splitBasicBlocks(program);
+        if(blocks.empty() || hasUndefinedLabels(blocks)){
+            joinBasicBlocks(program, blocks);
+            return stats;
+        }
+
+        size_t values = PhysicalValues + virtualIds.size();
+        RegisterMask named = 0, results = 0;
+        std::vector<std::vector<ValueRefs>> refs(blocks.size());
+        std::vector<size_t> blockFirst(blocks.size());
+        size_t instrCount = 0;
+
+        for(size_t b = 0; b < blocks.size(); ++b){
+            blockFirst[b] = instrCount;
+            for(const auto& instr : blocks[b].Instructions){
+                ValueRefs instrRefs = valueRefs(*instr, virtuals);
+                for(size_t value : instrRefs.Reads){
+                    if(value < PhysicalValues) named |= RegisterMask(1) << value;
+                }
+                for(size_t value : instrRefs.Writes){
+                    if(value < PhysicalValues) results |= RegisterMask(1) << value;
+                }
+                refs[b].push_back(std::move(instrRefs));
+                instrCount++;
+            }
+        }
+
+        named |= results;
+
+        std::vector<BlockValueLiveness> liveness = computeValueLiveness(blocks, refs, values, results);
+        liveness[0].LiveIn.ForEachVirtual([&](size_t value){
+            stats.Warnings.push_back(std::format("virtual register 'v{}' may be read before it is written", virtualIds[value - PhysicalValues]));
+        });
+
+        //hull of every virtual register's live positions, exact ranges of the physical ones
+        std::vector<LiveInterval> intervals(virtualIds.size());
+        std::vector<FixedRanges> fixed(PhysicalValues);
+        for(size_t b = 0; b < blocks.size(); ++b){
+            if(refs[b].empty()) continue;
+            size_t first = blockFirst[b], last = first + refs[b].size() - 1;
+
+            liveness[b].LiveIn.ForEachVirtual([&](size_t value){ intervals[value - PhysicalValues].Extend(2 * first); });
+            liveness[b].LiveOut.ForEachVirtual([&](size_t value){ intervals[value - PhysicalValues].Extend(2 * last + 1); });
+
+            RegisterMask live = liveness[b].LiveOut.Words[0];
+            size_t liveEnd[PhysicalValues];
+            for(RegisterMask bits = live; bits != 0; bits &= bits - 1) liveEnd[std::countr_zero(bits)] = 2 * last + 1;
+
+            for(size_t k = refs[b].size(); k-- > 0;){
+                const ValueRefs& instrRefs = refs[b][k];
+                size_t pos = 2 * (first + k);
+
+                RegisterMask reads = instrRefs.Observes ? results : 0;
+                for(size_t value : instrRefs.Reads){
+                    if(value >= PhysicalValues) intervals[value - PhysicalValues].Extend(pos);
+                    else reads |= RegisterMask(1) << value;
+                }
+                for(size_t value : instrRefs.Writes){
+                    if(value >= PhysicalValues){
+                        intervals[value - PhysicalValues].Extend(pos + 1);
+                    } else if((live >> value) & 1){
+                        fixed[value].Ranges.emplace_back(pos + 1, liveEnd[value]);
+                        live &= ~(RegisterMask(1) << value);
+                    } else {
+                        fixed[value].Ranges.emplace_back(pos + 1, pos + 1);
+                    }
+                }
+                for(RegisterMask bits = reads & ~live; bits != 0; bits &= bits - 1) liveEnd[std::countr_zero(bits)] = pos;
+                live |= reads;
+            }
+            for(RegisterMask bits = live; bits != 0; bits &= bits - 1){
+                size_t reg = std::countr_zero(bits);
+                fixed[reg].Ranges.emplace_back(2 * first, liveEnd[reg]);
+            }
+        }
+        for(FixedRanges& ranges : fixed) ranges.Normalize();
+
+        for(const BasicBlock& block : blocks){
+            for(const auto& instr : block.Instructions){
+                if(instr->Op != OpCode::MOV_REG) continue;
+
+                size_t dst = valueOf(instr->Args[0], virtuals), src = valueOf(instr->Args[1], virtuals);
+                if(dst >= PhysicalValues) intervals[dst - PhysicalValues].Copies.push_back(src);
+                if(src >= PhysicalValues) intervals[src - PhysicalValues].Copies.push_back(dst);
+            }
+        }
+
+        //spill code needs registers no interval gets: the highest ones the source leaves
+        //unnamed, else named ones it does not use where the spill code goes
+        static constexpr size_t ScratchAttempts = 4;
+        std::vector<size_t> scratch;
+        for(size_t attempt = 0;; ++attempt){
+            std::vector<size_t> pool;
+            for(size_t reg = 0; reg < registersCount; ++reg){
+                if(std::find(scratch.begin(), scratch.end(), reg) == scratch.end()) pool.push_back(reg);
+            }
+            linearScan(intervals, fixed, pool);
+
+            SpillCode code = spillCode(refs, intervals);
+            bool clear = std::all_of(scratch.begin(), scratch.end(), [&](size_t reg){ return clearForSpillCode(fixed[reg], code); });
+            if(code.Scratch <= scratch.size() && clear) break;
+
+            std::vector<size_t> candidates;
+            for(size_t reg = registersCount; reg-- > 0;){
+                if(!((named >> reg) & 1)) candidates.push_back(reg);
+            }
+            for(size_t reg = registersCount; reg-- > 0 && attempt < ScratchAttempts;){
+                if(((named >> reg) & 1) && clearForSpillCode(fixed[reg], code)) candidates.push_back(reg);
+            }
+            size_t needed = std::max(code.Scratch, scratch.size());
+            if(candidates.size() < needed){
+                throw std::runtime_error(std::format("Register allocation failed: spill code needs {} registers the source leaves free, {} of {} are",
+                    needed, candidates.size(), registersCount));
+            }
+            scratch.assign(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(needed));
+        }
+
+        //spill slots are shared by intervals that do not overlap
+        std::vector<size_t> spilledOrder, slotEnds;
+        for(size_t i = 0; i < intervals.size(); ++i){
+            if(intervals[i].Spilled) spilledOrder.push_back(i);
+        }
+        std::stable_sort(spilledOrder.begin(), spilledOrder.end(), [&](size_t a, size_t b){ return intervals[a].Start < intervals[b].Start; });
+        for(size_t i : spilledOrder){
+            auto slot = std::find_if(slotEnds.begin(), slotEnds.end(), [&](size_t end){ return end < intervals[i].Start; });
+            if(slot == slotEnds.end()) slot = slotEnds.insert(slotEnds.end(), 0);
+            *slot = intervals[i].End;
+            intervals[i].Slot = static_cast<size_t>(slot - slotEnds.begin());
+        }
+        if(slotEnds.size() > KOALA_CORE_VM_SPILL_SLOTS){
+            throw std::runtime_error(std::format("Register allocation failed: {} spill slots needed, the VM has {}", slotEnds.size(), KOALA_CORE_VM_SPILL_SLOTS));
+        }
+        stats.Spilled = spilledOrder.size();
+        stats.SpillSlots = slotEnds.size();
+
+        for(size_t b = 0; b < blocks.size(); ++b){
+            std::vector<std::unique_ptr<IRInstruction>> rewritten;
+            rewritten.reserve(blocks[b].Instructions.size());
+
+            for(size_t k = 0; k < blocks[b].Instructions.size(); ++k){
+                std::unique_ptr<IRInstruction>& instr = blocks[b].Instructions[k];
+                const ValueRefs& instrRefs = refs[b][k];
+                auto spilled = [&](size_t value){ return value >= PhysicalValues && intervals[value - PhysicalValues].Spilled; };
+                auto slotOf = [&](size_t value){ return static_cast<uint16_t>(intervals[value - PhysicalValues].Slot); };
+
+                //spilled values read come in through scratch registers, written ones go out
+                std::vector<std::pair<size_t, size_t>> scratchOf;
+                auto findScratch = [&](size_t value){
+                    return std::find_if(scratchOf.begin(), scratchOf.end(), [&](const auto& entry){ return entry.first == value; });
+                };
+                for(size_t value : instrRefs.Reads){
+                    if(!spilled(value) || findScratch(value) != scratchOf.end()) continue;
+
+                    size_t reg = scratch[scratchOf.size()];
+                    scratchOf.emplace_back(value, reg);
+                    rewritten.push_back(std::make_unique<IRInstruction>(OpCode::RELOAD, std::vector<IRArg>{ static_cast<uint8_t>(reg), slotOf(value) }, instr->Span));
+                }
+
+                std::vector<std::pair<size_t, size_t>> stores;
+                for(size_t value : instrRefs.Writes){
+                    if(!spilled(value) || std::any_of(stores.begin(), stores.end(), [&](const auto& entry){ return entry.first == value; })) continue;
+
+                    auto known = findScratch(value);
+                    size_t reg = known != scratchOf.end() ? known->second : NoRegister;
+                    for(size_t s = 0; reg == NoRegister; ++s){
+                        bool taken = std::any_of(stores.begin(), stores.end(), [&](const auto& entry){ return entry.second == scratch[s]; });
+                        if(!taken) reg = scratch[s];
+                    }
+                    if(known == scratchOf.end()) scratchOf.emplace_back(value, reg);
+                    stores.emplace_back(value, reg);
+                }
+
+                bool hasVirtual = false;
+                for(IRArg& arg : instr->Args){
+                    if(!std::holds_alternative<VirtualRegister>(arg)) continue;
+
+                    size_t value = valueOf(arg, virtuals);
+                    size_t reg = spilled(value) ? findScratch(value)->second : intervals[value - PhysicalValues].Register;
+                    arg = static_cast<uint8_t>(reg);
+                    hasVirtual = true;
+                }
+
+                Span span = instr->Span;
+                if(hasVirtual && instr->Op == OpCode::MOV_REG && instr->Args[0] == instr->Args[1]) stats.CoalescedMoves++;
+                else rewritten.push_back(std::move(instr));
+
+                for(const auto& [value, reg] : stores){
+                    rewritten.push_back(std::make_unique<IRInstruction>(OpCode::SPILL, std::vector<IRArg>{ static_cast<uint8_t>(reg), slotOf(value) }, span));
+                }
+            }
+
+            blocks[b].Instructions = std::move(rewritten);
+        }
+
+        joinBasicBlocks(program, blocks);
+        return stats;
+    }
+
+}
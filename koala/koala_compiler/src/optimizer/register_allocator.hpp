@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace koalac{
+
+    struct AllocatorStats{
+        size_t VirtualRegisters = 0;
+        size_t Spilled = 0;        //virtual registers kept in the VM spill area
+        size_t SpillSlots = 0;
+        size_t CoalescedMoves = 0; //copies whose two sides got the same register
+        std::vector<std::string> Warnings;
+    };
+
+    // Maps the virtual registers (`v<N>`) of a program onto r0..r<registersCount - 1>
+    // with linear scan:
+    //  - live ranges come from backward dataflow over the basic blocks; a virtual
+    //    register gets one interval from the first to the last position it is live at
+    //  - physical registers the source writes are results: they keep their value up to
+    //    every `ret`, `checkpoint` and `callhost` as written. Registers it only reads are
+    //    inputs, free again after their last read, and registers it never names are
+    //    scratch and end with unspecified values
+    //  - a `mov` prefers the register of its other side, so the copy disappears
+    //  - when the register file is full, the interval ending last moves to the spill
+    //    area (SPILL/RELOAD): every read of it reloads into a reserved scratch register
+    //    and every write stores back. Scratch registers are ones the source never names,
+    //    or else ones it leaves alone wherever spill code goes
+    // Programs without virtual registers, or with jumps to undefined labels (left for
+    // the translator to report), are not touched. Throws std::runtime_error when the
+    // registers the source leaves free or the spill slots do not suffice.
+    AllocatorStats allocateRegisters(IRProgram& program, size_t registersCount);
+
+}
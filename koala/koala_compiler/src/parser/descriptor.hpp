@@ -10,11 +10,13 @@ namespace koalac{
         Imm16,
         Imm64,
         Label,
+        HostFunction, //written as an identifier, resolved to an index at parse time
     };
 
     struct InstrVariant {
         OpCode Op;
         std::vector<ArgType> Format;
+        std::vector<size_t> Order = {}; //encoded operands as indices into the written ones; empty keeps them as written
     };
 
     using InstrDescriptor = std::vector<InstrVariant>;
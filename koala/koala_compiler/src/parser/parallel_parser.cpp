@@ -0,0 +1,136 @@
+#include "parser/parallel_parser.hpp"
+#include "lexer/lexer.hpp"
+#include "time_trace.hpp"
+
+#include <algorithm>
+#include <format>
+#include <thread>
+#include <unordered_map>
+
+namespace koalac{
+
+    // Pieces smaller than this are not worth a thread.
+    static constexpr size_t MinPieceSize = 256 * 1024;
+
+    struct SourcePiece{
+        size_t Begin;
+        size_t End;
+        size_t FirstLine;
+
+        IRNodes Nodes;
+        std::vector<ParserError> Errors;
+        std::string GlobalLabel; //in scope at the end of the piece
+    };
+
+    // Whether a statement may continue on the line after `newline`: its last token
+    // before any comment is a comma.
+    static bool continuesOnNextLine(const std::string& source, size_t newline){
+        size_t lineStart = source.rfind('\n', newline == 0 ? 0 : newline - 1);
+        lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+
+        size_t comment = source.find(';', lineStart);
+        size_t end = comment < newline ? comment : newline;
+        while(end > lineStart && std::isspace(static_cast<unsigned char>(source[end - 1]))) end--;
+        return end > lineStart && source[end - 1] == ',';
+    }
+
+    static std::vector<SourcePiece> cutSource(const std::string& source, size_t jobs){
+        jobs = std::max<size_t>(1, std::min(jobs, source.size() / MinPieceSize));
+
+        std::vector<SourcePiece> pieces;
+        size_t begin = 0, line = 1;
+        for(size_t i = 1; i <= jobs && begin < source.size(); ++i){
+            size_t end = source.size();
+            if(i < jobs){
+                end = source.find('\n', std::max(begin, source.size() * i / jobs));
+                while(end != std::string::npos && continuesOnNextLine(source, end)) end = source.find('\n', end + 1);
+                end = end == std::string::npos ? source.size() : end + 1;
+            }
+
+            pieces.push_back({ begin, end, line });
+            line += static_cast<size_t>(std::count(source.begin() + begin, source.begin() + end, '\n'));
+            begin = end;
+        }
+        return pieces;
+    }
+
+    static void parsePiece(const std::string& source, SourcePiece* piece, bool first, const KoalaHostRegistry* host, size_t registersCount){
+        TimeTraceScope trace("Parse piece", std::format("lines {}+", piece->FirstLine));
+        Lexer lexer(source.substr(piece->Begin, piece->End - piece->Begin), piece->FirstLine);
+        lexer.SetRegistersCount(registersCount);
+        Parser parser(&lexer, host);
+        if(!first) parser.DeferLocalScope();
+
+        while(parser.ParseNext(&piece->Nodes)){}
+
+        trace.SetArg("lex_ns", static_cast<int64_t>(lexer.GetLexTimeNs()));
+        timeTraceCount("tokens", lexer.GetTokenCount());
+        timeTraceCount("lex_ns", lexer.GetLexTimeNs());
+
+        piece->Errors = parser.GetErrors();
+        piece->GlobalLabel = parser.GetGlobalLabel();
+    }
+
+    // Replaces the InheritedScope prefix with the global label the piece starts under.
+    static bool resolveScope(std::string* name, const std::string& scope){
+        if(!name->starts_with(Parser::InheritedScope)) return true;
+        if(scope.empty()) return false;
+
+        name->replace(0, std::char_traits<char>::length(Parser::InheritedScope), scope);
+        return true;
+    }
+
+    IRProgram parseParallel(const std::string& source, const KoalaHostRegistry* host, size_t registersCount, size_t jobs, std::vector<ParserError>* errors){
+        std::vector<SourcePiece> pieces = cutSource(source, jobs);
+        TimeTraceScope trace("Parse", std::format("{} pieces", pieces.size()));
+
+        {
+            std::vector<std::jthread> threads;
+            for(size_t i = 1; i < pieces.size(); ++i){
+                threads.emplace_back(parsePiece, std::cref(source), &pieces[i], false, host, registersCount);
+            }
+            if(!pieces.empty()) parsePiece(source, &pieces[0], true, host, registersCount);
+        }
+
+        TimeTraceScope mergeTrace("Merge pieces");
+        IRNodes nodes;
+        std::unordered_map<std::string, size_t> labelPieces;
+        std::string scope;
+
+        for(size_t i = 0; i < pieces.size(); ++i){
+            SourcePiece& piece = pieces[i];
+            errors->insert(errors->end(), piece.Errors.begin(), piece.Errors.end());
+
+            for(auto& node : piece.Nodes){
+                if(auto* label = dynamic_cast<IRLabel*>(node.get())){
+                    std::string local = label->Label.substr(label->Label.starts_with(Parser::InheritedScope) ? 1 : 0);
+                    if(!resolveScope(&label->Label, scope)){
+                        errors->emplace_back(std::format("Cannot assign local label '{}'. No global label found.", local), label->Span);
+                    }
+
+                    //within a piece the parser already checked
+                    auto [it, inserted] = labelPieces.emplace(label->Label, i);
+                    if(!inserted && it->second != i){
+                        errors->emplace_back(std::format("Label '{}' was declared multiple times", label->Label), label->Span);
+                    }
+                } else if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
+                    for(auto& arg : instr->Args){
+                        if(std::string* target = std::get_if<std::string>(&arg); target && !resolveScope(target, scope)){
+                            errors->emplace_back(std::format("No global label found to append '{}'", target->substr(1)), instr->Span);
+                        }
+                    }
+                }
+
+                nodes.push_back(std::move(node));
+            }
+
+            if(piece.GlobalLabel != Parser::InheritedScope) scope = piece.GlobalLabel;
+        }
+
+        std::stable_sort(errors->begin(), errors->end(), [](const ParserError& a, const ParserError& b){
+            return a.Span.Line != b.Span.Line ? a.Span.Line < b.Span.Line : a.Span.Column < b.Span.Column;
+        });
+        return IRProgram(std::move(nodes));
+    }
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "parser/parser.hpp"
+#include "ir.hpp"
+#include <KoalaCore>
+#include <string>
+#include <vector>
+
+namespace koalac{
+
+    // Cuts `source` at line boundaries into up to `jobs` pieces of similar size, lexes
+    // and parses them on separate threads and merges the results: local labels at the
+    // start of a piece get the global label of the preceding pieces, labels declared in
+    // two pieces are reported, and errors come out sorted in source order.
+    // Produces the same program as a single Parser; `errors` is empty on success.
+    // `registersCount` is the target's register file size, see Lexer::SetRegistersCount.
+    IRProgram parseParallel(const std::string& source, const KoalaHostRegistry* host, size_t registersCount, size_t jobs, std::vector<ParserError>* errors);
+
+}
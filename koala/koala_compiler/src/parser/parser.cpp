@@ -88,23 +88,143 @@ namespace koalac{
         {"jmp", {{ .Op = OpCode::_JMP_UNDEFINED, .Format = { ArgType::Label } }}},
         {"jez", {{ .Op = OpCode::_JEZ_UNDEFINED, .Format = { ArgType::Register, ArgType::Label } }}},
         {"jnz", {{ .Op = OpCode::_JNZ_UNDEFINED, .Format = { ArgType::Register, ArgType::Label } }}},
+        {"jeq", {
+            { .Op = OpCode::JEQ_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JEQ_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        {"jne", {
+            { .Op = OpCode::JNE_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JNE_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        {"jlt", {
+            { .Op = OpCode::JLT_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JLT_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        {"jle", {
+            { .Op = OpCode::JLE_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JLE_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        {"jltu", {
+            { .Op = OpCode::JLTU_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JLTU_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        {"jleu", {
+            { .Op = OpCode::JLEU_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label } },
+            { .Op = OpCode::JLEU_IMM16_SHORT, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Label } }
+        }},
+        //a > b is b < a: register forms only
+        {"jgt", {{ .Op = OpCode::JLT_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label }, .Order = { 1, 0, 2 } }}},
+        {"jge", {{ .Op = OpCode::JLE_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label }, .Order = { 1, 0, 2 } }}},
+        {"jgtu", {{ .Op = OpCode::JLTU_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label }, .Order = { 1, 0, 2 } }}},
+        {"jgeu", {{ .Op = OpCode::JLEU_REG_SHORT, .Format = { ArgType::Register, ArgType::Register, ArgType::Label }, .Order = { 1, 0, 2 } }}},
+        {"seteq", {
+            { .Op = OpCode::SETEQ_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETEQ_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setne", {
+            { .Op = OpCode::SETNE_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETNE_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setlt", {
+            { .Op = OpCode::SETLT_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETLT_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setle", {
+            { .Op = OpCode::SETLE_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETLE_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setltu", {
+            { .Op = OpCode::SETLTU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETLTU_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setleu", {
+            { .Op = OpCode::SETLEU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::SETLEU_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }
+        }},
+        {"setgt", {{ .Op = OpCode::SETLT_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register }, .Order = { 0, 2, 1 } }}},
+        {"setge", {{ .Op = OpCode::SETLE_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register }, .Order = { 0, 2, 1 } }}},
+        {"setgtu", {{ .Op = OpCode::SETLTU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register }, .Order = { 0, 2, 1 } }}},
+        {"setgeu", {{ .Op = OpCode::SETLEU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register }, .Order = { 0, 2, 1 } }}},
+        {"cmov", {{ .Op = OpCode::CMOV, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"select", {{ .Op = OpCode::SELECT, .Format = { ArgType::Register, ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"popcnt", {{ .Op = OpCode::POPCNT_REG, .Format = { ArgType::Register, ArgType::Register } }}},
+        {"clz", {{ .Op = OpCode::CLZ_REG, .Format = { ArgType::Register, ArgType::Register } }}},
+        {"ctz", {{ .Op = OpCode::CTZ_REG, .Format = { ArgType::Register, ArgType::Register } }}},
+        {"bswap", {{ .Op = OpCode::BSWAP_REG, .Format = { ArgType::Register, ArgType::Register } }}},
+        {"rol", {
+            { .Op = OpCode::ROL_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::ROL_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"ror", {
+            { .Op = OpCode::ROR_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::ROR_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"mulhi", {{ .Op = OpCode::MULHI_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"mulhiu", {{ .Op = OpCode::MULHIU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"min", {
+            { .Op = OpCode::MIN_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::MIN_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"max", {
+            { .Op = OpCode::MAX_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::MAX_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"minu", {
+            { .Op = OpCode::MINU_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::MINU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"maxu", {
+            { .Op = OpCode::MAXU_IMM16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } },
+            { .Op = OpCode::MAXU_REG, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
+        {"checkpoint", {{ .Op = OpCode::CHECKPOINT, .Format = {} }}},
+        {"load8", {{ .Op = OpCode::LOAD8, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"load16", {{ .Op = OpCode::LOAD16, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"load32", {{ .Op = OpCode::LOAD32, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"load64", {{ .Op = OpCode::LOAD64, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"store8", {{ .Op = OpCode::STORE8, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Register } }}},
+        {"store16", {{ .Op = OpCode::STORE16, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Register } }}},
+        {"store32", {{ .Op = OpCode::STORE32, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Register } }}},
+        {"store64", {{ .Op = OpCode::STORE64, .Format = { ArgType::Register, ArgType::Imm16, ArgType::Register } }}},
+        {"memcopy", {{ .Op = OpCode::MEMCOPY, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"memfill", {{ .Op = OpCode::MEMFILL, .Format = { ArgType::Register, ArgType::Register, ArgType::Register } }}},
+        {"read8", {{ .Op = OpCode::READ_U8, .Format = { ArgType::Register } }}},
+        {"read64", {{ .Op = OpCode::READ_U64, .Format = { ArgType::Register } }}},
+        {"write8", {{ .Op = OpCode::WRITE_U8, .Format = { ArgType::Register } }}},
+        {"write64", {{ .Op = OpCode::WRITE_U64, .Format = { ArgType::Register } }}},
+        {"eof", {{ .Op = OpCode::READ_EOF, .Format = { ArgType::Register } }}},
+        {"send", {{ .Op = OpCode::SEND, .Format = { ArgType::Register, ArgType::Imm16 } }}},
+        {"recv", {{ .Op = OpCode::RECV, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"tryrecv", {{ .Op = OpCode::TRYRECV, .Format = { ArgType::Register, ArgType::Register, ArgType::Imm16 } }}},
+        {"close", {{ .Op = OpCode::CLOSE, .Format = { ArgType::Imm16 } }}},
+        //unused argument registers are padded by the translator, see CallHostOperands
+        {"callhost", {
+            { .Op = OpCode::CALLHOST, .Format = { ArgType::Register, ArgType::HostFunction } },
+            { .Op = OpCode::CALLHOST, .Format = { ArgType::Register, ArgType::HostFunction, ArgType::Register } },
+            { .Op = OpCode::CALLHOST, .Format = { ArgType::Register, ArgType::HostFunction, ArgType::Register, ArgType::Register } },
+            { .Op = OpCode::CALLHOST, .Format = { ArgType::Register, ArgType::HostFunction, ArgType::Register, ArgType::Register, ArgType::Register } }
+        }},
     };
 
     IRProgram Parser::MakeProgram(){
         IRNodes nodes;
-
-        while(m_Cur.Type != TokenType::EndOfFile){
-            if(m_Cur.Type == TokenType::Identifier) ParseLabel(&nodes);
-            else if(m_Cur.Type == TokenType::Keyword) ParseInstruction(&nodes);
-            else{
-                Panic("Unexpected token. Expected instruction or label.", m_Cur.Span);
-                Sync();
-            }
-        }
+        while(ParseNext(&nodes)){}
 
         return IRProgram(std::move(nodes));
     }
 
+    bool Parser::ParseNext(IRNodes* nodes){
+        if(m_Cur.Type == TokenType::EndOfFile) return false;
+
+        if(m_Cur.Type == TokenType::Identifier) ParseLabel(nodes);
+        else if(m_Cur.Type == TokenType::Keyword) ParseInstruction(nodes);
+        else{
+            Panic("Unexpected token. Expected instruction or label.", m_Cur.Span);
+            Sync();
+        }
+        return true;
+    }
+
 
     void Parser::ParseLabel(IRNodes* nodes){
         std::string ident = std::get<std::string>(m_Cur.Val);
@@ -118,24 +238,25 @@ namespace koalac{
         }
         Next();
 
-        auto it = m_Labels.find(ident);
-        if(it != m_Labels.end()){
-            Panic(std::format("Label '{}' was declared multiple times", ident), startSpan);
-            return;
-        }
-        
         if(isLocalLabel){
             if(m_CurGlobalLabel.empty()){
                 Panic(std::format("Cannot assign local label '{}'. No global label found.", ident), startSpan);
                 return;
             }
             ident = m_CurGlobalLabel + ident;
-        } else {
-            m_CurGlobalLabel = ident;
         }
+
+        //checked on the full name, so the same local label may appear under different globals
+        auto it = m_Labels.find(ident);
+        if(it != m_Labels.end()){
+            Panic(std::format("Label '{}' was declared multiple times", ident), startSpan);
+            return;
+        }
+
+        if(!isLocalLabel) m_CurGlobalLabel = ident;
         m_Labels.emplace(ident, startSpan);
 
-        nodes->push_back(std::make_unique<IRLabel>(ident, startSpan));
+        nodes->push_back(std::make_unique<IRLabel>(ident, startSpan, isLocalLabel));
     }
 
     void Parser::ParseInstruction(IRNodes* nodes){
@@ -152,7 +273,9 @@ namespace koalac{
 
         std::vector<ParserArg> args;
         while(m_Cur.Type != TokenType::EndOfFile &&
-            (m_Cur.Type == TokenType::Register || m_Cur.Type == TokenType::Number || m_Cur.Type == TokenType::Identifier)){
+            (m_Cur.Type == TokenType::Register || m_Cur.Type == TokenType::VirtualRegister ||
+             m_Cur.Type == TokenType::Number || m_Cur.Type == TokenType::Identifier)){
+                if(m_Cur.Type == TokenType::Identifier && m_Next.Type == TokenType::Colon) break; //next statement's label
 
                 switch(m_Cur.Type){
                     case TokenType::Register:{
@@ -160,6 +283,12 @@ namespace koalac{
                         args.push_back(ParserArg(ArgType::Register, regVal));
                         break;
                     }
+
+                    case TokenType::VirtualRegister:{
+                        uint32_t id = static_cast<uint32_t>(std::get<uint64_t>(m_Cur.Val));
+                        args.push_back(ParserArg(ArgType::Register, VirtualRegister{id}));
+                        break;
+                    }
                     
                     case TokenType::Number:{
                         uint64_t argVal = std::get<uint64_t>(m_Cur.Val);
@@ -193,6 +322,7 @@ namespace koalac{
         }
 
         OpCode op = OpCode::NONE;
+        const InstrVariant* matchedVar = nullptr;
 
         for(const InstrVariant& instrVar : instrIt->second){
             bool matches = true;
@@ -202,7 +332,8 @@ namespace koalac{
             size_t argsCount = args.size();
 
             for(size_t i = 0; i < argsCount; ++i){
-                if(args[i].Type != instrVar.Format[i]){
+                bool isHostFunction = args[i].Type == ArgType::Label && instrVar.Format[i] == ArgType::HostFunction;
+                if(args[i].Type != instrVar.Format[i] && !isHostFunction){
                     matches = false;
                     break;
                 }
@@ -210,6 +341,7 @@ namespace koalac{
 
             if(matches){
                 op = instrVar.Op;
+                matchedVar = &instrVar;
                 break;
             }
         }
@@ -221,8 +353,24 @@ namespace koalac{
         }
         
         std::vector<IRArg> valArgs;
-        for(const auto& arg : args){
-            valArgs.push_back(arg.Val);
+        if(matchedVar->Order.empty()){
+            for(const auto& arg : args){
+                valArgs.push_back(arg.Val);
+            }
+        } else {
+            for(size_t idx : matchedVar->Order){
+                valArgs.push_back(args[idx].Val);
+            }
+        }
+
+        if(op == OpCode::CALLHOST){
+            const std::string& name = std::get<std::string>(valArgs[1]);
+            int fnIdx = koalaHostFind(m_Host, name.c_str());
+            if(fnIdx < 0){
+                Panic(std::format("Unknown host function '{}'.", name), startSpan);
+                return;
+            }
+            valArgs[1] = static_cast<uint16_t>(fnIdx);
         }
 
         nodes->push_back(std::make_unique<IRInstruction>(op, std::move(valArgs), startSpan));
@@ -246,7 +394,11 @@ namespace koalac{
     }
 
     void Parser::PrintErrors(){
-        for(const ParserError& err : m_Errors){
+        printParserErrors(m_Errors);
+    }
+
+    void printParserErrors(const std::vector<ParserError>& errors){
+        for(const ParserError& err : errors){
             std::cerr << std::format("[ERROR(ln: {}, col: {})] {}\n", err.Span.Line, err.Span.Column, err.Msg);
         }
     }
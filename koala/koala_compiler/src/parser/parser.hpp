@@ -4,6 +4,7 @@
 #include "lexer/token.hpp"
 #include "ir.hpp"
 #include "parser/descriptor.hpp"
+#include <KoalaCore>
 #include <vector>
 #include <unordered_map>
 #include <string>
@@ -32,18 +33,35 @@ namespace koalac{
         ~ParserArg() = default;
     };
 
+    void printParserErrors(const std::vector<ParserError>& errors);
+
     class Parser{
     public:
-        Parser(Lexer* lexer)
-        : m_Lexer(lexer), m_Cur(m_Lexer->NextToken()), m_Next(m_Lexer->NextToken()), m_CurGlobalLabel("")
+        // Stands in for the enclosing global label of local labels that come before the
+        // first global label of a source piece, see DeferLocalScope.
+        static constexpr const char* InheritedScope = "\x01";
+
+        Parser(Lexer* lexer, const KoalaHostRegistry* host)
+        : m_Lexer(lexer), m_Host(host), m_Cur(m_Lexer->NextToken()), m_Next(m_Lexer->NextToken()), m_CurGlobalLabel("")
         {}
 
         IRProgram MakeProgram();
+        // Streaming: parses the next label or instruction into `nodes` (nothing on a
+        // syntax error). Returns false once the input is exhausted.
+        bool ParseNext(IRNodes* nodes);
         inline bool IsSuccess() const { return m_Errors.size() == 0; }
         void PrintErrors();
+        inline const std::vector<ParserError>& GetErrors() const { return m_Errors; }
+
+        // For a piece of a file that does not start it: local labels before its first
+        // global label are prefixed with InheritedScope instead of being rejected.
+        inline void DeferLocalScope() { m_CurGlobalLabel = InheritedScope; }
+        // Global label in scope at the current position.
+        inline const std::string& GetGlobalLabel() const { return m_CurGlobalLabel; }
         
     private:
         Lexer* m_Lexer;
+        const KoalaHostRegistry* m_Host;
         Token m_Cur;
         Token m_Next;
         
@@ -0,0 +1,143 @@
+#include "time_trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sys/resource.h>
+
+namespace koalac{
+
+    struct TraceEvent{
+        std::string Name;
+        std::string Detail;
+        char Phase;  //'X' complete span, 'C' counter
+        int64_t Ts;  //us since timeTraceInit
+        int64_t Dur;
+        uint32_t Tid;
+        std::vector<std::pair<const char*, int64_t>> Args;
+    };
+
+    struct TimeTraceState{
+        std::atomic<bool> Enabled{false};
+        std::chrono::steady_clock::time_point Start;
+        std::mutex Mutex;
+        std::vector<TraceEvent> Events;
+        std::map<std::string, uint64_t> Totals;
+        std::atomic<uint32_t> NextTid{0};
+    };
+
+    static TimeTraceState g_Trace;
+
+    static int64_t nowUs(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_Trace.Start).count();
+    }
+
+    static uint32_t threadTrack(){
+        thread_local uint32_t tid = g_Trace.NextTid.fetch_add(1);
+        return tid;
+    }
+
+    static std::string escapeJson(const std::string& str){
+        std::string out;
+        for(char c : str){
+            if(c == '"' || c == '\\') out += '\\';
+            if(static_cast<unsigned char>(c) < 0x20) continue;
+            out += c;
+        }
+        return out;
+    }
+
+    void timeTraceInit(){
+        g_Trace.Start = std::chrono::steady_clock::now();
+        g_Trace.Enabled = true;
+        threadTrack(); //main thread is track 0
+    }
+
+    bool timeTraceEnabled(){
+        return g_Trace.Enabled.load(std::memory_order_relaxed);
+    }
+
+    void timeTraceCount(const char* name, uint64_t delta){
+        if(!timeTraceEnabled()) return;
+
+        std::lock_guard lock(g_Trace.Mutex);
+        g_Trace.Totals[name] += delta;
+    }
+
+    void timeTraceSample(const char* name, int64_t value){
+        if(!timeTraceEnabled()) return;
+
+        TraceEvent event{ name, "", 'C', nowUs(), 0, 0, { { "value", value } } };
+        std::lock_guard lock(g_Trace.Mutex);
+        g_Trace.Events.push_back(std::move(event));
+    }
+
+    void timeTraceSampleMemory(){
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) == 0) timeTraceSample("peak_rss_kb", usage.ru_maxrss);
+    }
+
+    TimeTraceScope::TimeTraceScope(std::string name, std::string detail)
+    : m_Enabled(timeTraceEnabled())
+    {
+        if(!m_Enabled) return;
+
+        m_Name = std::move(name);
+        m_Detail = std::move(detail);
+        m_Start = nowUs();
+    }
+
+    TimeTraceScope::~TimeTraceScope(){
+        if(!m_Enabled) return;
+
+        int64_t end = nowUs();
+        TraceEvent event{ std::move(m_Name), std::move(m_Detail), 'X', m_Start, end - m_Start, threadTrack(), std::move(m_Args) };
+        std::lock_guard lock(g_Trace.Mutex);
+        g_Trace.Events.push_back(std::move(event));
+    }
+
+    void TimeTraceScope::SetArg(const char* key, int64_t value){
+        if(m_Enabled) m_Args.emplace_back(key, value);
+    }
+
+    bool timeTraceWrite(const std::string& path){
+        timeTraceSampleMemory();
+
+        std::lock_guard lock(g_Trace.Mutex);
+        int64_t end = nowUs();
+        for(const auto& [name, total] : g_Trace.Totals){
+            g_Trace.Events.push_back({ name, "", 'C', end, 0, 0, { { "value", static_cast<int64_t>(total) } } });
+        }
+
+        std::ofstream out(path);
+        if(!out) return false;
+
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for(const TraceEvent& event : g_Trace.Events){
+            if(!first) out << ",\n";
+            first = false;
+
+            out << "{\"name\":\"" << escapeJson(event.Name) << "\",\"ph\":\"" << event.Phase << "\",\"ts\":" << event.Ts;
+            if(event.Phase == 'X') out << ",\"dur\":" << event.Dur;
+            out << ",\"pid\":1,\"tid\":" << event.Tid << ",\"args\":{";
+
+            bool firstArg = true;
+            if(!event.Detail.empty()){
+                out << "\"detail\":\"" << escapeJson(event.Detail) << "\"";
+                firstArg = false;
+            }
+            for(const auto& [key, value] : event.Args){
+                out << (firstArg ? "" : ",") << "\"" << key << "\":" << value;
+                firstArg = false;
+            }
+            out << "}}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+        return out.good();
+    }
+
+}
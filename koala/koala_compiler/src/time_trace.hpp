@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace koalac{
+
+    // Compile-time tracing for `koalac --time-trace`, written as Chrome trace-event JSON
+    // (chrome://tracing, Perfetto). Disabled unless timeTraceInit was called, in which
+    // case scopes and counters cost one branch.
+    void timeTraceInit();
+    bool timeTraceEnabled();
+    // Returns false when the file cannot be written.
+    bool timeTraceWrite(const std::string& path);
+
+    // Adds to a counter reported once, with its total, at the end of the trace.
+    void timeTraceCount(const char* name, uint64_t delta);
+    // Records the current value of a counter track.
+    void timeTraceSample(const char* name, int64_t value);
+    // Samples peak RSS, typically after a phase.
+    void timeTraceSampleMemory();
+
+    // Span from construction to destruction, on the calling thread's track.
+    class TimeTraceScope{
+    public:
+        explicit TimeTraceScope(std::string name, std::string detail = "");
+        ~TimeTraceScope();
+
+        TimeTraceScope(const TimeTraceScope&) = delete;
+        TimeTraceScope& operator=(const TimeTraceScope&) = delete;
+
+        // Extra value shown with the span.
+        void SetArg(const char* key, int64_t value);
+    private:
+        bool m_Enabled;
+        std::string m_Name;
+        std::string m_Detail;
+        int64_t m_Start = 0;
+        std::vector<std::pair<const char*, int64_t>> m_Args;
+    };
+
+}
@@ -1,18 +1,159 @@
 #include "translator/translator.hpp"
+#include "time_trace.hpp"
 
 #include <unordered_map>
 #include <string>
 #include <bit>
 #include <array>
+#include <algorithm>
 #include <format>
 
 namespace koalac{
-    Bytecode translateToBytecode(IRProgram& program){
+
+    struct DenseAluForm{
+        OpCode Reg;
+        OpCode RegPacked;
+        OpCode Imm16;
+        OpCode Imm8; //NONE when there is no imm8 form
+    };
+
+    static const DenseAluForm DenseAluForms[] = {
+        { OpCode::ADD_REG,  OpCode::ADD_REG_PACKED,  OpCode::ADD_IMM16,  OpCode::ADD_IMM8 },
+        { OpCode::SUB_REG,  OpCode::SUB_REG_PACKED,  OpCode::SUB_IMM16,  OpCode::SUB_IMM8 },
+        { OpCode::MUL_REG,  OpCode::MUL_REG_PACKED,  OpCode::MUL_IMM16,  OpCode::MUL_IMM8 },
+        { OpCode::IDIV_REG, OpCode::IDIV_REG_PACKED, OpCode::NONE,       OpCode::NONE },
+        { OpCode::DIV_REG,  OpCode::DIV_REG_PACKED,  OpCode::NONE,       OpCode::NONE },
+        { OpCode::IREM_REG, OpCode::IREM_REG_PACKED, OpCode::NONE,       OpCode::NONE },
+        { OpCode::REM_REG,  OpCode::REM_REG_PACKED,  OpCode::NONE,       OpCode::NONE },
+        { OpCode::AND_REG,  OpCode::AND_REG_PACKED,  OpCode::AND_IMM16,  OpCode::AND_IMM8 },
+        { OpCode::OR_REG,   OpCode::OR_REG_PACKED,   OpCode::OR_IMM16,   OpCode::OR_IMM8 },
+        { OpCode::XOR_REG,  OpCode::XOR_REG_PACKED,  OpCode::XOR_IMM16,  OpCode::XOR_IMM8 },
+        { OpCode::SHL_REG,  OpCode::SHL_REG_PACKED,  OpCode::SHL_IMM16,  OpCode::SHL_IMM8 },
+        { OpCode::SHR_REG,  OpCode::SHR_REG_PACKED,  OpCode::SHR_IMM16,  OpCode::SHR_IMM8 },
+        { OpCode::SAR_REG,  OpCode::SAR_REG_PACKED,  OpCode::SAR_IMM16,  OpCode::SAR_IMM8 },
+    };
+
+    static bool fitsOffset(int64_t offset, size_t size){
+        if(size == 1) return offset >= INT8_MIN && offset <= INT8_MAX;
+        if(size == 2) return offset >= INT16_MIN && offset <= INT16_MAX;
+        return true;
+    }
+
+    static bool isPackableReg(const IRArg& arg){
+        return std::holds_alternative<uint8_t>(arg) && std::get<uint8_t>(arg) < 16;
+    }
+
+    static uint8_t packRegs(const IRArg& hi, const IRArg& lo){
+        return static_cast<uint8_t>((std::get<uint8_t>(hi) << 4) | std::get<uint8_t>(lo));
+    }
+
+    // Rewrites the instruction into its dense form when the operands allow it. Immediates
+    // keep their meaning: imm16/imm64 are sign-extended by the VM, and so are imm8/imm32.
+    // Jumps are left to the relaxation loop since label positions are not known yet.
+    static void selectDenseForm(IRInstruction* instr){
+        std::vector<IRArg>& args = instr->Args;
+
+        switch(instr->Op){
+            case OpCode::MOV_IMM16:{
+                int16_t imm = static_cast<int16_t>(std::get<uint16_t>(args[1]));
+                if(imm >= INT8_MIN && imm <= INT8_MAX){
+                    instr->Op = OpCode::MOV_IMM8;
+                    args[1] = static_cast<uint8_t>(imm);
+                }
+                return;
+            }
+            case OpCode::MOV_IMM64:{
+                int64_t imm = static_cast<int64_t>(std::get<uint64_t>(args[1]));
+                if(imm >= INT32_MIN && imm <= INT32_MAX){
+                    instr->Op = OpCode::MOV_IMM32;
+                    args[1] = static_cast<uint32_t>(imm);
+                }
+                return;
+            }
+            case OpCode::MOV_REG:{
+                if(isPackableReg(args[0]) && isPackableReg(args[1])){
+                    instr->Op = OpCode::MOV_REG_PACKED;
+                    args = { packRegs(args[0], args[1]) };
+                }
+                return;
+            }
+            default: break;
+        }
+
+        for(const DenseAluForm& form : DenseAluForms){
+            if(instr->Op == form.Reg && isPackableReg(args[0]) && isPackableReg(args[1])){
+                instr->Op = form.RegPacked;
+                args = { packRegs(args[0], args[1]), args[2] };
+                return;
+            }
+
+            if(instr->Op == form.Imm16 && form.Imm8 != OpCode::NONE && isPackableReg(args[0]) && isPackableReg(args[1])){
+                int16_t imm = static_cast<int16_t>(std::get<uint16_t>(args[2]));
+                if(imm >= INT8_MIN && imm <= INT8_MAX){
+                    instr->Op = form.Imm8;
+                    args = { packRegs(args[0], args[1]), static_cast<uint8_t>(imm) };
+                }
+                return;
+            }
+        }
+    }
+
+    template<typename T>
+    static void appendValue(Bytecode& bc, T val){
+        auto bytes = std::bit_cast<std::array<uint8_t, sizeof(T)>>(val);
+        bc.insert(bc.end(), bytes.begin(), bytes.end());
+    }
+
+    // Appends the encoding of `instr`; `relOffset` is the already resolved offset of its
+    // label operand, if it has one.
+    static void encodeInstruction(Bytecode& bc, const IRInstruction& instr, int64_t relOffset){
+        bc.push_back(static_cast<uint8_t>(instr.Op));
+
+        for(const auto& arg : instr.Args){
+            std::visit([&](const auto& val){
+                using T = std::decay_t<decltype(val)>;
+
+                if constexpr (std::is_same_v<T, VirtualRegister>){
+                    throw std::runtime_error(std::format("Compilation failed with fatal error: virtual register 'v{}' was not allocated", val.Id));
+                } else if constexpr (std::is_same_v<T, std::string>){
+                    switch(jumpOffsetSize(instr.Op)){
+                        case sizeof(int8_t):  bc.push_back(static_cast<uint8_t>(static_cast<int8_t>(relOffset))); break;
+                        case sizeof(int16_t): appendValue(bc, static_cast<int16_t>(relOffset)); break;
+                        case sizeof(int64_t): appendValue(bc, relOffset); break;
+                        default: break;
+                    }
+                } else {
+                    appendValue(bc, val);
+                }
+            }, arg);
+        }
+        for(size_t i = instr.Args.size(); instr.Op == OpCode::CALLHOST && i < CallHostOperands; ++i){
+            bc.push_back(0);
+        }
+    }
+
+    Bytecode translateToBytecode(IRProgram& program, const TranslatorOptions& options){
         std::unordered_map<std::string, size_t> labelPositions;
         bool sizeChanged = true;
         size_t bcSize = 0;
+
+        //initial encodings: the narrowest forms, jumps only ever widen from here
+        for(const auto& node : program.GetNodes()){
+            if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
+                if(options.Dense) selectDenseForm(instr);
+
+                //any member: a program may be translated again after its jumps were rewritten
+                const JumpFamily* family = findJumpFamily(instr->Op);
+                if(family){
+                    instr->Op = options.Dense && family->Short8 != OpCode::NONE ? family->Short8 : family->Short;
+                }
+            }
+        }
         
+        size_t iteration = 0;
         while(sizeChanged){
+            TimeTraceScope trace("Relaxation iteration", std::format("#{}", iteration++));
+            size_t promoted = 0;
             sizeChanged = false;
             labelPositions.clear();
             size_t bcPtr = 0;
@@ -20,12 +161,6 @@ namespace koalac{
             //calc tentative pos
             for(const auto& node : program.GetNodes()){
                 if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
-                    if(instr->Op == OpCode::_JMP_UNDEFINED ||
-                       instr->Op == OpCode::_JEZ_UNDEFINED ||
-                       instr->Op == OpCode::_JNZ_UNDEFINED
-                    ){
-                        instr->Op = static_cast<OpCode>(static_cast<uint8_t>(instr->Op) + 1); //_SHORT is always + 1 after _UNDEFINED
-                    }
                     bcPtr += instr->GetSize();
                 } else if(auto* label = dynamic_cast<IRLabel*>(node.get())){
                     labelPositions[label->Label] = bcPtr;
@@ -38,17 +173,15 @@ namespace koalac{
             for(const auto& node : program.GetNodes()){
                 if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
                     size_t currInstrSize = instr->GetSize();
+                    size_t offsetSize = jumpOffsetSize(instr->Op);
 
-                    if(instr->Op == OpCode::JMP_SHORT ||
-                        instr->Op == OpCode::JEZ_SHORT ||
-                        instr->Op == OpCode::JNZ_SHORT
-                    ){
+                    if(offsetSize != 0 && offsetSize != sizeof(int64_t)){
                         for(const auto& arg : instr->Args){
                             if(std::holds_alternative<std::string>(arg)){
                                 const std::string& target = std::get<std::string>(arg);
 
                                 if(labelPositions.find(target) == labelPositions.end()){
-                                    std::runtime_error(std::format("Compilation failed with fatal error: label '{}' not found", target));
+                                    throw std::runtime_error(std::format("Compilation failed with fatal error: label '{}' not found", target));
                                 }
 
                                 size_t targetPos = labelPositions[target];
@@ -56,9 +189,11 @@ namespace koalac{
 
                                 int64_t relOffset = static_cast<int64_t>(targetPos) - static_cast<int64_t>(nextInstrPos);
 
-                                if(relOffset < INT16_MIN || relOffset > INT16_MAX){
-                                    instr->Op = static_cast<OpCode>(static_cast<uint8_t>(instr->Op) + 1); //_LONG is always + 1 after _SHORT
+                                if(!fitsOffset(relOffset, offsetSize)){
+                                    const JumpFamily* family = findJumpFamily(instr->Op);
+                                    instr->Op = instr->Op == family->Short8 ? family->Short : family->Long;
                                     sizeChanged = true;
+                                    promoted++;
                                 }
 
                                 break;
@@ -69,9 +204,13 @@ namespace koalac{
                     bcPtr += currInstrSize;
                 }
             }
+
+            trace.SetArg("promoted", static_cast<int64_t>(promoted));
+            timeTraceCount("promoted_jumps", promoted);
         }
 
         //bytecode generating
+        TimeTraceScope trace("Encode");
         Bytecode bc;
         bc.reserve(bcSize);
         size_t bcPtr = 0;
@@ -79,46 +218,15 @@ namespace koalac{
         for(const auto& node : program.GetNodes()){
             if(auto* instr = dynamic_cast<IRInstruction*>(node.get())){
                 size_t instrSize = instr->GetSize();
-                
-                bc.push_back(static_cast<uint8_t>(instr->Op));
+                instr->Offset = bcPtr;
 
+                int64_t relOffset = 0;
                 for(const auto& arg : instr->Args){
-                    std::visit([&](auto val){
-                        using T = std::decay_t<decltype(val)>;
-
-                        if constexpr (std::is_same_v<T, uint8_t>){
-                            bc.push_back(val);
-                        } else if constexpr (std::is_same_v<T, uint16_t>){
-                            auto bytes = std::bit_cast<std::array<uint8_t, sizeof(uint16_t)>>(static_cast<uint16_t>(val));
-                            bc.insert(bc.end(), bytes.begin(), bytes.end());
-                        } else if constexpr (std::is_same_v<T, uint64_t>){
-                            auto bytes = std::bit_cast<std::array<uint8_t, sizeof(uint64_t)>>(static_cast<uint64_t>(val));
-                            bc.insert(bc.end(), bytes.begin(), bytes.end());
-                        } else if constexpr (std::is_same_v<T, std::string>){
-                            size_t targetPos = labelPositions[val];
-                            size_t nextInstrPos = bcPtr + instrSize;
-                            int64_t relOffset = static_cast<int64_t>(targetPos) - static_cast<int64_t>(nextInstrPos);
-
-                            if(instr->Op == OpCode::JMP_SHORT ||
-                               instr->Op == OpCode::JEZ_SHORT ||
-                               instr->Op == OpCode::JNZ_SHORT
-                            ){
-                                int16_t offset16 = static_cast<int16_t>(relOffset);
-                                auto bytes = std::bit_cast<std::array<uint8_t, sizeof(int16_t)>>(offset16);
-                                bc.insert(bc.end(), bytes.begin(), bytes.end());
-                            } else if(instr->Op == OpCode::JMP_LONG ||
-                                      instr->Op == OpCode::JEZ_LONG ||
-                                      instr->Op == OpCode::JNZ_LONG
-                            ){
-                                int64_t offset64 = static_cast<int64_t>(relOffset);
-                                auto bytes = std::bit_cast<std::array<uint8_t, sizeof(int64_t)>>(offset64);
-                                bc.insert(bc.end(), bytes.begin(), bytes.end());
-                            }
-
-                        }
-
-                    }, arg);
+                    if(std::holds_alternative<std::string>(arg)){
+                        relOffset = static_cast<int64_t>(labelPositions[std::get<std::string>(arg)]) - static_cast<int64_t>(bcPtr + instrSize);
+                    }
                 }
+                encodeInstruction(bc, *instr, relOffset);
 
                 bcPtr += instrSize;
             }
@@ -126,4 +234,104 @@ namespace koalac{
 
         return std::move(bc);
     }
-}
\ No newline at end of file
+
+    static constexpr size_t StreamBufferSize = 64 * 1024;
+
+    StreamingTranslator::StreamingTranslator(std::ostream* out, const TranslatorOptions& options)
+    : m_Out(out), m_Options(options), m_Base(out->tellp())
+    {
+        m_Buffer.reserve(StreamBufferSize);
+    }
+
+    void StreamingTranslator::Emit(IRNode& node){
+        if(auto* label = dynamic_cast<IRLabel*>(&node)){
+            if(label->Local){
+                m_ScopeLabels[label->Label] = m_Size;
+            } else {
+                m_ScopeLabels.clear();
+                m_Labels[label->Label] = m_Size;
+            }
+
+            auto pending = m_Pending.find(label->Label);
+            if(pending != m_Pending.end()){
+                for(const PendingJump& jump : pending->second){
+                    Patch(jump.OffsetPos, static_cast<int64_t>(m_Size) - static_cast<int64_t>(jump.NextInstrPos));
+                }
+                m_Pending.erase(pending);
+            }
+            return;
+        }
+
+        auto* instr = dynamic_cast<IRInstruction*>(&node);
+        if(!instr) return;
+
+        if(m_Options.Dense) selectDenseForm(instr);
+
+        int64_t relOffset = 0;
+        if(const JumpFamily* family = findJumpFamily(instr->Op)){
+            const std::string& target = std::get<std::string>(instr->Args.back());
+            const size_t* known = nullptr;
+            if(auto local = m_ScopeLabels.find(target); local != m_ScopeLabels.end()) known = &local->second;
+            else if(auto global = m_Labels.find(target); global != m_Labels.end()) known = &global->second;
+
+            if(known){
+                //backward: the target is fixed, take the first form that reaches it
+                OpCode forms[] = { m_Options.Dense ? family->Short8 : OpCode::NONE, family->Short, family->Long };
+                for(OpCode form : forms){
+                    if(form == OpCode::NONE) continue;
+
+                    instr->Op = form;
+                    relOffset = static_cast<int64_t>(*known) - static_cast<int64_t>(m_Size + instr->GetSize());
+                    if(fitsOffset(relOffset, jumpOffsetSize(form))) break;
+                }
+            } else {
+                instr->Op = family->Long;
+                size_t next = m_Size + instr->GetSize();
+                m_Pending[target].push_back({ next - sizeof(int64_t), next });
+            }
+        }
+
+        instr->Offset = m_Size;
+        size_t before = m_Buffer.size();
+        encodeInstruction(m_Buffer, *instr, relOffset);
+        m_Size += m_Buffer.size() - before;
+
+        if(m_Buffer.size() >= StreamBufferSize) Flush();
+    }
+
+    void StreamingTranslator::Patch(size_t pos, int64_t value){
+        auto bytes = std::bit_cast<std::array<uint8_t, sizeof(int64_t)>>(value);
+
+        if(pos >= m_Flushed){
+            std::copy(bytes.begin(), bytes.end(), m_Buffer.begin() + static_cast<std::ptrdiff_t>(pos - m_Flushed));
+            return;
+        }
+
+        //instructions are flushed whole, so the offset is entirely in the file
+        std::streampos end = m_Out->tellp();
+        m_Out->seekp(m_Base + static_cast<std::streamoff>(pos));
+        m_Out->write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        m_Out->seekp(end);
+    }
+
+    void StreamingTranslator::Flush(){
+        m_Out->write(reinterpret_cast<const char*>(m_Buffer.data()), static_cast<std::streamsize>(m_Buffer.size()));
+        m_Flushed += m_Buffer.size();
+        m_Buffer.clear();
+    }
+
+    bool StreamingTranslator::Finish(std::string* error){
+        Flush();
+        m_Out->flush();
+
+        if(!m_Pending.empty()){
+            *error = std::format("Compilation failed with fatal error: label '{}' not found", m_Pending.begin()->first);
+            return false;
+        }
+        if(!m_Out->good()){
+            *error = "Error occured while writing bytecode data.";
+            return false;
+        }
+        return true;
+    }
+}
@@ -1,11 +1,60 @@
 #pragma once
 
 #include "ir.hpp"
+#include <KoalaCompiler>
 #include <vector>
 #include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
 
 namespace koalac{
-    using Bytecode = std::vector<uint8_t>;
+    struct TranslatorOptions{
+        // Pick the compact encodings (packed register pairs, imm8/imm32, 8-bit jumps)
+        // wherever the operands allow it.
+        bool Dense = false;
+    };
 
-    Bytecode translateToBytecode(IRProgram& program);
-}
\ No newline at end of file
+    Bytecode translateToBytecode(IRProgram& program, const TranslatorOptions& options = {});
+
+    // Translates nodes one at a time, as the parser produces them, and writes the
+    // bytecode to a seekable stream as it goes. A jump to a label already seen gets the
+    // narrowest form that reaches it; a forward jump is written in the long form and
+    // backpatched when its label appears. Memory holds the global labels, the local
+    // labels of the current global label, the forward jumps still pending and one
+    // output buffer, not the program.
+    class StreamingTranslator{
+    public:
+        StreamingTranslator(std::ostream* out, const TranslatorOptions& options);
+
+        void Emit(IRNode& node);
+        // Flushes the remaining output. Returns false, with a message in `error`, when
+        // a label was never defined or writing failed.
+        bool Finish(std::string* error);
+
+        inline size_t GetSize() const { return m_Size; }
+    private:
+        struct PendingJump{
+            size_t OffsetPos;    //where the 8-byte offset goes
+            size_t NextInstrPos; //what it is relative to
+        };
+
+        std::ostream* m_Out;
+        TranslatorOptions m_Options;
+        std::streampos m_Base;
+
+        Bytecode m_Buffer;
+        size_t m_Flushed = 0; //bytes of the bytecode already handed to m_Out
+        size_t m_Size = 0;
+
+        std::unordered_map<std::string, size_t> m_Labels;
+        //local labels under the current global label, dropped at the next one: the
+        //parser qualifies '.name' with the global label in scope, so no later jump can
+        //name them
+        std::unordered_map<std::string, size_t> m_ScopeLabels;
+        std::unordered_map<std::string, std::vector<PendingJump>> m_Pending;
+
+        void Patch(size_t pos, int64_t value);
+        void Flush();
+    };
+}
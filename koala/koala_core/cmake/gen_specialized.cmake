@@ -0,0 +1,23 @@
+# Generates the list of operand-specialized handlers used by src/vm_specialized.c:
+# one KOALA_SPEC(opcode, register) entry per specialized opcode and register.
+#
+# Inputs: OUTPUT, OPCODES (comma separated), REGISTERS_COUNT
+
+string(REPLACE "," ";" OPCODES "${OPCODES}")
+math(EXPR LAST_REGISTER "${REGISTERS_COUNT} - 1")
+
+set(CONTENT "// Generated by cmake/gen_specialized.cmake. Do not edit.\n")
+foreach(OPCODE ${OPCODES})
+    string(APPEND CONTENT "\n")
+    foreach(REG RANGE 0 ${LAST_REGISTER})
+        string(APPEND CONTENT "KOALA_SPEC(${OPCODE}, ${REG})\n")
+    endforeach()
+endforeach()
+
+# only touch the file when it changes so dependents are not rebuilt needlessly
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" OLD_CONTENT)
+endif()
+if(NOT "${OLD_CONTENT}" STREQUAL "${CONTENT}")
+    file(WRITE "${OUTPUT}" "${CONTENT}")
+endif()
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include "vm.h"
+
+// Bounded queues of 64-bit words connecting VM instances that run on different
+// threads (SEND/RECV/TRYRECV/CLOSE). Producer and consumer indices live on separate
+// cache lines. A blocked operation spins briefly and then parks the thread on a futex
+// until the other side makes progress or the channel is closed.
+
+typedef enum KoalaChannelKind {
+    KOALA_CHANNEL_SPSC, // exactly one sending and one receiving thread
+    KOALA_CHANNEL_MPMC, // any number of both
+} KoalaChannelKind;
+
+typedef enum KoalaChannelResult {
+    KOALA_CHANNEL_OK,
+    KOALA_CHANNEL_WOULD_BLOCK, // try* only: full on send, empty on receive
+    KOALA_CHANNEL_CLOSED,      // send: closed; receive: closed and drained
+} KoalaChannelResult;
+
+typedef struct KoalaChannel KoalaChannel;
+
+// Capacity is rounded up to a power of two. Returns NULL on allocation failure.
+KoalaChannel* koalaChannelCreate(KoalaChannelKind kind, uint32_t capacity);
+void koalaChannelDestroy(KoalaChannel* channel);
+
+// Wakes every parked thread. Values sent before closing can still be received.
+void koalaChannelClose(KoalaChannel* channel);
+
+KoalaChannelResult koalaChannelSend(KoalaChannel* channel, uint64_t value);
+KoalaChannelResult koalaChannelTrySend(KoalaChannel* channel, uint64_t value);
+KoalaChannelResult koalaChannelRecv(KoalaChannel* channel, uint64_t* value);
+KoalaChannelResult koalaChannelTryRecv(KoalaChannel* channel, uint64_t* value);
+
+// Channel operands of the opcodes index this table; NULL entries count as unbound.
+// The table must outlive every execution on the state; it is kept across koalaVMStateReset.
+void koalaVMBindChannels(KoalaVMState* state, KoalaChannel* const* channels, uint32_t count);
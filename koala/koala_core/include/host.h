@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include "vm.h"
+
+// Host functions reachable from bytecode through CALLHOST. The instruction carries the
+// function's index, resolved by koalac from its name, so calls never look up strings:
+// a call is a bounds check and an indirect call through the bound registry.
+//
+// Indices are assigned in registration order, builtins first. A program compiled against
+// a list of extra names (`koalac --host <names.txt>`) expects the embedder to register
+// the same names in the same order.
+
+#define KOALA_HOST_FUNCTIONS_MAX 256
+
+// Up to three argument registers in, the result goes to the destination register.
+// Unused arguments hold unspecified values.
+typedef uint64_t (*KoalaHostFn)(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+
+typedef struct KoalaHostRegistry {
+    KoalaHostFn functions[KOALA_HOST_FUNCTIONS_MAX];
+    const char* names[KOALA_HOST_FUNCTIONS_MAX];
+    uint32_t count;
+} KoalaHostRegistry;
+
+// Empties the registry and registers the builtins (print_i64, print_u64, print_f64,
+// print_char, clock_ns).
+void koalaHostRegistryInit(KoalaHostRegistry* registry);
+
+// Appends a function and returns its index, or -1 when the name is taken or the
+// registry is full. fn may be NULL to reserve an index by name only (e.g. in koalac).
+// The name is not copied and must outlive the registry.
+int koalaHostRegister(KoalaHostRegistry* registry, const char* name, KoalaHostFn fn);
+
+// Index of a registered name, or -1.
+int koalaHostFind(const KoalaHostRegistry* registry, const char* name);
+
+// Makes the registry's functions callable from the state. The registry must outlive
+// every execution on the state; it is kept across koalaVMStateReset.
+void koalaVMBindHost(KoalaVMState* state, const KoalaHostRegistry* registry);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+// Result cache for programs whose final registers depend only on their initial ones.
+// Entries are keyed by (bytecode hash, input registers) and hold the output registers
+// and final pc of a run that halted. The table is split into independently locked
+// shards, each a fixed pool of entries with its own LRU order, so concurrent runs of
+// different inputs rarely contend and a full shard evicts its least recently used entry.
+//
+// Whether a program may be cached is the caller's decision: koalaBytecodeEffects
+// lists what else it can touch. A program that calls the host, does I/O, uses channels
+// or checkpoints has to opt out, i.e. run with koalaVMExecute instead.
+
+typedef enum KoalaEffect {
+    KOALA_EFFECT_MEMORY     = 1u << 0, // loads/stores: reads memory contents, leaves them changed
+    KOALA_EFFECT_HOST       = 1u << 1, // CALLHOST
+    KOALA_EFFECT_IO         = 1u << 2, // program input/output streams
+    KOALA_EFFECT_CHANNEL    = 1u << 3, // SEND/RECV/TRYRECV/CLOSE
+    KOALA_EFFECT_CHECKPOINT = 1u << 4, // pauses; also set for bytes that do not decode
+} KoalaEffect;
+
+// KoalaEffect bits of every instruction in a bytecode body, 0 for a pure program.
+// Memory alone is cacheable when every run starts from the same (e.g. reset) memory
+// and only the registers are looked at afterwards.
+uint32_t koalaBytecodeEffects(const uint8_t* bytecode, size_t size);
+
+typedef struct KoalaMemoStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t entries;  // currently cached
+    uint64_t capacity;
+} KoalaMemoStats;
+
+typedef struct KoalaMemo KoalaMemo;
+
+// Holds about `capacity` results (rounded up to fill every shard evenly) in `shards`
+// shards: a power of two, 0 picks KOALA_CORE_VM_MEMO_SHARDS, never more than
+// `capacity`. Returns NULL on allocation failure.
+KoalaMemo* koalaMemoCreate(size_t capacity, uint32_t shards);
+void koalaMemoDestroy(KoalaMemo* memo);
+
+// Copies the cached registers and pc of a run of the bytecode from `inputs` to
+// `outputs`/`pc` and returns 1, or returns 0 on a miss. `pc` may be NULL.
+int koalaMemoLookup(KoalaMemo* memo, uint64_t bytecodeHash, const uint64_t* inputs, uint64_t* outputs, uint64_t* pc);
+// Records (or refreshes) the result of a run, evicting the shard's least recently used
+// entry when it is full.
+void koalaMemoInsert(KoalaMemo* memo, uint64_t bytecodeHash, const uint64_t* inputs, const uint64_t* outputs, uint64_t pc);
+
+// Counters summed over all shards; each shard is read under its lock.
+void koalaMemoGetStats(KoalaMemo* memo, KoalaMemoStats* stats);
+
+// koalaVMExecute through the cache: the state's registers are the inputs of a run from
+// pc 0. A hit sets registers and pc as the run would have and returns
+// KOALA_VM_STATUS_HALTED without executing; only halted runs are recorded. A state that
+// resumes (pc != 0) always executes. bytecodeHash is koalaBytecodeHash of the body.
+KoalaVMStatus koalaVMExecuteMemoized(KoalaMemo* memo, uint64_t bytecodeHash, KoalaVMState* state, uint8_t* bytecode);
@@ -78,4 +78,144 @@ enum OpCode : uint8_t {
     _JNZ_UNDEFINED,
     JNZ_SHORT,
     JNZ_LONG,
+
+    CHECKPOINT,
+
+    LOAD8,
+    LOAD16,
+    LOAD32,
+    LOAD64,
+
+    STORE8,
+    STORE16,
+    STORE32,
+    STORE64,
+
+    MEMCOPY,
+    MEMFILL,
+
+    CALLHOST,
+
+    READ_U8,
+    READ_U64,
+    WRITE_U8,
+    WRITE_U64,
+    READ_EOF,
+
+    SEND,
+    RECV,
+    TRYRECV,
+    CLOSE,
+
+    //dense encoding (koalac --dense): two registers < 16 share one byte, high nibble first
+    MOV_IMM8,
+    MOV_IMM32,
+    MOV_REG_PACKED,
+
+    ADD_IMM8,
+    SUB_IMM8,
+    MUL_IMM8,
+    AND_IMM8,
+    OR_IMM8,
+    XOR_IMM8,
+    SHL_IMM8,
+    SHR_IMM8,
+    SAR_IMM8,
+
+    ADD_REG_PACKED,
+    SUB_REG_PACKED,
+    MUL_REG_PACKED,
+    IDIV_REG_PACKED,
+    DIV_REG_PACKED,
+    IREM_REG_PACKED,
+    REM_REG_PACKED,
+    AND_REG_PACKED,
+    OR_REG_PACKED,
+    XOR_REG_PACKED,
+    SHL_REG_PACKED,
+    SHR_REG_PACKED,
+    SAR_REG_PACKED,
+
+    JMP_SHORT8,
+    JEZ_SHORT8,
+    JNZ_SHORT8,
+
+    //compare-and-branch: if(a <cc> b) jump
+    JEQ_REG_SHORT,
+    JEQ_REG_LONG,
+    JEQ_IMM16_SHORT,
+    JEQ_IMM16_LONG,
+
+    JNE_REG_SHORT,
+    JNE_REG_LONG,
+    JNE_IMM16_SHORT,
+    JNE_IMM16_LONG,
+
+    JLT_REG_SHORT,
+    JLT_REG_LONG,
+    JLT_IMM16_SHORT,
+    JLT_IMM16_LONG,
+
+    JLE_REG_SHORT,
+    JLE_REG_LONG,
+    JLE_IMM16_SHORT,
+    JLE_IMM16_LONG,
+
+    JLTU_REG_SHORT,
+    JLTU_REG_LONG,
+    JLTU_IMM16_SHORT,
+    JLTU_IMM16_LONG,
+
+    JLEU_REG_SHORT,
+    JLEU_REG_LONG,
+    JLEU_IMM16_SHORT,
+    JLEU_IMM16_LONG,
+
+    //dst = a <cc> b ? 1 : 0
+    SETEQ_REG,
+    SETEQ_IMM16,
+    SETNE_REG,
+    SETNE_IMM16,
+    SETLT_REG,
+    SETLT_IMM16,
+    SETLE_REG,
+    SETLE_IMM16,
+    SETLTU_REG,
+    SETLTU_IMM16,
+    SETLEU_REG,
+    SETLEU_IMM16,
+
+    CMOV,
+    SELECT,
+
+    //bit manipulation: dst, src
+    POPCNT_REG,
+    CLZ_REG,
+    CTZ_REG,
+    BSWAP_REG,
+
+    //rotates: dst, a, count (mod 64)
+    ROL_REG,
+    ROL_IMM16,
+    ROR_REG,
+    ROR_IMM16,
+
+    //high 64 bits of the 128-bit product
+    MULHI_REG,
+    MULHIU_REG,
+
+    MIN_REG,
+    MIN_IMM16,
+    MAX_REG,
+    MAX_IMM16,
+    MINU_REG,
+    MINU_IMM16,
+    MAXU_REG,
+    MAXU_IMM16,
+
+    //koalac's register allocator: reg, slot16 into the spill area (KoalaVMState.spill)
+    SPILL,
+    RELOAD,
+
+    _OPCODES_COUNT, //not an instruction; engine-private opcodes start here
 };
\ No newline at end of file
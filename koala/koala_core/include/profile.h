@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+#define KOALA_PROFILE_MAGIC "KLPROF"
+#define KOALA_PROFILE_VERSION 1
+
+// Branch profile of one bytecode body: how often the jump instruction starting at
+// each pc was taken and not taken. Written by `koala --profile-out`, consumed by
+// `koalac --profile-use` to lay out basic blocks.
+typedef struct KoalaProfile {
+    uint64_t bytecodeHash;
+    uint64_t bytecodeSize;
+    uint64_t* taken;    // [bytecodeSize], indexed by the pc of the jump
+    uint64_t* notTaken; // [bytecodeSize]
+} KoalaProfile;
+
+// Returns 0 on success.
+int koalaProfileInit(KoalaProfile* profile, const uint8_t* bytecode, size_t size);
+void koalaProfileDestroy(KoalaProfile* profile);
+
+// Like koalaVMExecute on the computed-goto engine, counting every jump outcome into
+// profile, which must have been initialized for this bytecode. Slower than the plain
+// engine and not usable on specialized bytecode.
+KoalaVMStatus koalaVMExecuteProfiled(KoalaVMState* state, uint8_t* bytecode, KoalaProfile* profile);
+
+// Text format, one line per jump that executed at least once:
+//   KLPROF <version> <hash hex> <size>
+//   <pc> <taken> <not taken>
+// Returns 0 on success.
+int koalaProfileWrite(const char* path, const KoalaProfile* profile);
+int koalaProfileRead(const char* path, KoalaProfile* profile);
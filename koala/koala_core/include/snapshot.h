@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+#define KOALA_SNAPSHOT_MAGIC "KLSN"
+#define KOALA_SNAPSHOT_VERSION 1
+
+typedef enum KoalaSnapshotResult {
+    KOALA_SNAPSHOT_OK,
+    KOALA_SNAPSHOT_IO_ERROR,
+    KOALA_SNAPSHOT_BAD_FORMAT,
+} KoalaSnapshotResult;
+
+// A paused VM: where to continue, the register file, spill slots and linear memory, bound to the
+// exact bytecode body (hash and size) it was taken from. bytecodePath is informational
+// and lets `koala --resume` find the program without being told.
+//
+// Only the memory prefix up to the last non-zero byte is kept (`memory` is owned by the
+// snapshot, see koalaSnapshotRelease); the rest reads as zero again after restore.
+typedef struct KoalaSnapshot {
+    uint64_t bytecodeHash;
+    uint64_t bytecodeSize;
+    uint64_t pc;
+    uint64_t registers[KOALA_CORE_VM_REGISTERS_COUNT];
+    uint64_t spill[KOALA_CORE_VM_SPILL_SLOTS];
+    char bytecodePath[4096];
+    uint8_t* memory;
+    uint64_t memorySize;
+} KoalaSnapshot;
+
+uint64_t koalaBytecodeHash(const uint8_t* bytecode, size_t size);
+
+// Returns KOALA_SNAPSHOT_IO_ERROR when the memory copy cannot be allocated.
+KoalaSnapshotResult koalaSnapshotCapture(KoalaSnapshot* snapshot, const KoalaVMState* state, const uint8_t* bytecode, size_t size, const char* bytecodePath);
+// Fails with KOALA_SNAPSHOT_BAD_FORMAT when the bytecode is not the one the snapshot was taken
+// from, or when the state's memory is smaller than the saved contents. Resets the state first.
+KoalaSnapshotResult koalaSnapshotRestore(const KoalaSnapshot* snapshot, KoalaVMState* state, const uint8_t* bytecode, size_t size);
+
+KoalaSnapshotResult koalaSnapshotWrite(const char* path, const KoalaSnapshot* snapshot);
+KoalaSnapshotResult koalaSnapshotRead(const char* path, KoalaSnapshot* snapshot);
+void koalaSnapshotRelease(KoalaSnapshot* snapshot);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+
+// Buffered byte streams behind the READ_*/WRITE_*/EOF opcodes. The buffered bytes
+// are [pos, end): for input that is data not yet read, for output the free space
+// (pending data is [buffer, pos)). Handlers only bump pos while the buffer has
+// room and fall back to read/write on the file descriptor otherwise.
+typedef struct KoalaVMStream {
+    uint8_t* buffer;
+    uint8_t* pos;
+    uint8_t* end;
+    size_t capacity;
+    int fd;
+    int eof; // input only: the descriptor returned 0
+} KoalaVMStream;
+
+// Allocates the buffer. The descriptor is borrowed, never closed. Returns 0 on success.
+int koalaVMStreamInitInput(KoalaVMStream* stream, int fd, size_t capacity);
+int koalaVMStreamInitOutput(KoalaVMStream* stream, int fd, size_t capacity);
+// Writes out pending output. Returns 0 on success.
+int koalaVMStreamFlush(KoalaVMStream* stream);
+void koalaVMStreamDestroy(KoalaVMStream* stream);
+
+// Either stream may be NULL; I/O on an unbound stream stops with KOALA_VM_STATUS_IO_ERROR.
+// Bindings are kept across koalaVMStateReset. Stream positions are not part of snapshots.
+void koalaVMBindStreams(KoalaVMState* state, KoalaVMStream* input, KoalaVMStream* output);
@@ -1,5 +1,100 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include "vm_config.h"
 
-void koalaVMRun(uint8_t* bytecode);
\ No newline at end of file
+typedef enum KoalaVMStatus {
+    KOALA_VM_STATUS_HALTED,         // reached RET
+    KOALA_VM_STATUS_INVALID_OPCODE, // dispatched an opcode with no handler
+    KOALA_VM_STATUS_CHECKPOINT,     // paused at CHECKPOINT or on host request, resumable
+    KOALA_VM_STATUS_MEMORY_FAULT,   // accessed linear memory out of bounds
+    KOALA_VM_STATUS_INVALID_HOST_CALL, // CALLHOST to an index with no bound function
+    KOALA_VM_STATUS_IO_ERROR,       // stream I/O failed or no stream is bound
+    KOALA_VM_STATUS_CHANNEL_ERROR,  // SEND to a closed channel or use of an unbound channel
+    KOALA_VM_STATUS_DIVIDE_BY_ZERO, // DIV, IDIV, REM or IREM by zero
+} KoalaVMStatus;
+
+struct KoalaHostRegistry;
+struct KoalaVMStream;
+struct KoalaChannel;
+
+typedef struct KoalaVMState {
+    uint64_t registers[KOALA_CORE_VM_REGISTERS_COUNT];
+    uint64_t pc; // offset into the bytecode where execution (re)starts
+
+    // Set by the host (possibly from a signal handler) to pause at the next jump.
+    volatile uint8_t checkpointRequest;
+
+    // Linear memory, see koalaVMMemoryInit. Addresses are the low 32 bits of a base
+    // register plus a signed 16-bit offset. Without it every access is a memory fault.
+    uint8_t* memory;
+    uint64_t memorySize;
+
+    // Functions callable with CALLHOST, see koalaVMBindHost.
+    const struct KoalaHostRegistry* host;
+
+    // Program input and output, see koalaVMBindStreams.
+    struct KoalaVMStream* input;
+    struct KoalaVMStream* output;
+
+    // Channels addressed by SEND/RECV/TRYRECV/CLOSE, see koalaVMBindChannels.
+    struct KoalaChannel* const* channels;
+    uint32_t channelsCount;
+
+    // Executions per opcode byte, [256]. Only counted by a core built with
+    // KOALA_CORE_OPCODE_STATS (see koalaVMOpcodeStatsEnabled); NULL counts nothing.
+    uint64_t* opcodeCounts;
+
+    // Values koalac's register allocator keeps out of the register file, see SPILL/RELOAD.
+    uint64_t spill[KOALA_CORE_VM_SPILL_SLOTS];
+} KoalaVMState;
+
+void koalaVMStateInit(KoalaVMState* state);
+// Clears registers, spill slots, pc and memory contents; keeps the memory mapping and the host,
+// stream and channel bindings.
+void koalaVMStateReset(KoalaVMState* state);
+const char* koalaVMStatusString(KoalaVMStatus status);
+
+// Reserves the full 32-bit address range (plus offset reach) as PROT_NONE and makes
+// the first `size` bytes accessible. Out-of-bounds loads and stores then fault into
+// a SIGSEGV handler that ends execution with KOALA_VM_STATUS_MEMORY_FAULT, so accesses
+// carry no explicit bounds check. Returns 0 on success.
+int koalaVMMemoryInit(KoalaVMState* state, uint64_t size);
+void koalaVMMemoryDestroy(KoalaVMState* state);
+
+// Encoded size of an instruction (opcode byte included), 0 for unknown opcodes.
+size_t koalaOpcodeSize(uint8_t op);
+// Handler name of an opcode ("add_reg"), NULL for unknown and engine-private opcodes.
+const char* koalaOpcodeName(uint8_t op);
+// Checks a bytecode body that is about to run untrusted: every instruction decodes, its
+// register operands are below KOALA_CORE_VM_REGISTERS_COUNT and its jump lands on an
+// instruction or just past the last one (the trailing zero of a loaded image). Returns
+// `size` for a valid body, otherwise the offset of the first instruction that is not
+// (0 also when out of memory).
+size_t koalaBytecodeVerify(const uint8_t* bytecode, size_t size);
+// Whether the engines were built to maintain KoalaVMState.opcodeCounts.
+int koalaVMOpcodeStatsEnabled(void);
+
+// Executes bytecode from state->pc on the given state. The state is not reset, so
+// callers may preload input registers or call again after KOALA_VM_STATUS_CHECKPOINT.
+KoalaVMStatus koalaVMExecute(KoalaVMState* state, uint8_t* bytecode);
+
+// Operand-specialized engine. koalaVMSpecialize rewrites common instructions of a
+// bytecode body in place (once, at load time) into forms that only
+// koalaVMExecuteSpecialized understands; instruction sizes and offsets are unchanged.
+void koalaVMSpecialize(uint8_t* bytecode, size_t size);
+KoalaVMStatus koalaVMExecuteSpecialized(KoalaVMState* state, uint8_t* bytecode);
+
+// SPMD batch: runs bytecode from pc 0 once per register set, KOALA_CORE_VM_BATCH_LANES
+// sets at a time in SIMD lockstep. `inputs` and `results` hold `count` sets of
+// KOALA_CORE_VM_REGISTERS_COUNT registers each (set i starts at
+// i * KOALA_CORE_VM_REGISTERS_COUNT) and may be the same array; statuses[i] (optional)
+// receives the status of run i. Lanes that reach an instruction without a vector form
+// (memory, I/O, channels, host calls, checkpoint) finish on the scalar engine using
+// `scalar` for memory and bindings, shared by all runs; NULL gives them none. A lane
+// that pauses at a checkpoint reports KOALA_VM_STATUS_CHECKPOINT and is not resumed.
+void koalaVMRunBatch(uint8_t* bytecode, const uint64_t* inputs, uint64_t* results, KoalaVMStatus* statuses, size_t count, KoalaVMState* scalar);
+
+void koalaVMDumpRegisters(const KoalaVMState* state);
+void koalaVMRun(uint8_t* bytecode);
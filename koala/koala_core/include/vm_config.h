@@ -4,8 +4,30 @@
 #define KOALA_MAG_1 'L'
 #define KOALA_MAG_2 'B'
 #define KOALA_MAG_3 '0'
-#define KOALA_MAG_4 '0'
+#define KOALA_MAG_4 '1' // format version; '0' files have no register count and need 8
+
+// Bytecode header: the magic bytes, then the number of registers the program uses.
+#define KOALA_HEADER_SIZE 6
+#define KOALA_HEADER_SIZE_V0 5
 
 #define KOALA_CORE_VERSION "0.0.1"
 
+// Register file size, set per build with -DKOALA_CORE_VM_REGISTERS_COUNT=8|16|32|64.
+#ifndef KOALA_CORE_VM_REGISTERS_COUNT
 #define KOALA_CORE_VM_REGISTERS_COUNT 8
+#endif
+#define KOALA_CORE_VM_REGISTERS_MAX 64
+// Slots of the spill area koalac's register allocator moves values to when the register
+// file is full (SPILL/RELOAD).
+#define KOALA_CORE_VM_SPILL_SLOTS 256
+
+// Register sets koalaVMRunBatch executes per dispatch: 4 or 8.
+#ifndef KOALA_CORE_VM_BATCH_LANES
+#define KOALA_CORE_VM_BATCH_LANES 8
+#endif
+// Independently locked parts of a koalaMemoCreate cache unless the caller picks a count.
+#ifndef KOALA_CORE_VM_MEMO_SHARDS
+#define KOALA_CORE_VM_MEMO_SHARDS 16
+#endif
+#define KOALA_CORE_VM_MEMORY_DEFAULT_SIZE (64ull << 20)
+#define KOALA_CORE_VM_STREAM_BUFFER_SIZE (1u << 20)
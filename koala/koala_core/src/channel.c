@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include "channel.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+#define CHANNEL_SPIN_COUNT 128
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+    #define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+    #define CPU_RELAX() ((void)0)
+#endif
+
+typedef struct ChannelSlot {
+    _Atomic uint64_t seq; // MPMC only: which lap may use the slot next
+    uint64_t value;
+} ChannelSlot;
+
+// One side's parking spot: waiters announce themselves before the final check, the
+// other side bumps event and wakes only when someone announced.
+typedef struct ChannelParking {
+    alignas(CACHE_LINE_SIZE) _Atomic uint32_t event;
+    _Atomic uint32_t waiters;
+} ChannelParking;
+
+struct KoalaChannel {
+    //read-only after creation
+    alignas(CACHE_LINE_SIZE) ChannelSlot* slots;
+    uint64_t mask;
+    KoalaChannelKind kind;
+    _Atomic uint32_t closed;
+
+    //written by producers
+    alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;
+    uint64_t headCache; //SPSC: last head the producer saw
+
+    //written by consumers
+    alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;
+    uint64_t tailCache; //SPSC: last tail the consumer saw
+
+    ChannelParking senders;   //parked on a full channel
+    ChannelParking receivers; //parked on an empty channel
+};
+
+static void futexWait(_Atomic uint32_t* addr, uint32_t expected){
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t* addr, int count){
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static void channelNotify(ChannelParking* parking){
+    atomic_thread_fence(memory_order_seq_cst); //pairs with the fence in CHANNEL_BLOCKING
+    if(atomic_load_explicit(&parking->waiters, memory_order_relaxed) != 0){
+        atomic_fetch_add_explicit(&parking->event, 1, memory_order_release);
+        futexWake(&parking->event, 1);
+    }
+}
+
+KoalaChannel* koalaChannelCreate(KoalaChannelKind kind, uint32_t capacity){
+    uint64_t slotsCount = 1;
+    while(slotsCount < capacity) slotsCount <<= 1;
+
+    KoalaChannel* channel = aligned_alloc(CACHE_LINE_SIZE, sizeof(KoalaChannel));
+    if(!channel) return NULL;
+    memset(channel, 0, sizeof(*channel));
+
+    channel->slots = aligned_alloc(CACHE_LINE_SIZE, (slotsCount * sizeof(ChannelSlot) + CACHE_LINE_SIZE - 1) & ~(uint64_t)(CACHE_LINE_SIZE - 1));
+    if(!channel->slots){
+        free(channel);
+        return NULL;
+    }
+    for(uint64_t i = 0; i < slotsCount; ++i){
+        atomic_init(&channel->slots[i].seq, i);
+        channel->slots[i].value = 0;
+    }
+
+    channel->mask = slotsCount - 1;
+    channel->kind = kind;
+    return channel;
+}
+
+void koalaChannelDestroy(KoalaChannel* channel){
+    if(!channel) return;
+    free(channel->slots);
+    free(channel);
+}
+
+void koalaChannelClose(KoalaChannel* channel){
+    atomic_store(&channel->closed, 1);
+
+    atomic_fetch_add(&channel->senders.event, 1);
+    atomic_fetch_add(&channel->receivers.event, 1);
+    futexWake(&channel->senders.event, INT_MAX);
+    futexWake(&channel->receivers.event, INT_MAX);
+}
+
+static int spscPush(KoalaChannel* channel, uint64_t value){
+    uint64_t tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    if(tail - channel->headCache > channel->mask){
+        channel->headCache = atomic_load_explicit(&channel->head, memory_order_acquire);
+        if(tail - channel->headCache > channel->mask) return 0;
+    }
+    channel->slots[tail & channel->mask].value = value;
+    atomic_store_explicit(&channel->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static int spscPop(KoalaChannel* channel, uint64_t* value){
+    uint64_t head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    if(head == channel->tailCache){
+        channel->tailCache = atomic_load_explicit(&channel->tail, memory_order_acquire);
+        if(head == channel->tailCache) return 0;
+    }
+    *value = channel->slots[head & channel->mask].value;
+    atomic_store_explicit(&channel->head, head + 1, memory_order_release);
+    return 1;
+}
+
+//bounded MPMC queue with per-slot sequence numbers (D. Vyukov)
+static int mpmcPush(KoalaChannel* channel, uint64_t value){
+    uint64_t pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    for(;;){
+        ChannelSlot* slot = &channel->slots[pos & channel->mask];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                slot->value = value;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if(diff < 0){
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static int mpmcPop(KoalaChannel* channel, uint64_t* value){
+    uint64_t pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    for(;;){
+        ChannelSlot* slot = &channel->slots[pos & channel->mask];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&channel->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                *value = slot->value;
+                atomic_store_explicit(&slot->seq, pos + channel->mask + 1, memory_order_release);
+                return 1;
+            }
+        } else if(diff < 0){
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+        }
+    }
+}
+
+KoalaChannelResult koalaChannelTrySend(KoalaChannel* channel, uint64_t value){
+    if(atomic_load_explicit(&channel->closed, memory_order_acquire)) return KOALA_CHANNEL_CLOSED;
+
+    int pushed = channel->kind == KOALA_CHANNEL_SPSC ? spscPush(channel, value) : mpmcPush(channel, value);
+    if(!pushed) return KOALA_CHANNEL_WOULD_BLOCK;
+
+    channelNotify(&channel->receivers);
+    return KOALA_CHANNEL_OK;
+}
+
+KoalaChannelResult koalaChannelTryRecv(KoalaChannel* channel, uint64_t* value){
+    //read `closed` first: everything sent before closing is then already visible
+    int closed = atomic_load_explicit(&channel->closed, memory_order_acquire);
+
+    int popped = channel->kind == KOALA_CHANNEL_SPSC ? spscPop(channel, value) : mpmcPop(channel, value);
+    if(!popped) return closed ? KOALA_CHANNEL_CLOSED : KOALA_CHANNEL_WOULD_BLOCK;
+
+    channelNotify(&channel->senders);
+    return KOALA_CHANNEL_OK;
+}
+
+// Retries `attempt` until it stops reporting WOULD_BLOCK: a short spin, then parking.
+// Announcing the waiter and re-checking after a full fence means the other side
+// either sees the waiter and wakes it, or we see its progress and do not sleep.
+#define CHANNEL_BLOCKING(parking, attempt) do{\
+        KoalaChannelResult result_;\
+        for(int spin_ = 0; spin_ < CHANNEL_SPIN_COUNT; ++spin_){\
+            if((result_ = (attempt)) != KOALA_CHANNEL_WOULD_BLOCK) return result_;\
+            CPU_RELAX();\
+        }\
+        for(;;){\
+            uint32_t event_ = atomic_load_explicit(&(parking)->event, memory_order_acquire);\
+            atomic_fetch_add_explicit(&(parking)->waiters, 1, memory_order_relaxed);\
+            atomic_thread_fence(memory_order_seq_cst);\
+            result_ = (attempt);\
+            if(result_ == KOALA_CHANNEL_WOULD_BLOCK) futexWait(&(parking)->event, event_);\
+            atomic_fetch_sub_explicit(&(parking)->waiters, 1, memory_order_relaxed);\
+            if(result_ != KOALA_CHANNEL_WOULD_BLOCK) return result_;\
+        }\
+    } while(0)
+
+KoalaChannelResult koalaChannelSend(KoalaChannel* channel, uint64_t value){
+    CHANNEL_BLOCKING(&channel->senders, koalaChannelTrySend(channel, value));
+}
+
+KoalaChannelResult koalaChannelRecv(KoalaChannel* channel, uint64_t* value){
+    CHANNEL_BLOCKING(&channel->receivers, koalaChannelTryRecv(channel, value));
+}
+
+void koalaVMBindChannels(KoalaVMState* state, KoalaChannel* const* channels, uint32_t count){
+    state->channels = channels;
+    state->channelsCount = count;
+}
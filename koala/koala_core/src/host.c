@@ -0,0 +1,62 @@
+#include "host.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t hostPrintI64(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2){
+    printf("%lld\n", (long long)arg0);
+    return 0;
+}
+
+static uint64_t hostPrintU64(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2){
+    printf("%llu\n", (unsigned long long)arg0);
+    return 0;
+}
+
+static uint64_t hostPrintF64(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2){
+    double val;
+    memcpy(&val, &arg0, sizeof(val));
+    printf("%f\n", val);
+    return 0;
+}
+
+static uint64_t hostPrintChar(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2){
+    putchar((int)(uint8_t)arg0);
+    return 0;
+}
+
+static uint64_t hostClockNs(KoalaVMState* state, uint64_t arg0, uint64_t arg1, uint64_t arg2){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void koalaHostRegistryInit(KoalaHostRegistry* registry){
+    memset(registry, 0, sizeof(*registry));
+
+    koalaHostRegister(registry, "print_i64", hostPrintI64);
+    koalaHostRegister(registry, "print_u64", hostPrintU64);
+    koalaHostRegister(registry, "print_f64", hostPrintF64);
+    koalaHostRegister(registry, "print_char", hostPrintChar);
+    koalaHostRegister(registry, "clock_ns", hostClockNs);
+}
+
+int koalaHostRegister(KoalaHostRegistry* registry, const char* name, KoalaHostFn fn){
+    if(registry->count >= KOALA_HOST_FUNCTIONS_MAX || koalaHostFind(registry, name) >= 0) return -1;
+
+    registry->functions[registry->count] = fn;
+    registry->names[registry->count] = name;
+    return (int)registry->count++;
+}
+
+int koalaHostFind(const KoalaHostRegistry* registry, const char* name){
+    for(uint32_t i = 0; i < registry->count; ++i){
+        if(strcmp(registry->names[i], name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+void koalaVMBindHost(KoalaVMState* state, const KoalaHostRegistry* registry){
+    state->host = registry;
+}
@@ -0,0 +1,258 @@
+#include "memo.h"
+
+#include "opcodes.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+#define MEMO_NIL UINT32_MAX
+#define REGISTERS_SIZE (KOALA_CORE_VM_REGISTERS_COUNT * sizeof(uint64_t))
+
+static uint32_t opcodeEffects(uint8_t op){
+    switch(op){
+        case LOAD8: case LOAD16: case LOAD32: case LOAD64:
+        case STORE8: case STORE16: case STORE32: case STORE64:
+        case MEMCOPY: case MEMFILL:
+            return KOALA_EFFECT_MEMORY;
+        case CALLHOST:
+            return KOALA_EFFECT_HOST;
+        case READ_U8: case READ_U64: case WRITE_U8: case WRITE_U64: case READ_EOF:
+            return KOALA_EFFECT_IO;
+        case SEND: case RECV: case TRYRECV: case CLOSE:
+            return KOALA_EFFECT_CHANNEL;
+        case CHECKPOINT:
+            return KOALA_EFFECT_CHECKPOINT;
+        default:
+            return 0;
+    }
+}
+
+uint32_t koalaBytecodeEffects(const uint8_t* bytecode, size_t size){
+    uint32_t effects = 0;
+    for(size_t offset = 0; offset < size;){
+        size_t instrSize = koalaOpcodeSize(bytecode[offset]);
+        //an undecodable byte ends the run there with an error; nothing after it is known
+        if(instrSize == 0 || offset + instrSize > size) return effects | KOALA_EFFECT_CHECKPOINT;
+        effects |= opcodeEffects(bytecode[offset]);
+        offset += instrSize;
+    }
+    return effects;
+}
+
+typedef struct MemoEntry {
+    uint64_t keyHash;
+    uint64_t bytecodeHash;
+    uint64_t inputs[KOALA_CORE_VM_REGISTERS_COUNT];
+    uint64_t outputs[KOALA_CORE_VM_REGISTERS_COUNT];
+    uint64_t pc;
+    uint32_t chain;         // next entry of the same bucket
+    uint32_t newer, older;  // LRU order
+} MemoEntry;
+
+// Entries are handed out from the pool until it is full, then the oldest one is reused.
+typedef struct MemoShard {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    MemoEntry* entries;
+    uint32_t* buckets;
+    uint32_t bucketMask;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t newest, oldest;
+    uint64_t hits, misses, insertions, evictions;
+} MemoShard;
+
+struct KoalaMemo {
+    MemoShard* shards;
+    uint32_t shardsCount;
+};
+
+static uint64_t memoKeyHash(uint64_t bytecodeHash, const uint64_t* inputs){
+    uint64_t hash = bytecodeHash;
+    for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+        hash = (hash ^ inputs[r]) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    //splitmix64 finalizer: the shard comes from the high bits, the bucket from the low
+    hash ^= hash >> 30; hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27; hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static MemoShard* memoShard(KoalaMemo* memo, uint64_t keyHash){
+    return &memo->shards[(keyHash >> 32) & (memo->shardsCount - 1)];
+}
+
+KoalaMemo* koalaMemoCreate(size_t capacity, uint32_t shards){
+    if(shards == 0) shards = KOALA_CORE_VM_MEMO_SHARDS;
+    uint32_t shardsCount = 1;
+    while(shardsCount < shards) shardsCount <<= 1;
+    //keep the bound: no more shards than entries
+    while(shardsCount > 1 && shardsCount > capacity) shardsCount >>= 1;
+
+    size_t perShard = (capacity + shardsCount - 1) / shardsCount;
+    if(perShard == 0) perShard = 1;
+    if(perShard >= MEMO_NIL) return NULL;
+
+    uint32_t bucketsCount = 1;
+    while(bucketsCount < perShard) bucketsCount <<= 1;
+
+    KoalaMemo* memo = calloc(1, sizeof(KoalaMemo));
+    if(!memo) return NULL;
+    memo->shards = aligned_alloc(CACHE_LINE_SIZE, shardsCount * sizeof(MemoShard));
+    if(!memo->shards){
+        free(memo);
+        return NULL;
+    }
+    memset(memo->shards, 0, shardsCount * sizeof(MemoShard));
+    memo->shardsCount = shardsCount;
+
+    for(uint32_t i = 0; i < shardsCount; ++i){
+        MemoShard* shard = &memo->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->entries = malloc(perShard * sizeof(MemoEntry));
+        shard->buckets = malloc(bucketsCount * sizeof(uint32_t));
+        if(!shard->entries || !shard->buckets){
+            koalaMemoDestroy(memo);
+            return NULL;
+        }
+        memset(shard->buckets, 0xff, bucketsCount * sizeof(uint32_t)); //MEMO_NIL
+        shard->bucketMask = bucketsCount - 1;
+        shard->capacity = (uint32_t)perShard;
+        shard->newest = shard->oldest = MEMO_NIL;
+    }
+    return memo;
+}
+
+void koalaMemoDestroy(KoalaMemo* memo){
+    if(!memo) return;
+    for(uint32_t i = 0; i < memo->shardsCount; ++i){
+        pthread_mutex_destroy(&memo->shards[i].lock);
+        free(memo->shards[i].entries);
+        free(memo->shards[i].buckets);
+    }
+    free(memo->shards);
+    free(memo);
+}
+
+static uint32_t shardFind(const MemoShard* shard, uint64_t keyHash, uint64_t bytecodeHash, const uint64_t* inputs){
+    for(uint32_t idx = shard->buckets[keyHash & shard->bucketMask]; idx != MEMO_NIL; idx = shard->entries[idx].chain){
+        const MemoEntry* entry = &shard->entries[idx];
+        if(entry->keyHash == keyHash && entry->bytecodeHash == bytecodeHash && memcmp(entry->inputs, inputs, REGISTERS_SIZE) == 0){
+            return idx;
+        }
+    }
+    return MEMO_NIL;
+}
+
+static void lruUnlink(MemoShard* shard, uint32_t idx){
+    MemoEntry* entry = &shard->entries[idx];
+    if(entry->newer != MEMO_NIL) shard->entries[entry->newer].older = entry->older;
+    else shard->newest = entry->older;
+    if(entry->older != MEMO_NIL) shard->entries[entry->older].newer = entry->newer;
+    else shard->oldest = entry->newer;
+}
+
+static void lruPushNewest(MemoShard* shard, uint32_t idx){
+    MemoEntry* entry = &shard->entries[idx];
+    entry->newer = MEMO_NIL;
+    entry->older = shard->newest;
+    if(shard->newest != MEMO_NIL) shard->entries[shard->newest].newer = idx;
+    else shard->oldest = idx;
+    shard->newest = idx;
+}
+
+static void bucketUnlink(MemoShard* shard, uint32_t idx){
+    uint32_t* link = &shard->buckets[shard->entries[idx].keyHash & shard->bucketMask];
+    while(*link != idx) link = &shard->entries[*link].chain;
+    *link = shard->entries[idx].chain;
+}
+
+int koalaMemoLookup(KoalaMemo* memo, uint64_t bytecodeHash, const uint64_t* inputs, uint64_t* outputs, uint64_t* pc){
+    uint64_t keyHash = memoKeyHash(bytecodeHash, inputs);
+    MemoShard* shard = memoShard(memo, keyHash);
+
+    pthread_mutex_lock(&shard->lock);
+    uint32_t idx = shardFind(shard, keyHash, bytecodeHash, inputs);
+    if(idx == MEMO_NIL){
+        shard->misses++;
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    shard->hits++;
+    if(shard->newest != idx){
+        lruUnlink(shard, idx);
+        lruPushNewest(shard, idx);
+    }
+    const MemoEntry* entry = &shard->entries[idx];
+    memcpy(outputs, entry->outputs, REGISTERS_SIZE);
+    if(pc) *pc = entry->pc;
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+void koalaMemoInsert(KoalaMemo* memo, uint64_t bytecodeHash, const uint64_t* inputs, const uint64_t* outputs, uint64_t pc){
+    uint64_t keyHash = memoKeyHash(bytecodeHash, inputs);
+    MemoShard* shard = memoShard(memo, keyHash);
+
+    pthread_mutex_lock(&shard->lock);
+    //another thread may have finished the same run first
+    uint32_t idx = shardFind(shard, keyHash, bytecodeHash, inputs);
+    if(idx != MEMO_NIL){
+        lruUnlink(shard, idx);
+    } else {
+        if(shard->used < shard->capacity){
+            idx = shard->used++;
+        } else {
+            idx = shard->oldest;
+            lruUnlink(shard, idx);
+            bucketUnlink(shard, idx);
+            shard->evictions++;
+        }
+
+        MemoEntry* entry = &shard->entries[idx];
+        entry->keyHash = keyHash;
+        entry->bytecodeHash = bytecodeHash;
+        memcpy(entry->inputs, inputs, REGISTERS_SIZE);
+        uint32_t* bucket = &shard->buckets[keyHash & shard->bucketMask];
+        entry->chain = *bucket;
+        *bucket = idx;
+        shard->insertions++;
+    }
+
+    MemoEntry* entry = &shard->entries[idx];
+    memcpy(entry->outputs, outputs, REGISTERS_SIZE);
+    entry->pc = pc;
+    lruPushNewest(shard, idx);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void koalaMemoGetStats(KoalaMemo* memo, KoalaMemoStats* stats){
+    memset(stats, 0, sizeof(*stats));
+    for(uint32_t i = 0; i < memo->shardsCount; ++i){
+        MemoShard* shard = &memo->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->insertions += shard->insertions;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->used;
+        stats->capacity += shard->capacity;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+KoalaVMStatus koalaVMExecuteMemoized(KoalaMemo* memo, uint64_t bytecodeHash, KoalaVMState* state, uint8_t* bytecode){
+    if(state->pc != 0) return koalaVMExecute(state, bytecode);
+
+    uint64_t inputs[KOALA_CORE_VM_REGISTERS_COUNT];
+    memcpy(inputs, state->registers, REGISTERS_SIZE);
+    if(koalaMemoLookup(memo, bytecodeHash, inputs, state->registers, &state->pc)) return KOALA_VM_STATUS_HALTED;
+
+    KoalaVMStatus status = koalaVMExecute(state, bytecode);
+    if(status == KOALA_VM_STATUS_HALTED) koalaMemoInsert(memo, bytecodeHash, inputs, state->registers, state->pc);
+    return status;
+}
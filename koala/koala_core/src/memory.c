@@ -0,0 +1,147 @@
+#define _DEFAULT_SOURCE
+
+#include "vm_engine.h"
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(void*) == 8, "Guard-page memory needs a 64-bit address space");
+
+// base register (u32) + imm16 reaches [-32768, 4GiB + 32767] plus the access width
+#define GUARD_LOW_SIZE      (64ull << 10)
+#define ADDRESSABLE_SIZE    (4ull << 30)
+#define GUARD_HIGH_SIZE     (64ull << 10)
+#define RESERVATION_SIZE    (GUARD_LOW_SIZE + ADDRESSABLE_SIZE + GUARD_HIGH_SIZE)
+
+typedef struct VMFaultScope {
+    sigjmp_buf jump;
+    const KoalaVMState* state;
+} VMFaultScope;
+
+static _Thread_local VMFaultScope* tl_faultScope = NULL;
+static struct sigaction s_prevSegvAction;
+static atomic_int s_handlerInstalled = 0;
+
+static void vmFaultHandler(int sig, siginfo_t* info, void* context){
+    VMFaultScope* scope = tl_faultScope;
+    if(scope){
+        uint8_t* addr = (uint8_t*)info->si_addr;
+        uint8_t* reservation = scope->state->memory - GUARD_LOW_SIZE;
+        if(addr >= reservation && addr < reservation + RESERVATION_SIZE){
+            siglongjmp(scope->jump, 1);
+        }
+    }
+
+    //not a VM access: behave as if we were never installed
+    if(s_prevSegvAction.sa_flags & SA_SIGINFO){
+        s_prevSegvAction.sa_sigaction(sig, info, context);
+    } else if(s_prevSegvAction.sa_handler != SIG_DFL && s_prevSegvAction.sa_handler != SIG_IGN){
+        s_prevSegvAction.sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL); //the faulting instruction re-executes and terminates the process
+    }
+}
+
+static void vmInstallFaultHandler(void){
+    int expected = 0;
+    if(!atomic_compare_exchange_strong(&s_handlerInstalled, &expected, 1)) return;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = vmFaultHandler;
+    //SA_NODEFER: we leave the handler with siglongjmp without restoring the signal mask
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &s_prevSegvAction);
+}
+
+int koalaVMMemoryInit(KoalaVMState* state, uint64_t size){
+    uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    size = (size + pageSize - 1) / pageSize * pageSize;
+    if(size > ADDRESSABLE_SIZE) return -1;
+
+    uint8_t* reservation = mmap(NULL, RESERVATION_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reservation == MAP_FAILED) return -1;
+
+    uint8_t* memory = reservation + GUARD_LOW_SIZE;
+    if(size != 0 && mprotect(memory, size, PROT_READ | PROT_WRITE) != 0){
+        munmap(reservation, RESERVATION_SIZE);
+        return -1;
+    }
+
+    vmInstallFaultHandler();
+
+    state->memory = memory;
+    state->memorySize = size;
+    return 0;
+}
+
+void koalaVMMemoryDestroy(KoalaVMState* state){
+    if(!state->memory) return;
+
+    munmap(state->memory - GUARD_LOW_SIZE, RESERVATION_SIZE);
+    state->memory = NULL;
+    state->memorySize = 0;
+}
+
+void koalaVMStateReset(KoalaVMState* state){
+    //everything else is a binding to host-owned resources and stays
+    memset(state->registers, 0, sizeof(state->registers));
+    memset(state->spill, 0, sizeof(state->spill));
+    state->pc = 0;
+    state->checkpointRequest = 0;
+
+    if(state->memory){
+        //hands the pages back; they read as zero on next touch
+        madvise(state->memory, state->memorySize, MADV_DONTNEED);
+    }
+}
+
+// Lent to states without linear memory for the length of a run: a zero-size mapping,
+// so every access lands on a guard page. Shared by all of them and never unmapped.
+static _Atomic(uint8_t*) s_noMemory = NULL;
+
+static uint8_t* vmNoMemory(void){
+    uint8_t* memory = atomic_load(&s_noMemory);
+    if(memory) return memory;
+
+    uint8_t* reservation = mmap(NULL, RESERVATION_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reservation == MAP_FAILED) return NULL;
+    vmInstallFaultHandler();
+
+    uint8_t* expected = NULL;
+    if(!atomic_compare_exchange_strong(&s_noMemory, &expected, reservation + GUARD_LOW_SIZE)){
+        munmap(reservation, RESERVATION_SIZE); //another thread got there first
+        return expected;
+    }
+    return reservation + GUARD_LOW_SIZE;
+}
+
+KoalaVMStatus vmRunGuarded(VMEngineFn engine, KoalaVMState* state, uint8_t* bytecode){
+    int borrowed = 0;
+    if(!state->memory){
+        state->memory = vmNoMemory();
+        if(!state->memory) return engine(state, bytecode);
+        borrowed = 1;
+    }
+
+    VMFaultScope* prevScope = tl_faultScope;
+    VMFaultScope scope;
+    scope.state = state;
+
+    KoalaVMStatus status;
+    if(sigsetjmp(scope.jump, 0)){
+        status = KOALA_VM_STATUS_MEMORY_FAULT;
+    } else {
+        tl_faultScope = &scope;
+        status = engine(state, bytecode);
+    }
+
+    tl_faultScope = prevScope;
+    if(borrowed) state->memory = NULL;
+    return status;
+}
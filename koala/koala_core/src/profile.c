@@ -0,0 +1,75 @@
+#include "profile.h"
+#include "snapshot.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int profileAlloc(KoalaProfile* profile, uint64_t size){
+    profile->bytecodeSize = size;
+    profile->taken = calloc(size ? size : 1, sizeof(uint64_t));
+    profile->notTaken = calloc(size ? size : 1, sizeof(uint64_t));
+    if(!profile->taken || !profile->notTaken){
+        koalaProfileDestroy(profile);
+        return -1;
+    }
+    return 0;
+}
+
+int koalaProfileInit(KoalaProfile* profile, const uint8_t* bytecode, size_t size){
+    memset(profile, 0, sizeof(*profile));
+    profile->bytecodeHash = koalaBytecodeHash(bytecode, size);
+    return profileAlloc(profile, size);
+}
+
+void koalaProfileDestroy(KoalaProfile* profile){
+    free(profile->taken);
+    free(profile->notTaken);
+    memset(profile, 0, sizeof(*profile));
+}
+
+int koalaProfileWrite(const char* path, const KoalaProfile* profile){
+    FILE* f = fopen(path, "w");
+    if(!f) return -1;
+
+    int ok = fprintf(f, "%s %d %016" PRIx64 " %" PRIu64 "\n", KOALA_PROFILE_MAGIC, KOALA_PROFILE_VERSION, profile->bytecodeHash, profile->bytecodeSize) > 0;
+    for(uint64_t pc = 0; ok && pc < profile->bytecodeSize; ++pc){
+        if(profile->taken[pc] == 0 && profile->notTaken[pc] == 0) continue;
+        ok = fprintf(f, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", pc, profile->taken[pc], profile->notTaken[pc]) > 0;
+    }
+
+    if(fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+int koalaProfileRead(const char* path, KoalaProfile* profile){
+    memset(profile, 0, sizeof(*profile));
+
+    FILE* f = fopen(path, "r");
+    if(!f) return -1;
+
+    char magic[8] = {0};
+    int version = 0;
+    uint64_t hash = 0, size = 0;
+    if(fscanf(f, "%7s %d %" SCNx64 " %" SCNu64, magic, &version, &hash, &size) != 4 ||
+       strcmp(magic, KOALA_PROFILE_MAGIC) != 0 || version != KOALA_PROFILE_VERSION ||
+       profileAlloc(profile, size) != 0){
+        fclose(f);
+        return -1;
+    }
+    profile->bytecodeHash = hash;
+
+    uint64_t pc, taken, notTaken;
+    int fields;
+    while((fields = fscanf(f, "%" SCNu64 " %" SCNu64 " %" SCNu64, &pc, &taken, &notTaken)) == 3){
+        if(pc >= size) break;
+        profile->taken[pc] = taken;
+        profile->notTaken[pc] = notTaken;
+    }
+
+    int ok = fields == EOF && !ferror(f);
+    fclose(f);
+    if(!ok) koalaProfileDestroy(profile);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,196 @@
+#define _DEFAULT_SOURCE
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// /proc/self/pagemap entry bits: page present in RAM, page swapped out
+#define PAGEMAP_PRESENT     (1ull << 63)
+#define PAGEMAP_SWAPPED     (1ull << 62)
+#define PAGEMAP_BATCH       512
+
+uint64_t koalaBytecodeHash(const uint8_t* bytecode, size_t size){
+    //FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size; ++i){
+        hash ^= bytecode[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Length of linear memory up to its last non-zero byte. Pages never written (or handed back
+// by koalaVMStateReset) have no entry in the page map and read as zero, so they are skipped
+// without touching them; the rest is scanned from the top a word at a time. Without the
+// page map every page is scanned.
+static uint64_t snapshotMemoryUsed(const KoalaVMState* state){
+    if(!state->memory) return 0;
+
+    uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t firstPage = (uint64_t)(uintptr_t)state->memory / pageSize;
+    uint64_t end = state->memorySize; //a whole number of pages, see koalaVMMemoryInit
+    int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    uint64_t entries[PAGEMAP_BATCH];
+
+    while(end > 0){
+        if(pagemap >= 0){
+            uint64_t pages = end / pageSize;
+            uint64_t count = pages < PAGEMAP_BATCH ? pages : PAGEMAP_BATCH;
+            ssize_t want = (ssize_t)(count * sizeof(uint64_t));
+            if(pread(pagemap, entries, (size_t)want, (off_t)((firstPage + pages - count) * sizeof(uint64_t))) != want){
+                close(pagemap);
+                pagemap = -1;
+                continue;
+            }
+
+            uint64_t mapped = count;
+            while(mapped > 0 && !(entries[mapped - 1] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))) mapped--;
+            end -= (count - mapped) * pageSize;
+            if(mapped == 0) continue;
+        }
+
+        const uint64_t* words = (const uint64_t*)(state->memory + end - pageSize);
+        size_t word = pageSize / sizeof(uint64_t);
+        while(word > 0 && words[word - 1] == 0) word--;
+        if(word > 0){
+            uint64_t used = end - pageSize + word * sizeof(uint64_t);
+            while(state->memory[used - 1] == 0) used--;
+            if(pagemap >= 0) close(pagemap);
+            return used;
+        }
+        end -= pageSize;
+    }
+
+    if(pagemap >= 0) close(pagemap);
+    return 0;
+}
+
+KoalaSnapshotResult koalaSnapshotCapture(KoalaSnapshot* snapshot, const KoalaVMState* state, const uint8_t* bytecode, size_t size, const char* bytecodePath){
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->bytecodeHash = koalaBytecodeHash(bytecode, size);
+    snapshot->bytecodeSize = size;
+    snapshot->pc = state->pc;
+    memcpy(snapshot->registers, state->registers, sizeof(snapshot->registers));
+    memcpy(snapshot->spill, state->spill, sizeof(snapshot->spill));
+
+    if(bytecodePath){
+        strncpy(snapshot->bytecodePath, bytecodePath, sizeof(snapshot->bytecodePath) - 1);
+    }
+
+    uint64_t memoryUsed = snapshotMemoryUsed(state);
+
+    if(memoryUsed > 0){
+        snapshot->memory = malloc(memoryUsed);
+        if(!snapshot->memory) return KOALA_SNAPSHOT_IO_ERROR;
+        memcpy(snapshot->memory, state->memory, memoryUsed);
+        snapshot->memorySize = memoryUsed;
+    }
+    return KOALA_SNAPSHOT_OK;
+}
+
+void koalaSnapshotRelease(KoalaSnapshot* snapshot){
+    free(snapshot->memory);
+    snapshot->memory = NULL;
+    snapshot->memorySize = 0;
+}
+
+KoalaSnapshotResult koalaSnapshotRestore(const KoalaSnapshot* snapshot, KoalaVMState* state, const uint8_t* bytecode, size_t size){
+    if(snapshot->bytecodeSize != size ||
+       snapshot->pc >= size ||
+       snapshot->bytecodeHash != koalaBytecodeHash(bytecode, size) ||
+       snapshot->memorySize > (state->memory ? state->memorySize : 0)){
+        return KOALA_SNAPSHOT_BAD_FORMAT;
+    }
+
+    koalaVMStateReset(state);
+    state->pc = snapshot->pc;
+    memcpy(state->registers, snapshot->registers, sizeof(state->registers));
+    memcpy(state->spill, snapshot->spill, sizeof(state->spill));
+    if(snapshot->memorySize > 0){
+        memcpy(state->memory, snapshot->memory, snapshot->memorySize);
+    }
+    return KOALA_SNAPSHOT_OK;
+}
+
+// Layout (host byte order):
+// magic[4] | u32 version | u32 register count | u32 path length |
+// u64 hash | u64 size | u64 pc | u64 registers[count] | path bytes |
+// u64 memory size | memory bytes | u32 spill slot count | u64 spill[count]
+KoalaSnapshotResult koalaSnapshotWrite(const char* path, const KoalaSnapshot* snapshot){
+    FILE* f = fopen(path, "wb");
+    if(!f) return KOALA_SNAPSHOT_IO_ERROR;
+
+    uint32_t version = KOALA_SNAPSHOT_VERSION;
+    uint32_t registersCount = KOALA_CORE_VM_REGISTERS_COUNT;
+    uint32_t spillCount = KOALA_CORE_VM_SPILL_SLOTS;
+    const char* pathEnd = memchr(snapshot->bytecodePath, '\0', sizeof(snapshot->bytecodePath));
+    uint32_t pathLength = pathEnd ? (uint32_t)(pathEnd - snapshot->bytecodePath) : (uint32_t)sizeof(snapshot->bytecodePath) - 1;
+
+    int ok = fwrite(KOALA_SNAPSHOT_MAGIC, 1, 4, f) == 4 &&
+             fwrite(&version, sizeof(version), 1, f) == 1 &&
+             fwrite(&registersCount, sizeof(registersCount), 1, f) == 1 &&
+             fwrite(&pathLength, sizeof(pathLength), 1, f) == 1 &&
+             fwrite(&snapshot->bytecodeHash, sizeof(uint64_t), 1, f) == 1 &&
+             fwrite(&snapshot->bytecodeSize, sizeof(uint64_t), 1, f) == 1 &&
+             fwrite(&snapshot->pc, sizeof(uint64_t), 1, f) == 1 &&
+             fwrite(snapshot->registers, sizeof(uint64_t), registersCount, f) == registersCount &&
+             fwrite(snapshot->bytecodePath, 1, pathLength, f) == pathLength &&
+             fwrite(&snapshot->memorySize, sizeof(uint64_t), 1, f) == 1 &&
+             (snapshot->memorySize == 0 || fwrite(snapshot->memory, 1, snapshot->memorySize, f) == snapshot->memorySize) &&
+             fwrite(&spillCount, sizeof(spillCount), 1, f) == 1 &&
+             fwrite(snapshot->spill, sizeof(uint64_t), spillCount, f) == spillCount;
+
+    if(fclose(f) != 0) ok = 0;
+    return ok ? KOALA_SNAPSHOT_OK : KOALA_SNAPSHOT_IO_ERROR;
+}
+
+KoalaSnapshotResult koalaSnapshotRead(const char* path, KoalaSnapshot* snapshot){
+    FILE* f = fopen(path, "rb");
+    if(!f) return KOALA_SNAPSHOT_IO_ERROR;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    char magic[4];
+    uint32_t version = 0, registersCount = 0, pathLength = 0;
+    KoalaSnapshotResult result = KOALA_SNAPSHOT_BAD_FORMAT;
+
+    if(fread(magic, 1, 4, f) != 4 || memcmp(magic, KOALA_SNAPSHOT_MAGIC, 4) != 0) goto done;
+    if(fread(&version, sizeof(version), 1, f) != 1 || version != KOALA_SNAPSHOT_VERSION) goto done;
+    if(fread(&registersCount, sizeof(registersCount), 1, f) != 1 || registersCount != KOALA_CORE_VM_REGISTERS_COUNT) goto done;
+    if(fread(&pathLength, sizeof(pathLength), 1, f) != 1 || pathLength >= sizeof(snapshot->bytecodePath)) goto done;
+
+    if(fread(&snapshot->bytecodeHash, sizeof(uint64_t), 1, f) != 1 ||
+       fread(&snapshot->bytecodeSize, sizeof(uint64_t), 1, f) != 1 ||
+       fread(&snapshot->pc, sizeof(uint64_t), 1, f) != 1 ||
+       fread(snapshot->registers, sizeof(uint64_t), registersCount, f) != registersCount ||
+       fread(snapshot->bytecodePath, 1, pathLength, f) != pathLength) goto done;
+
+    uint64_t memorySize = 0;
+    if(fread(&memorySize, sizeof(memorySize), 1, f) != 1) goto done;
+    if(memorySize > 0){
+        snapshot->memory = malloc(memorySize);
+        if(!snapshot->memory) { result = KOALA_SNAPSHOT_IO_ERROR; goto done; }
+        snapshot->memorySize = memorySize;
+        if(fread(snapshot->memory, 1, memorySize, f) != memorySize){
+            koalaSnapshotRelease(snapshot);
+            goto done;
+        }
+    }
+
+    uint32_t spillCount = 0;
+    if(fread(&spillCount, sizeof(spillCount), 1, f) != 1 || spillCount != KOALA_CORE_VM_SPILL_SLOTS ||
+       fread(snapshot->spill, sizeof(uint64_t), spillCount, f) != spillCount){
+        koalaSnapshotRelease(snapshot);
+        goto done;
+    }
+
+    result = KOALA_SNAPSHOT_OK;
+
+done:
+    fclose(f);
+    return result;
+}
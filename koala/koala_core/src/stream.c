@@ -0,0 +1,101 @@
+#include "vm_engine.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int vmStreamAlloc(KoalaVMStream* stream, int fd, size_t capacity){
+    memset(stream, 0, sizeof(*stream));
+    stream->buffer = malloc(capacity);
+    if(!stream->buffer) return -1;
+
+    stream->capacity = capacity;
+    stream->fd = fd;
+    return 0;
+}
+
+int koalaVMStreamInitInput(KoalaVMStream* stream, int fd, size_t capacity){
+    if(vmStreamAlloc(stream, fd, capacity) != 0) return -1;
+    stream->pos = stream->end = stream->buffer;
+    return 0;
+}
+
+int koalaVMStreamInitOutput(KoalaVMStream* stream, int fd, size_t capacity){
+    if(vmStreamAlloc(stream, fd, capacity) != 0) return -1;
+    stream->pos = stream->buffer;
+    stream->end = stream->buffer + capacity;
+    return 0;
+}
+
+int koalaVMStreamFlush(KoalaVMStream* stream){
+    uint8_t* data = stream->buffer;
+    while(data < stream->pos){
+        ssize_t written = write(stream->fd, data, (size_t)(stream->pos - data));
+        if(written < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+    }
+    stream->pos = stream->buffer;
+    return 0;
+}
+
+void koalaVMStreamDestroy(KoalaVMStream* stream){
+    free(stream->buffer);
+    memset(stream, 0, sizeof(*stream));
+}
+
+void koalaVMBindStreams(KoalaVMState* state, KoalaVMStream* input, KoalaVMStream* output){
+    state->input = input;
+    state->output = output;
+}
+
+// Tops the buffer up until it holds `want` bytes or the input ends. One read per
+// call is usually enough since the buffer is much larger than any single element.
+static int vmStreamFill(KoalaVMStream* stream, size_t want){
+    size_t avail = (size_t)(stream->end - stream->pos);
+    if(stream->pos != stream->buffer){
+        memmove(stream->buffer, stream->pos, avail);
+        stream->pos = stream->buffer;
+        stream->end = stream->buffer + avail;
+    }
+
+    while(avail < want && !stream->eof){
+        ssize_t got = read(stream->fd, stream->end, stream->capacity - avail);
+        if(got < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(got == 0) stream->eof = 1;
+        stream->end += got;
+        avail += (size_t)got;
+    }
+    return 0;
+}
+
+int vmStreamReadSlow(KoalaVMStream* stream, void* dst, size_t size){
+    if(!stream || vmStreamFill(stream, size) != 0) return -1;
+
+    size_t avail = (size_t)(stream->end - stream->pos);
+    size_t count = avail < size ? avail : size; //a short tail is zero-padded by the caller
+    memcpy(dst, stream->pos, count);
+    stream->pos += count;
+    return 0;
+}
+
+int vmStreamWriteSlow(KoalaVMStream* stream, const void* src, size_t size){
+    if(!stream || koalaVMStreamFlush(stream) != 0) return -1;
+
+    memcpy(stream->pos, src, size);
+    stream->pos += size;
+    return 0;
+}
+
+int vmStreamAtEof(KoalaVMStream* stream){
+    if(!stream) return -1;
+    if(stream->pos != stream->end) return 0;
+    if(vmStreamFill(stream, 1) != 0) return -1;
+    return stream->pos == stream->end;
+}
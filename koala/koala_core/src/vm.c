@@ -1,253 +1,160 @@
-#include "vm.h"
+#include "vm_engine.h"
 
 #include "opcodes.h"
 #include "vm_config.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-void koalaVMRun(uint8_t* bytecode){
-    static void* dispatch_table[] = {
-        [RET]                           = &&vm_ret,
-
-        [MOV_IMM16]                     = &&vm_mov_imm16,
-        [MOV_IMM64]                     = &&vm_mov_imm64,
-        [MOV_REG]                       = &&vm_mov_reg,
-
-        [INC_REG]                       = &&vm_inc_reg,
-        [DEC_REG]                       = &&vm_dec_reg,
-        
-        [ADD_IMM16]                     = &&vm_add_imm16,
-        [ADD_REG]                       = &&vm_add_reg,
-        
-        [SUB_IMM16]                     = &&vm_sub_imm16,
-        [SUB_IMM16_R]                   = &&vm_sub_imm16_r,
-        [SUB_REG]                       = &&vm_sub_reg,
-
-        [MUL_IMM16]                     = &&vm_mul_imm16,
-        [MUL_REG]                       = &&vm_mul_reg,
-
-        [IDIV_IMM16]                    = &&vm_idiv_imm16,
-        [IDIV_IMM16_R]                  = &&vm_idiv_imm16_r,
-        [IDIV_REG]                      = &&vm_idiv_reg,
-
-        [DIV_IMM16]                     = &&vm_div_imm16,
-        [DIV_IMM16_R]                   = &&vm_div_imm16_r,
-        [DIV_REG]                       = &&vm_div_reg,
-
-        [NEG_IMM16]                     = &&vm_neg_imm16,
-        [NEG_REG]                       = &&vm_neg_reg,
-        
-        [IREM_IMM16]                    = &&vm_irem_imm16,
-        [IREM_IMM16_R]                  = &&vm_irem_imm16_r,
-        [IREM_REG]                      = &&vm_irem_reg,
-
-        [REM_IMM16]                     = &&vm_rem_imm16,
-        [REM_IMM16_R]                   = &&vm_rem_imm16_r,
-        [REM_REG]                       = &&vm_rem_reg,
-
-        [AND_IMM16]                     = &&vm_and_imm16,
-        [AND_REG]                       = &&vm_and_reg,
-
-        [OR_IMM16]                      = &&vm_or_imm16,
-        [OR_REG]                        = &&vm_or_reg,
-
-        [XOR_IMM16]                     = &&vm_xor_imm16,
-        [XOR_REG]                       = &&vm_xor_reg,
-
-        [NOT_IMM16]                     = &&vm_not_imm16,
-        [NOT_REG]                       = &&vm_not_reg,
-
-        [SHL_IMM16]                     = &&vm_shl_imm16,
-        [SHL_IMM16_R]                   = &&vm_shl_imm16_r,
-        [SHL_REG]                       = &&vm_shl_reg,
-
-        [SHR_IMM16]                     = &&vm_shr_imm16,
-        [SHR_IMM16_R]                   = &&vm_shr_imm16_r,
-        [SHR_REG]                       = &&vm_shr_reg,
-
-        [SAR_IMM16]                     = &&vm_sar_imm16,
-        [SAR_IMM16_R]                   = &&vm_sar_imm16_r,
-        [SAR_REG]                       = &&vm_sar_reg,
-
-        [JMP_SHORT]                     = &&vm_jmp_short,
-        [JMP_LONG]                      = &&vm_jmp_long,
-
-        [JEZ_SHORT]                     = &&vm_jez_short,
-        [JEZ_LONG]                      = &&vm_jez_long,
-
-        [JNZ_SHORT]                     = &&vm_jnz_short,
-        [JNZ_LONG]                      = &&vm_jnz_long,
+void koalaVMStateInit(KoalaVMState* state){
+    memset(state, 0, sizeof(*state));
+}
+
+const char* koalaVMStatusString(KoalaVMStatus status){
+    switch(status){
+        case KOALA_VM_STATUS_HALTED:            return "halted";
+        case KOALA_VM_STATUS_INVALID_OPCODE:    return "invalid_opcode";
+        case KOALA_VM_STATUS_CHECKPOINT:        return "checkpoint";
+        case KOALA_VM_STATUS_MEMORY_FAULT:      return "memory_fault";
+        case KOALA_VM_STATUS_INVALID_HOST_CALL: return "invalid_host_call";
+        case KOALA_VM_STATUS_IO_ERROR:          return "io_error";
+        case KOALA_VM_STATUS_CHANNEL_ERROR:     return "channel_error";
+        case KOALA_VM_STATUS_DIVIDE_BY_ZERO:    return "divide_by_zero";
+    }
+    return "unknown";
+}
+
+size_t koalaOpcodeSize(uint8_t op){
+    static const uint8_t sizes[256] = {
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = size,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
     };
-
-    uint8_t* pc = &bytecode[0];
-    uint64_t registers[KOALA_CORE_VM_REGISTERS_COUNT] = {0};
-    
-    #define DISPATCH() goto *dispatch_table[*pc++]
-
-    #define DECODE_REG(name) uint8_t name = *pc++
-    #define USE_REG(name) registers[name]
-
-    #define DECODE_IMM_N(type, name) \
-        type name = *(type*)pc;\
-        pc += sizeof(type);
-
-    #define USE_IMM_N(type, name) ((type)name)
-
-    #define DECODE_IMM16(name) DECODE_IMM_N(int16_t, name)
-    #define USE_IMM16(name) USE_IMM_N(int16_t, name)
-
-    #define DECODE_IMM64(name) DECODE_IMM_N(int64_t, name)
-    #define USE_IMM64(name) USE_IMM_N(int64_t, name)
-
-    #define CAST_TO_SIGNED(val) ((int64_t)val)
-    #define CAST_TO_UNSIGNED(val) ((uint64_t)val)
-
-    #define BITS_AS_FLOAT(bits)({\
-            double fbits;\
-            memcpy(&fbits, &bits, sizeof(fbits));\
-            fbits;\
-        })
-    
-
-    #define VM_BINARY_OP(instr, operation, type1, type2, mod)\
-        vm_##instr: {\
-            DECODE_REG(dst); DECODE_##type1(op1); DECODE_##type2(op2);\
-            USE_REG(dst) = (uint64_t)(CAST_TO_##mod(USE_##type1(op1)) operation CAST_TO_##mod(USE_##type2(op2)));\
-            DISPATCH();\
-        }
-    #define VM_UNARY_OP(instr, operation, type, mod)\
-        vm_##instr: {\
-            DECODE_REG(dst); DECODE_##type(op);\
-            USE_REG(dst) = (uint64_t)(operation CAST_TO_##mod(USE_##type(op)));\
-            DISPATCH();\
-        }
-    #define VM_UNARY_RIGHT_OP(instr, operation)\
-        vm_##instr: {\
-            DECODE_REG(dst); \
-            USE_REG(dst) operation;\
-            DISPATCH();\
-        }
-
-    DISPATCH();
-
-    vm_ret: {
-        //DBG
-        for(size_t i = 0; i < KOALA_CORE_VM_REGISTERS_COUNT; ++i){
-            double f = BITS_AS_FLOAT(registers[i]);
-            printf("R%.2ld S: %ld | U: %lu | F: %f\n", i, (int64_t)registers[i], (uint64_t)registers[i], f);
+    return sizes[op];
+}
+
+const char* koalaOpcodeName(uint8_t op){
+    static const char* names[256] = {
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = #name,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
+    };
+    return names[op];
+}
+
+// Decodes the instruction at `at`: its register operands are checked and a jump target
+// (relative to the next instruction) goes to *target, with *jumps set.
+static int verifyOperands(const uint8_t* at, const char* operands, uint64_t next, int* jumps, uint64_t* target){
+    const uint8_t* arg = at + 1;
+    *jumps = 0;
+    for(const char* kind = operands; *kind; ++kind){
+        switch(*kind){
+            case 'r': if(*arg >= KOALA_CORE_VM_REGISTERS_COUNT) return 0; arg += 1; break;
+            case 'p': if((*arg >> 4) >= KOALA_CORE_VM_REGISTERS_COUNT || (*arg & 0x0F) >= KOALA_CORE_VM_REGISTERS_COUNT) return 0; arg += 1; break;
+            case 'b': arg += 1; break;
+            case 'w': arg += 2; break;
+            case 'd': arg += 4; break;
+            case 'q': arg += 8; break;
+            case 'B': *jumps = 1; *target = next + (uint64_t)(int64_t)(int8_t)*arg; arg += 1; break;
+            case 'W': { *jumps = 1; int16_t offset; memcpy(&offset, arg, sizeof(offset)); *target = next + (uint64_t)(int64_t)offset; arg += 2; break; }
+            case 'Q': { *jumps = 1; int64_t offset; memcpy(&offset, arg, sizeof(offset)); *target = next + (uint64_t)offset; arg += 8; break; }
+            default: return 0;
         }
-        /////
-
-        return;
-    }
-
-    vm_mov_imm16: {
-        DECODE_REG(dst); DECODE_IMM16(imm);
-        USE_REG(dst) = USE_IMM16(imm);
-        DISPATCH();
-    }
-    
-    vm_mov_imm64: {
-        DECODE_REG(dst); DECODE_IMM64(imm);
-        USE_REG(dst) = USE_IMM64(imm);
-        DISPATCH();
-    }
-
-    vm_mov_reg: {
-        DECODE_REG(dst); DECODE_REG(src);
-        USE_REG(dst) = USE_REG(src);
-        DISPATCH();
-    }
-
-    VM_UNARY_RIGHT_OP(inc_reg, ++)
-    VM_UNARY_RIGHT_OP(dec_reg, --)
-
-    VM_BINARY_OP(add_imm16,     +, REG, IMM16, SIGNED)
-    VM_BINARY_OP(add_reg,       +, REG, REG, SIGNED)
-    
-    VM_BINARY_OP(sub_imm16,     -, REG, IMM16, SIGNED)
-    VM_BINARY_OP(sub_imm16_r,   -, IMM16, REG, SIGNED)
-    VM_BINARY_OP(sub_reg,       -, REG, REG, SIGNED)
-
-    VM_BINARY_OP(mul_imm16,     *, REG, IMM16, SIGNED)
-    VM_BINARY_OP(mul_reg,       *, REG, REG, SIGNED)
-
-    VM_BINARY_OP(idiv_imm16,    /, REG, IMM16, SIGNED)
-    VM_BINARY_OP(idiv_imm16_r,  /, IMM16, REG, SIGNED)
-    VM_BINARY_OP(idiv_reg,      /, REG, REG, SIGNED)
-
-    VM_BINARY_OP(div_imm16,     /, REG, IMM16, UNSIGNED)
-    VM_BINARY_OP(div_imm16_r,   /, IMM16, REG, UNSIGNED)
-    VM_BINARY_OP(div_reg,       /, REG, REG, UNSIGNED)
-
-    VM_UNARY_OP(neg_imm16,      -, IMM16, UNSIGNED)
-    VM_UNARY_OP(neg_reg,        -, REG, UNSIGNED)
-
-    VM_BINARY_OP(irem_imm16,    %, REG, IMM16, SIGNED)
-    VM_BINARY_OP(irem_imm16_r,  %, IMM16, REG, SIGNED)
-    VM_BINARY_OP(irem_reg,      %, REG, REG, SIGNED)
-
-    VM_BINARY_OP(rem_imm16,     %, REG, IMM16, UNSIGNED)
-    VM_BINARY_OP(rem_imm16_r,   %, IMM16, REG, UNSIGNED)
-    VM_BINARY_OP(rem_reg,       %, REG, REG, UNSIGNED)
-
-    VM_BINARY_OP(and_imm16,     &, REG, IMM16, SIGNED)
-    VM_BINARY_OP(and_reg,       &, REG, REG, SIGNED)
-
-    VM_BINARY_OP(or_imm16,      |, REG, IMM16, SIGNED)
-    VM_BINARY_OP(or_reg,        |, REG, REG, SIGNED)
-
-    VM_BINARY_OP(xor_imm16,     ^, REG, IMM16, SIGNED)
-    VM_BINARY_OP(xor_reg,       ^, REG, REG, SIGNED)
-    
-    VM_UNARY_OP(not_imm16,      ~, IMM16, UNSIGNED)
-    VM_UNARY_OP(not_reg,        ~, REG, UNSIGNED)
-
-    VM_BINARY_OP(shl_imm16,     <<, REG, IMM16, SIGNED)
-    VM_BINARY_OP(shl_imm16_r,   <<, IMM16, REG, SIGNED)
-    VM_BINARY_OP(shl_reg,       <<, REG, REG, SIGNED)
-
-    VM_BINARY_OP(shr_imm16,     >>, REG, IMM16, UNSIGNED)
-    VM_BINARY_OP(shr_imm16_r,   >>, IMM16, REG, UNSIGNED)
-    VM_BINARY_OP(shr_reg,       >>, REG, REG, UNSIGNED)
-
-    VM_BINARY_OP(sar_imm16,     >>, REG, IMM16, SIGNED)
-    VM_BINARY_OP(sar_imm16_r,   >>, IMM16, REG, SIGNED)
-    VM_BINARY_OP(sar_reg,       >>, REG, REG, SIGNED)
-
-    vm_jmp_short: {
-        DECODE_IMM16(offset);
-        pc += offset;
-        DISPATCH();
-    }
-
-    vm_jmp_long: {
-        DECODE_IMM64(offset);
-        pc += offset;
-        DISPATCH();
     }
+    return 1;
+}
+
+size_t koalaBytecodeVerify(const uint8_t* bytecode, size_t size){
+    static const char* operands[256] = {
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = operands,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
+    };
 
-    vm_jez_short: {
-        DECODE_REG(zf); DECODE_IMM16(offset);
-        if(USE_REG(zf) == 0) pc += offset;
-        DISPATCH();
+    //jumps may go backwards, so targets are checked once every instruction start is known
+    uint8_t* starts = calloc(size / 8 + 1, 1);
+    if(!starts) return 0;
+
+    size_t bad = size;
+    for(size_t offset = 0; offset < size;){
+        uint8_t op = bytecode[offset];
+        size_t instrSize = koalaOpcodeSize(op);
+        int jumps;
+        uint64_t target;
+        if(!operands[op] || offset + instrSize > size || !verifyOperands(&bytecode[offset], operands[op], offset + instrSize, &jumps, &target)){
+            bad = offset;
+            break;
+        }
+        starts[offset / 8] |= (uint8_t)(1u << (offset % 8));
+        offset += instrSize;
     }
 
-    vm_jez_long: {
-        DECODE_REG(zf); DECODE_IMM64(offset);
-        if(USE_REG(zf) == 0) pc += offset;
-        DISPATCH();
+    for(size_t offset = 0; offset < bad;){
+        uint8_t op = bytecode[offset];
+        size_t instrSize = koalaOpcodeSize(op);
+        int jumps;
+        uint64_t target;
+        verifyOperands(&bytecode[offset], operands[op], offset + instrSize, &jumps, &target);
+        //past the last instruction is the trailing NONE of a loaded image
+        if(jumps && target != size && (target > size || !(starts[target / 8] & (1u << (target % 8))))){
+            bad = offset;
+            break;
+        }
+        offset += instrSize;
     }
 
-    vm_jnz_short: {
-        DECODE_REG(zf); DECODE_IMM16(offset);
-        if(USE_REG(zf) != 0) pc += offset;
-        DISPATCH();
+    free(starts);
+    return bad;
+}
+
+int koalaVMOpcodeStatsEnabled(void){
+#ifdef KOALA_CORE_OPCODE_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+KoalaVMStatus koalaVMExecute(KoalaVMState* state, uint8_t* bytecode){
+    return vmRunGuarded(vmEngineExecute, state, bytecode);
+}
+
+KoalaVMStatus koalaVMExecuteSpecialized(KoalaVMState* state, uint8_t* bytecode){
+    return vmRunGuarded(vmEngineExecuteSpecialized, state, bytecode);
+}
+
+#define BITS_AS_FLOAT(bits)({\
+        double fbits;\
+        memcpy(&fbits, &bits, sizeof(fbits));\
+        fbits;\
+    })
+
+void koalaVMDumpRegisters(const KoalaVMState* state){
+    for(size_t i = 0; i < KOALA_CORE_VM_REGISTERS_COUNT; ++i){
+        double f = BITS_AS_FLOAT(state->registers[i]);
+        printf("R%.2ld S: %ld | U: %lu | F: %f\n", i, (int64_t)state->registers[i], (uint64_t)state->registers[i], f);
     }
+}
 
-    vm_jnz_long: {
-        DECODE_REG(zf); DECODE_IMM64(offset);
-        if(USE_REG(zf) != 0) pc += offset;
-        DISPATCH();
-    }
+void koalaVMRun(uint8_t* bytecode){
+    KoalaVMState state;
+    koalaVMStateInit(&state);
+    koalaVMMemoryInit(&state, KOALA_CORE_VM_MEMORY_DEFAULT_SIZE);
+    KoalaHostRegistry host;
+    koalaHostRegistryInit(&host);
+    koalaVMBindHost(&state, &host);
+    KoalaVMStream input, output;
+    koalaVMStreamInitInput(&input, 0, KOALA_CORE_VM_STREAM_BUFFER_SIZE);
+    koalaVMStreamInitOutput(&output, 1, KOALA_CORE_VM_STREAM_BUFFER_SIZE);
+    koalaVMBindStreams(&state, &input, &output);
+    while(koalaVMExecute(&state, bytecode) == KOALA_VM_STATUS_CHECKPOINT){}
+    koalaVMStreamFlush(&output);
+
+    //DBG
+    koalaVMDumpRegisters(&state);
+    /////
+
+    koalaVMStreamDestroy(&input);
+    koalaVMStreamDestroy(&output);
+    koalaVMMemoryDestroy(&state);
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vm.h"
+#include "host.h"
+#include "stream.h"
+#include "channel.h"
+
+// Internal entry points of the interpreter engines. The public koalaVMExecute*
+// functions wrap them with the linear-memory fault guard.
+
+typedef KoalaVMStatus (*VMEngineFn)(KoalaVMState* state, uint8_t* bytecode);
+
+// Provided by the engine selected with KOALA_CORE_INTERPRETER (vm_goto.c or vm_tailcall.c)
+KoalaVMStatus vmEngineExecute(KoalaVMState* state, uint8_t* bytecode);
+// Provided by vm_specialized.c
+KoalaVMStatus vmEngineExecuteSpecialized(KoalaVMState* state, uint8_t* bytecode);
+
+// Counts one execution of `op` into state->opcodeCounts; compiled in by the
+// KOALA_CORE_OPCODE_STATS build only, since it costs a branch on every dispatch.
+#ifdef KOALA_CORE_OPCODE_STATS
+    #define VM_COUNT_OPCODE(state, op) do{ if((state)->opcodeCounts) (state)->opcodeCounts[(op)]++; } while(0)
+#else
+    #define VM_COUNT_OPCODE(state, op) ((void)0)
+#endif
+
+// Bit-manipulation and wide-arithmetic results shared by the scalar and SPMD engines.
+// They are defined for every input: counting zeros of 0 gives 64, rotate counts wrap at 64.
+static inline uint64_t vmClz(uint64_t val){ return val ? (uint64_t)__builtin_clzll(val) : 64; }
+static inline uint64_t vmCtz(uint64_t val){ return val ? (uint64_t)__builtin_ctzll(val) : 64; }
+static inline uint64_t vmRotl(uint64_t val, uint64_t count){ return (val << (count & 63)) | (val >> (-count & 63)); }
+static inline uint64_t vmRotr(uint64_t val, uint64_t count){ return (val >> (count & 63)) | (val << (-count & 63)); }
+static inline uint64_t vmMulHi(uint64_t a, uint64_t b){ return (uint64_t)(((__int128)(int64_t)a * (int64_t)b) >> 64); }
+static inline uint64_t vmMulHiU(uint64_t a, uint64_t b){ return (uint64_t)(((unsigned __int128)a * b) >> 64); }
+
+// Runs engine on state and turns faults inside state's memory reservation into
+// KOALA_VM_STATUS_MEMORY_FAULT.
+KoalaVMStatus vmRunGuarded(VMEngineFn engine, KoalaVMState* state, uint8_t* bytecode);
+
+// Stream slow paths for when the buffer cannot serve the whole element (see stream.c).
+// Return -1 on I/O errors and unbound streams.
+int vmStreamReadSlow(KoalaVMStream* stream, void* dst, size_t size);
+int vmStreamWriteSlow(KoalaVMStream* stream, const void* src, size_t size);
+// 1 when the input is exhausted, 0 when more data is available.
+int vmStreamAtEof(KoalaVMStream* stream);
@@ -0,0 +1,35 @@
+#include "vm_engine.h"
+
+#include "opcodes.h"
+#include "vm_config.h"
+#include <string.h>
+
+// Computed-goto engine: every handler is a label inside one function and each one
+// ends in its own indirect jump.
+
+KoalaVMStatus vmEngineExecute(KoalaVMState* state, uint8_t* bytecode){
+    static void* dispatch_table[256] = {
+        [0 ... 255]                     = &&vm_invalid,
+
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = &&vm_##name,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
+    };
+
+    uint8_t* pc = &bytecode[state->pc];
+    uint64_t* registers = state->registers;
+    
+    #define VM_HANDLER(name) vm_##name:
+    #define DISPATCH() do{ VM_COUNT_OPCODE(state, *pc); goto *dispatch_table[*pc++]; } while(0)
+
+    //jumps are the only way to loop, so polling host requests there bounds the latency
+    #define DISPATCH_JUMP() \
+        if(state->checkpointRequest) goto vm_checkpoint;\
+        DISPATCH()
+
+    #define USE_REG(name) registers[name]
+
+    DISPATCH();
+
+    #include "vm_handlers.inc"
+}
@@ -0,0 +1,57 @@
+#include "vm_engine.h"
+#include "profile.h"
+
+#include "opcodes.h"
+#include "vm_config.h"
+#include <string.h>
+
+// The computed-goto engine again, instrumented: every dispatch remembers where its
+// instruction started, and every jump compares where it went against the next
+// instruction to count taken/not taken for that pc.
+
+static KoalaVMStatus vmEngineExecuteProfiled(KoalaVMState* state, uint8_t* bytecode, KoalaProfile* profile){
+    static void* dispatch_table[256] = {
+        [0 ... 255]                     = &&vm_invalid,
+
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = &&vm_##name,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
+    };
+
+    uint8_t* pc = &bytecode[state->pc];
+    uint8_t* instrPc = pc;
+    uint64_t* registers = state->registers;
+    uint64_t* taken = profile->taken;
+    uint64_t* notTaken = profile->notTaken;
+
+    #define VM_HANDLER(name) vm_##name:
+    #define DISPATCH() do{ instrPc = pc; goto *dispatch_table[*pc++]; } while(0)
+
+    #define DISPATCH_JUMP() do{\
+            size_t branchPc = (size_t)(instrPc - bytecode);\
+            if(pc == instrPc + koalaOpcodeSize(*instrPc)) notTaken[branchPc]++;\
+            else taken[branchPc]++;\
+            if(state->checkpointRequest) goto vm_checkpoint;\
+            DISPATCH();\
+        } while(0)
+
+    #define USE_REG(name) registers[name]
+
+    DISPATCH();
+
+    #include "vm_handlers.inc"
+}
+
+static _Thread_local KoalaProfile* tl_profile = NULL;
+
+static KoalaVMStatus vmEngineExecuteProfiledEntry(KoalaVMState* state, uint8_t* bytecode){
+    return vmEngineExecuteProfiled(state, bytecode, tl_profile);
+}
+
+KoalaVMStatus koalaVMExecuteProfiled(KoalaVMState* state, uint8_t* bytecode, KoalaProfile* profile){
+    KoalaProfile* prevProfile = tl_profile;
+    tl_profile = profile;
+    KoalaVMStatus status = vmRunGuarded(vmEngineExecuteProfiledEntry, state, bytecode);
+    tl_profile = prevProfile;
+    return status;
+}
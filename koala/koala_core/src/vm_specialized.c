@@ -0,0 +1,144 @@
+#include "vm_engine.h"
+
+#include "opcodes.h"
+#include "vm_config.h"
+#include <string.h>
+
+// Operand-specialized engine: the register file lives in local variables for the
+// whole run, and the most common instructions have one handler per register operand
+// (list generated at build time, see cmake/gen_specialized.cmake), so they never
+// index memory. Generic handlers spill the locals around their body.
+//
+// The locals are never address-taken, which lets the compiler keep them in host
+// registers across DISPATCH(). Explicitly pinning them with `register ... asm("rbx")`
+// is not honoured by GCC/Clang outside of asm operands, so it is not attempted.
+
+// Only r0..r7 live in locals and have specialized opcodes; with a larger register file
+// the remaining registers stay in memory and are reached by the generic handlers.
+#define SPEC_REGISTERS_COUNT 8
+
+_Static_assert(KOALA_CORE_VM_REGISTERS_COUNT >= SPEC_REGISTERS_COUNT, "The specialized engine keeps r0..r7 in locals");
+
+enum SpecOpCode {
+    _SPEC_OPCODES_BASE = _OPCODES_COUNT - 1,
+
+    #define KOALA_SPEC(opcode, reg) SPEC_##opcode##_##reg,
+    #include "vm_specialized_list.inc"
+    #undef KOALA_SPEC
+
+    _SPEC_OPCODES_END,
+};
+
+_Static_assert(_SPEC_OPCODES_END <= 256, "Specialized opcodes do not fit in one byte");
+
+void koalaVMSpecialize(uint8_t* bytecode, size_t size){
+    size_t idx = 0;
+
+    while(idx < size){
+        uint8_t op = bytecode[idx];
+        size_t instrSize = koalaOpcodeSize(op);
+        if(instrSize == 0 || idx + instrSize > size) return; //leave anything unknown to the generic handlers
+
+        const uint8_t* args = &bytecode[idx + 1];
+        uint8_t dst = args[0];
+
+        if(dst < SPEC_REGISTERS_COUNT){
+            switch(op){
+                case INC_REG:   bytecode[idx] = (uint8_t)(SPEC_INC_REG_0 + dst); break;
+                case DEC_REG:   bytecode[idx] = (uint8_t)(SPEC_DEC_REG_0 + dst); break;
+                case MOV_IMM16: bytecode[idx] = (uint8_t)(SPEC_MOV_IMM16_0 + dst); break;
+                case MOV_REG:   if(args[1] < SPEC_REGISTERS_COUNT) bytecode[idx] = (uint8_t)(SPEC_MOV_REG_0 + dst); break;
+                case JEZ_SHORT: bytecode[idx] = (uint8_t)(SPEC_JEZ_SHORT_0 + dst); break;
+                case JNZ_SHORT: bytecode[idx] = (uint8_t)(SPEC_JNZ_SHORT_0 + dst); break;
+
+                //accumulator forms only: dst == op1; register sources must be locals too
+                case ADD_IMM16: if(args[1] == dst) bytecode[idx] = (uint8_t)(SPEC_ADD_IMM16_0 + dst); break;
+                case SUB_IMM16: if(args[1] == dst) bytecode[idx] = (uint8_t)(SPEC_SUB_IMM16_0 + dst); break;
+                case ADD_REG:   if(args[1] == dst && args[2] < SPEC_REGISTERS_COUNT) bytecode[idx] = (uint8_t)(SPEC_ADD_REG_0 + dst); break;
+                case SUB_REG:   if(args[1] == dst && args[2] < SPEC_REGISTERS_COUNT) bytecode[idx] = (uint8_t)(SPEC_SUB_REG_0 + dst); break;
+
+                default: break;
+            }
+        }
+
+        idx += instrSize;
+    }
+}
+
+KoalaVMStatus vmEngineExecuteSpecialized(KoalaVMState* state, uint8_t* bytecode){
+    static void* dispatch_table[256] = {
+        [0 ... 255]                     = &&vm_invalid,
+
+        #define VM_OPCODE(opcode, name, size, operands) [opcode] = &&vm_##name,
+        #include "vm_opcodes.inc"
+        #undef VM_OPCODE
+
+        #define KOALA_SPEC(opcode, reg) [SPEC_##opcode##_##reg] = &&spec_##opcode##_##reg,
+        #include "vm_specialized_list.inc"
+        #undef KOALA_SPEC
+    };
+
+    uint8_t* pc = &bytecode[state->pc];
+    uint64_t* registers = state->registers;
+
+    uint64_t reg0 = registers[0], reg1 = registers[1], reg2 = registers[2], reg3 = registers[3];
+    uint64_t reg4 = registers[4], reg5 = registers[5], reg6 = registers[6], reg7 = registers[7];
+
+    #define STORE_LOCALS() \
+        registers[0] = reg0; registers[1] = reg1; registers[2] = reg2; registers[3] = reg3;\
+        registers[4] = reg4; registers[5] = reg5; registers[6] = reg6; registers[7] = reg7
+
+    #define LOAD_LOCALS() \
+        reg0 = registers[0]; reg1 = registers[1]; reg2 = registers[2]; reg3 = registers[3];\
+        reg4 = registers[4]; reg5 = registers[5]; reg6 = registers[6]; reg7 = registers[7]
+
+    //generic handlers: run on the in-memory register file
+    #define VM_HANDLER(name) vm_##name: STORE_LOCALS();
+    #define DISPATCH() do{ LOAD_LOCALS(); VM_COUNT_OPCODE(state, *pc); goto *dispatch_table[*pc++]; } while(0)
+    #define DISPATCH_JUMP() do{\
+            LOAD_LOCALS();\
+            if(state->checkpointRequest) goto vm_checkpoint;\
+            VM_COUNT_OPCODE(state, *pc);\
+            goto *dispatch_table[*pc++];\
+        } while(0)
+    #define USE_REG(name) registers[name]
+
+    //specialized handlers: run on the locals
+    #define SPEC_DISPATCH() do{ VM_COUNT_OPCODE(state, *pc); goto *dispatch_table[*pc++]; } while(0)
+    #define SPEC_DISPATCH_JUMP() do{\
+            if(state->checkpointRequest) goto vm_checkpoint;\
+            SPEC_DISPATCH();\
+        } while(0)
+
+    #define SPEC_REG(n) reg##n
+    #define SPEC_GET_REG(idx) ({\
+            uint64_t val_ = 0;\
+            switch((idx) & 7){\
+                case 0: val_ = reg0; break; case 1: val_ = reg1; break;\
+                case 2: val_ = reg2; break; case 3: val_ = reg3; break;\
+                case 4: val_ = reg4; break; case 5: val_ = reg5; break;\
+                case 6: val_ = reg6; break; case 7: val_ = reg7; break;\
+            }\
+            val_;\
+        })
+
+    //every body skips the operand bytes that the opcode itself now encodes
+    #define SPEC_BODY_INC_REG(reg)      pc += 1; SPEC_REG(reg)++;
+    #define SPEC_BODY_DEC_REG(reg)      pc += 1; SPEC_REG(reg)--;
+    #define SPEC_BODY_MOV_IMM16(reg)    pc += 1; { DECODE_IMM16(imm); SPEC_REG(reg) = (uint64_t)USE_IMM16(imm); }
+    #define SPEC_BODY_MOV_REG(reg)      pc += 1; { DECODE_REG(src); SPEC_REG(reg) = SPEC_GET_REG(src); }
+    #define SPEC_BODY_ADD_IMM16(reg)    pc += 2; { DECODE_IMM16(imm); SPEC_REG(reg) = (uint64_t)(CAST_TO_SIGNED(SPEC_REG(reg)) + USE_IMM16(imm)); }
+    #define SPEC_BODY_SUB_IMM16(reg)    pc += 2; { DECODE_IMM16(imm); SPEC_REG(reg) = (uint64_t)(CAST_TO_SIGNED(SPEC_REG(reg)) - USE_IMM16(imm)); }
+    #define SPEC_BODY_ADD_REG(reg)      pc += 2; { DECODE_REG(src); SPEC_REG(reg) = SPEC_REG(reg) + SPEC_GET_REG(src); }
+    #define SPEC_BODY_SUB_REG(reg)      pc += 2; { DECODE_REG(src); SPEC_REG(reg) = SPEC_REG(reg) - SPEC_GET_REG(src); }
+    #define SPEC_BODY_JEZ_SHORT(reg)    pc += 1; { DECODE_IMM16(offset); if(SPEC_REG(reg) == 0){ pc += offset; SPEC_DISPATCH_JUMP(); } }
+    #define SPEC_BODY_JNZ_SHORT(reg)    pc += 1; { DECODE_IMM16(offset); if(SPEC_REG(reg) != 0){ pc += offset; SPEC_DISPATCH_JUMP(); } }
+
+    SPEC_DISPATCH();
+
+    #include "vm_handlers.inc"
+
+    #define KOALA_SPEC(opcode, reg) spec_##opcode##_##reg: { SPEC_BODY_##opcode(reg) SPEC_DISPATCH(); }
+    #include "vm_specialized_list.inc"
+    #undef KOALA_SPEC
+}
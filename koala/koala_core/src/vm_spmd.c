@@ -0,0 +1,447 @@
+#include "vm_engine.h"
+
+#include "opcodes.h"
+#include "vm_config.h"
+#include <string.h>
+
+// SPMD engine behind koalaVMRunBatch: one program runs on KOALA_CORE_VM_BATCH_LANES
+// register sets at once. Every Koala register is a vector with one value per lane and a
+// lane mask selects the lanes that execute the current instruction, so one dispatch does
+// the work of all of them.
+//
+// Lanes that disagree at a conditional jump are parked at their own pc. Execution always
+// continues with the lowest pc among the unfinished lanes, and parked lanes rejoin when
+// it reaches their pc. With join points laid out after their branches and loop exits
+// after the loop body, that is the immediate post-dominator of the branch, so lanes
+// reconverge where their paths meet without a CFG analysis. Every lane only ever executes
+// its own path; the schedule just decides which lanes share a dispatch.
+//
+// Only register instructions and jumps have vector forms. A lane that reaches anything
+// else (memory, I/O, channels, host calls, checkpoints, invalid opcodes) is finished
+// alone by koalaVMExecute from that instruction.
+
+#define LANES KOALA_CORE_VM_BATCH_LANES
+
+_Static_assert(LANES == 4 || LANES == 8, "KOALA_CORE_VM_BATCH_LANES must be 4 or 8");
+
+typedef uint64_t VecU __attribute__((vector_size(LANES * sizeof(uint64_t))));
+typedef int64_t VecS __attribute__((vector_size(LANES * sizeof(int64_t))));
+
+typedef struct SpmdGroup {
+    VecU registers[KOALA_CORE_VM_REGISTERS_COUNT];
+    uint64_t pc[LANES];   // parked lanes only
+    uint32_t running;     // lanes that did not finish yet
+    KoalaVMStatus status[LANES];
+} SpmdGroup;
+
+// Vectors are only passed around inside the engine function: as arguments or return
+// values of 8-lane vectors they would depend on the AVX-512 calling convention.
+#define SPLAT(value) ((VecU){0} + (uint64_t)(value))
+
+#define LANE_MASK(bits) ({\
+        VecU mask_;\
+        for(int l_ = 0; l_ < LANES; ++l_) mask_[l_] = ((bits) >> l_) & 1 ? ~UINT64_C(0) : 0;\
+        mask_;\
+    })
+
+#define LANE_BITS(mask) ({\
+        VecU mask_ = (mask);\
+        uint32_t bits_ = 0;\
+        for(int l_ = 0; l_ < LANES; ++l_) bits_ |= (uint32_t)(mask_[l_] != 0) << l_;\
+        bits_;\
+    })
+
+static inline int16_t readImm16(const uint8_t* p){ int16_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline int32_t readImm32(const uint8_t* p){ int32_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline int64_t readImm64(const uint8_t* p){ int64_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+// Runs one lane from `offset` to the end on the scalar engine.
+static void spmdFinishScalar(SpmdGroup* group, int lane, uint8_t* bytecode, uint64_t offset, KoalaVMState* scalar){
+    for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r) scalar->registers[r] = group->registers[r][lane];
+    scalar->pc = offset;
+    scalar->checkpointRequest = 0;
+
+    group->status[lane] = koalaVMExecute(scalar, bytecode);
+
+    for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r) group->registers[r][lane] = scalar->registers[r];
+}
+
+static void spmdRunGroup(SpmdGroup* group, uint8_t* bytecode, KoalaVMState* scalar){
+    static void* dispatch_table[256] = {
+        [0 ... 255]         = &&spmd_scalar,
+
+        [RET]               = &&spmd_ret,
+
+        [MOV_IMM16]         = &&spmd_mov_imm16,
+        [MOV_IMM64]         = &&spmd_mov_imm64,
+        [MOV_REG]           = &&spmd_mov_reg,
+        [MOV_IMM8]          = &&spmd_mov_imm8,
+        [MOV_IMM32]         = &&spmd_mov_imm32,
+        [MOV_REG_PACKED]    = &&spmd_mov_reg_packed,
+        [INC_REG]           = &&spmd_inc_reg,
+        [DEC_REG]           = &&spmd_dec_reg,
+        [NEG_IMM16]         = &&spmd_neg_imm16,
+        [NEG_REG]           = &&spmd_neg_reg,
+        [NOT_IMM16]         = &&spmd_not_imm16,
+        [NOT_REG]           = &&spmd_not_reg,
+
+        #define SPMD_BINARY_ENTRIES(OPCODE, name) \
+            [OPCODE##_REG] = &&spmd_##name##_reg, [OPCODE##_IMM16] = &&spmd_##name##_imm16, [OPCODE##_REG_PACKED] = &&spmd_##name##_reg_packed
+        #define SPMD_REVERSED_ENTRIES(OPCODE, name) [OPCODE##_IMM16_R] = &&spmd_##name##_imm16_r
+        #define SPMD_IMM8_ENTRIES(OPCODE, name) [OPCODE##_IMM8] = &&spmd_##name##_imm8
+
+        SPMD_BINARY_ENTRIES(ADD, add),   SPMD_IMM8_ENTRIES(ADD, add),
+        SPMD_BINARY_ENTRIES(SUB, sub),   SPMD_IMM8_ENTRIES(SUB, sub),   SPMD_REVERSED_ENTRIES(SUB, sub),
+        SPMD_BINARY_ENTRIES(MUL, mul),   SPMD_IMM8_ENTRIES(MUL, mul),
+        SPMD_BINARY_ENTRIES(IDIV, idiv), SPMD_REVERSED_ENTRIES(IDIV, idiv),
+        SPMD_BINARY_ENTRIES(DIV, div),   SPMD_REVERSED_ENTRIES(DIV, div),
+        SPMD_BINARY_ENTRIES(IREM, irem), SPMD_REVERSED_ENTRIES(IREM, irem),
+        SPMD_BINARY_ENTRIES(REM, rem),   SPMD_REVERSED_ENTRIES(REM, rem),
+        SPMD_BINARY_ENTRIES(AND, and),   SPMD_IMM8_ENTRIES(AND, and),
+        SPMD_BINARY_ENTRIES(OR, or),     SPMD_IMM8_ENTRIES(OR, or),
+        SPMD_BINARY_ENTRIES(XOR, xor),   SPMD_IMM8_ENTRIES(XOR, xor),
+        SPMD_BINARY_ENTRIES(SHL, shl),   SPMD_IMM8_ENTRIES(SHL, shl),   SPMD_REVERSED_ENTRIES(SHL, shl),
+        SPMD_BINARY_ENTRIES(SHR, shr),   SPMD_IMM8_ENTRIES(SHR, shr),   SPMD_REVERSED_ENTRIES(SHR, shr),
+        SPMD_BINARY_ENTRIES(SAR, sar),   SPMD_IMM8_ENTRIES(SAR, sar),   SPMD_REVERSED_ENTRIES(SAR, sar),
+
+        #undef SPMD_BINARY_ENTRIES
+        #undef SPMD_REVERSED_ENTRIES
+        #undef SPMD_IMM8_ENTRIES
+
+        #define SPMD_SET_ENTRIES(OPCODE, name) [OPCODE##_REG] = &&spmd_##name##_reg, [OPCODE##_IMM16] = &&spmd_##name##_imm16
+        SPMD_SET_ENTRIES(SETEQ, seteq), SPMD_SET_ENTRIES(SETNE, setne),
+        SPMD_SET_ENTRIES(SETLT, setlt), SPMD_SET_ENTRIES(SETLE, setle),
+        SPMD_SET_ENTRIES(SETLTU, setltu), SPMD_SET_ENTRIES(SETLEU, setleu),
+        #undef SPMD_SET_ENTRIES
+
+        [CMOV]              = &&spmd_cmov,
+        [SELECT]            = &&spmd_select,
+
+        [POPCNT_REG]        = &&spmd_popcnt_reg,
+        [CLZ_REG]           = &&spmd_clz_reg,
+        [CTZ_REG]           = &&spmd_ctz_reg,
+        [BSWAP_REG]         = &&spmd_bswap_reg,
+        [ROL_REG]           = &&spmd_rol_reg,
+        [ROL_IMM16]         = &&spmd_rol_imm16,
+        [ROR_REG]           = &&spmd_ror_reg,
+        [ROR_IMM16]         = &&spmd_ror_imm16,
+        [MULHI_REG]         = &&spmd_mulhi_reg,
+        [MULHIU_REG]        = &&spmd_mulhiu_reg,
+
+        #define SPMD_MINMAX_ENTRIES(OPCODE, name) [OPCODE##_REG] = &&spmd_##name##_reg, [OPCODE##_IMM16] = &&spmd_##name##_imm16
+        SPMD_MINMAX_ENTRIES(MIN, min), SPMD_MINMAX_ENTRIES(MAX, max),
+        SPMD_MINMAX_ENTRIES(MINU, minu), SPMD_MINMAX_ENTRIES(MAXU, maxu),
+        #undef SPMD_MINMAX_ENTRIES
+
+        [JMP_SHORT8]        = &&spmd_jmp_short8,
+        [JMP_SHORT]         = &&spmd_jmp_short,
+        [JMP_LONG]          = &&spmd_jmp_long,
+        [JEZ_SHORT8]        = &&spmd_jez_short8,
+        [JEZ_SHORT]         = &&spmd_jez_short,
+        [JEZ_LONG]          = &&spmd_jez_long,
+        [JNZ_SHORT8]        = &&spmd_jnz_short8,
+        [JNZ_SHORT]         = &&spmd_jnz_short,
+        [JNZ_LONG]          = &&spmd_jnz_long,
+
+        #define SPMD_CMP_BRANCH_ENTRIES(OPCODE, name) \
+            [OPCODE##_REG_SHORT] = &&spmd_##name##_reg_short, [OPCODE##_REG_LONG] = &&spmd_##name##_reg_long,\
+            [OPCODE##_IMM16_SHORT] = &&spmd_##name##_imm16_short, [OPCODE##_IMM16_LONG] = &&spmd_##name##_imm16_long
+        SPMD_CMP_BRANCH_ENTRIES(JEQ, jeq), SPMD_CMP_BRANCH_ENTRIES(JNE, jne),
+        SPMD_CMP_BRANCH_ENTRIES(JLT, jlt), SPMD_CMP_BRANCH_ENTRIES(JLE, jle),
+        SPMD_CMP_BRANCH_ENTRIES(JLTU, jltu), SPMD_CMP_BRANCH_ENTRIES(JLEU, jleu),
+        #undef SPMD_CMP_BRANCH_ENTRIES
+    };
+
+    VecU* registers = group->registers;
+    uint8_t* pc = bytecode;
+    uint32_t active = group->running; //every lane starts at pc 0
+    VecU activeMask = LANE_MASK(active);
+    uint64_t nextParked = UINT64_MAX; //lowest pc of a parked lane
+
+    #define OFFSET() ((uint64_t)(pc - bytecode))
+
+    //straight-line code: parked lanes rejoin once pc reaches them
+    #define SPMD_DISPATCH() do{ if(OFFSET() >= nextParked) goto spmd_park; goto *dispatch_table[*pc]; } while(0)
+
+    //lanes the mask excludes keep their old value
+    #define WRITE_REG(dst, value) registers[dst] = (registers[dst] & ~activeMask) | ((value) & activeMask)
+
+    //operand forms: pc still points at the opcode
+    #define OPERANDS_REG(size)      uint8_t dst = pc[1]; VecU a = registers[pc[2]]; VecU b = registers[pc[3]]; pc += (size)
+    #define OPERANDS_IMM16(size)    uint8_t dst = pc[1]; VecU a = registers[pc[2]]; VecU b = SPLAT((uint64_t)readImm16(&pc[3])); pc += (size)
+    #define OPERANDS_IMM16_R(size)  uint8_t dst = pc[1]; VecU a = SPLAT((uint64_t)readImm16(&pc[2])); VecU b = registers[pc[4]]; pc += (size)
+    #define OPERANDS_REG_PACKED(size) uint8_t dst = pc[1] >> 4; VecU a = registers[pc[1] & 0x0F]; VecU b = registers[pc[2]]; pc += (size)
+    #define OPERANDS_UNARY(size)    uint8_t dst = pc[1]; VecU a = registers[pc[2]]; pc += (size)
+    #define OPERANDS_IMM8(size)     uint8_t dst = pc[1] >> 4; VecU a = registers[pc[1] & 0x0F]; VecU b = SPLAT((uint64_t)(int8_t)pc[2]); pc += (size)
+
+    //shift counts wrap like the x86 shift instructions behind the scalar handlers
+    #define OP_ADD(a, b)  ((a) + (b))
+    #define OP_SUB(a, b)  ((a) - (b))
+    #define OP_MUL(a, b)  ((a) * (b))
+    #define OP_AND(a, b)  ((a) & (b))
+    #define OP_OR(a, b)   ((a) | (b))
+    #define OP_XOR(a, b)  ((a) ^ (b))
+    #define OP_SHL(a, b)  ((a) << ((b) & 63))
+    #define OP_SHR(a, b)  ((a) >> ((b) & 63))
+    #define OP_SAR(a, b)  ((VecU)((VecS)(a) >> (VecS)((b) & 63)))
+    //inactive lanes may hold any divisor, they divide by 1 instead of trapping
+    #define DIVISOR(b)    (((b) & activeMask) | (SPLAT(1) & ~activeMask))
+    #define OP_IDIV(a, b) ((VecU)((VecS)(a) / (VecS)DIVISOR(b)))
+    #define OP_DIV(a, b)  ((a) / DIVISOR(b))
+    #define OP_IREM(a, b) ((VecU)((VecS)(a) % (VecS)DIVISOR(b)))
+    #define OP_REM(a, b)  ((a) % DIVISOR(b))
+
+    //generic vectors have no popcount, bit scan or widening multiply: one scalar op per lane
+    #define LANEWISE_UNARY(scalarOp, a) ({\
+            VecU r_;\
+            for(int l_ = 0; l_ < LANES; ++l_) r_[l_] = (uint64_t)scalarOp((a)[l_]);\
+            r_;\
+        })
+    #define LANEWISE(scalarOp, a, b) ({\
+            VecU r_;\
+            for(int l_ = 0; l_ < LANES; ++l_) r_[l_] = scalarOp((a)[l_], (b)[l_]);\
+            r_;\
+        })
+    #define OP_POPCNT(a)    LANEWISE_UNARY(__builtin_popcountll, a)
+    #define OP_CLZ(a)       LANEWISE_UNARY(vmClz, a)
+    #define OP_CTZ(a)       LANEWISE_UNARY(vmCtz, a)
+    #define OP_BSWAP(a)     LANEWISE_UNARY(__builtin_bswap64, a)
+    #define OP_MULHI(a, b)  LANEWISE(vmMulHi, a, b)
+    #define OP_MULHIU(a, b) LANEWISE(vmMulHiU, a, b)
+    #define OP_ROL(a, b)    (((a) << ((b) & 63)) | ((a) >> (-(b) & 63)))
+    #define OP_ROR(a, b)    (((a) >> ((b) & 63)) | ((a) << (-(b) & 63)))
+    #define SELECT_LANES(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+    #define OP_MIN(a, b)    SELECT_LANES(CMP_LT(a, b), a, b)
+    #define OP_MAX(a, b)    SELECT_LANES(CMP_LT(b, a), a, b)
+    #define OP_MINU(a, b)   SELECT_LANES(CMP_LTU(a, b), a, b)
+    #define OP_MAXU(a, b)   SELECT_LANES(CMP_LTU(b, a), a, b)
+
+    #define SPMD_BINARY(name, form, size, operation) \
+        spmd_##name: { OPERANDS_##form(size); WRITE_REG(dst, operation(a, b)); SPMD_DISPATCH(); }
+
+    #define SPMD_BINARY_FORMS(name, operation) \
+        SPMD_BINARY(name##_reg, REG, 4, operation)\
+        SPMD_BINARY(name##_imm16, IMM16, 5, operation)\
+        SPMD_BINARY(name##_reg_packed, REG_PACKED, 3, operation)
+    #define SPMD_REVERSED_FORM(name, operation) SPMD_BINARY(name##_imm16_r, IMM16_R, 5, operation)
+    #define SPMD_IMM8_FORM(name, operation) SPMD_BINARY(name##_imm8, IMM8, 3, operation)
+    #define SPMD_REG_IMM16_FORMS(name, operation) \
+        SPMD_BINARY(name##_reg, REG, 4, operation)\
+        SPMD_BINARY(name##_imm16, IMM16, 5, operation)
+    //a zero divisor ends the lane and INT64_MIN / -1 wraps instead of trapping: the scalar
+    //handlers take care of both, so active lanes dividing by 0 or -1 finish there
+    #define SPMD_DIVIDE(name, form, size, operation) \
+        spmd_##name: {\
+            OPERANDS_##form(size);\
+            if(LANE_BITS((CMP_EQ(b, SPLAT(0)) | CMP_EQ(b, SPLAT(~UINT64_C(0)))) & activeMask)){ pc -= (size); goto spmd_scalar; }\
+            WRITE_REG(dst, operation(a, b));\
+            SPMD_DISPATCH();\
+        }
+    #define SPMD_DIVIDE_FORMS(name, operation) \
+        SPMD_DIVIDE(name##_reg, REG, 4, operation)\
+        SPMD_DIVIDE(name##_imm16, IMM16, 5, operation)\
+        SPMD_DIVIDE(name##_reg_packed, REG_PACKED, 3, operation)\
+        SPMD_DIVIDE(name##_imm16_r, IMM16_R, 5, operation)
+    #define SPMD_UNARY(name, operation) \
+        spmd_##name: { OPERANDS_UNARY(3); WRITE_REG(dst, operation(a)); SPMD_DISPATCH(); }
+
+    //comparisons give all-ones lanes, SETcc stores 1
+    #define CMP_EQ(a, b)  ((VecU)((a) == (b)))
+    #define CMP_NE(a, b)  ((VecU)((a) != (b)))
+    #define CMP_LT(a, b)  ((VecU)((VecS)(a) < (VecS)(b)))
+    #define CMP_LE(a, b)  ((VecU)((VecS)(a) <= (VecS)(b)))
+    #define CMP_LTU(a, b) ((VecU)((a) < (b)))
+    #define CMP_LEU(a, b) ((VecU)((a) <= (b)))
+
+    #define SPMD_SET(name, compare) \
+        spmd_##name##_reg:   { OPERANDS_REG(4);   WRITE_REG(dst, compare(a, b) & SPLAT(1)); SPMD_DISPATCH(); }\
+        spmd_##name##_imm16: { OPERANDS_IMM16(5); WRITE_REG(dst, compare(a, b) & SPLAT(1)); SPMD_DISPATCH(); }
+
+    // Sends the active lanes whose `taken` lane is set to the jump target and the others
+    // past the jump. Lanes that disagree are parked and rescheduled.
+    #define SPMD_BRANCH(taken, size, offset) do{\
+            uint64_t next_ = OFFSET() + (size);\
+            uint64_t target_ = next_ + (uint64_t)(int64_t)(offset);\
+            uint32_t takenBits_ = LANE_BITS((taken) & activeMask);\
+            if(takenBits_ == active){\
+                pc = bytecode + target_;\
+            } else if(takenBits_ == 0){\
+                pc = bytecode + next_;\
+            } else {\
+                for(int l = 0; l < LANES; ++l){\
+                    if((active >> l) & 1) group->pc[l] = (takenBits_ >> l) & 1 ? target_ : next_;\
+                }\
+                active = 0;\
+                goto spmd_schedule;\
+            }\
+            SPMD_DISPATCH();\
+        } while(0)
+
+    #define SPMD_CMP_BRANCH(name, compare) \
+        spmd_##name##_reg_short:   SPMD_BRANCH(compare(registers[pc[1]], registers[pc[2]]), 5, readImm16(&pc[3]));\
+        spmd_##name##_reg_long:    SPMD_BRANCH(compare(registers[pc[1]], registers[pc[2]]), 11, readImm64(&pc[3]));\
+        spmd_##name##_imm16_short: SPMD_BRANCH(compare(registers[pc[1]], SPLAT((uint64_t)readImm16(&pc[2]))), 6, readImm16(&pc[4]));\
+        spmd_##name##_imm16_long:  SPMD_BRANCH(compare(registers[pc[1]], SPLAT((uint64_t)readImm16(&pc[2]))), 12, readImm64(&pc[4]));
+
+    SPMD_DISPATCH();
+
+spmd_mov_imm16:      { uint8_t dst = pc[1]; WRITE_REG(dst, SPLAT((uint64_t)readImm16(&pc[2]))); pc += 4; SPMD_DISPATCH(); }
+spmd_mov_imm64:      { uint8_t dst = pc[1]; WRITE_REG(dst, SPLAT((uint64_t)readImm64(&pc[2]))); pc += 10; SPMD_DISPATCH(); }
+spmd_mov_reg:        { uint8_t dst = pc[1]; WRITE_REG(dst, registers[pc[2]]); pc += 3; SPMD_DISPATCH(); }
+spmd_mov_imm8:       { uint8_t dst = pc[1]; WRITE_REG(dst, SPLAT((uint64_t)(int8_t)pc[2])); pc += 3; SPMD_DISPATCH(); }
+spmd_mov_imm32:      { uint8_t dst = pc[1]; WRITE_REG(dst, SPLAT((uint64_t)readImm32(&pc[2]))); pc += 6; SPMD_DISPATCH(); }
+spmd_mov_reg_packed: { uint8_t dst = pc[1] >> 4; WRITE_REG(dst, registers[pc[1] & 0x0F]); pc += 2; SPMD_DISPATCH(); }
+spmd_inc_reg:        { uint8_t dst = pc[1]; WRITE_REG(dst, registers[dst] + 1); pc += 2; SPMD_DISPATCH(); }
+spmd_dec_reg:        { uint8_t dst = pc[1]; WRITE_REG(dst, registers[dst] - 1); pc += 2; SPMD_DISPATCH(); }
+spmd_neg_imm16:      { uint8_t dst = pc[1]; WRITE_REG(dst, -SPLAT((uint64_t)readImm16(&pc[2]))); pc += 4; SPMD_DISPATCH(); }
+spmd_neg_reg:        { uint8_t dst = pc[1]; WRITE_REG(dst, -registers[pc[2]]); pc += 3; SPMD_DISPATCH(); }
+spmd_not_imm16:      { uint8_t dst = pc[1]; WRITE_REG(dst, ~SPLAT((uint64_t)readImm16(&pc[2]))); pc += 4; SPMD_DISPATCH(); }
+spmd_not_reg:        { uint8_t dst = pc[1]; WRITE_REG(dst, ~registers[pc[2]]); pc += 3; SPMD_DISPATCH(); }
+
+    SPMD_BINARY_FORMS(add, OP_ADD)   SPMD_IMM8_FORM(add, OP_ADD)
+    SPMD_BINARY_FORMS(sub, OP_SUB)   SPMD_IMM8_FORM(sub, OP_SUB)   SPMD_REVERSED_FORM(sub, OP_SUB)
+    SPMD_BINARY_FORMS(mul, OP_MUL)   SPMD_IMM8_FORM(mul, OP_MUL)
+    SPMD_DIVIDE_FORMS(idiv, OP_IDIV)
+    SPMD_DIVIDE_FORMS(div, OP_DIV)
+    SPMD_DIVIDE_FORMS(irem, OP_IREM)
+    SPMD_DIVIDE_FORMS(rem, OP_REM)
+    SPMD_BINARY_FORMS(and, OP_AND)   SPMD_IMM8_FORM(and, OP_AND)
+    SPMD_BINARY_FORMS(or, OP_OR)     SPMD_IMM8_FORM(or, OP_OR)
+    SPMD_BINARY_FORMS(xor, OP_XOR)   SPMD_IMM8_FORM(xor, OP_XOR)
+    SPMD_BINARY_FORMS(shl, OP_SHL)   SPMD_IMM8_FORM(shl, OP_SHL)   SPMD_REVERSED_FORM(shl, OP_SHL)
+    SPMD_BINARY_FORMS(shr, OP_SHR)   SPMD_IMM8_FORM(shr, OP_SHR)   SPMD_REVERSED_FORM(shr, OP_SHR)
+    SPMD_BINARY_FORMS(sar, OP_SAR)   SPMD_IMM8_FORM(sar, OP_SAR)   SPMD_REVERSED_FORM(sar, OP_SAR)
+
+    SPMD_UNARY(popcnt_reg, OP_POPCNT)
+    SPMD_UNARY(clz_reg, OP_CLZ)
+    SPMD_UNARY(ctz_reg, OP_CTZ)
+    SPMD_UNARY(bswap_reg, OP_BSWAP)
+    SPMD_REG_IMM16_FORMS(rol, OP_ROL)
+    SPMD_REG_IMM16_FORMS(ror, OP_ROR)
+    SPMD_BINARY(mulhi_reg, REG, 4, OP_MULHI)
+    SPMD_BINARY(mulhiu_reg, REG, 4, OP_MULHIU)
+    SPMD_REG_IMM16_FORMS(min, OP_MIN)
+    SPMD_REG_IMM16_FORMS(max, OP_MAX)
+    SPMD_REG_IMM16_FORMS(minu, OP_MINU)
+    SPMD_REG_IMM16_FORMS(maxu, OP_MAXU)
+
+    SPMD_SET(seteq, CMP_EQ)
+    SPMD_SET(setne, CMP_NE)
+    SPMD_SET(setlt, CMP_LT)
+    SPMD_SET(setle, CMP_LE)
+    SPMD_SET(setltu, CMP_LTU)
+    SPMD_SET(setleu, CMP_LEU)
+
+spmd_cmov: {
+    uint8_t dst = pc[1];
+    VecU cond = CMP_NE(registers[pc[2]], SPLAT(0));
+    WRITE_REG(dst, (registers[pc[3]] & cond) | (registers[dst] & ~cond));
+    pc += 4;
+    SPMD_DISPATCH();
+}
+
+spmd_select: {
+    uint8_t dst = pc[1];
+    VecU cond = CMP_NE(registers[pc[2]], SPLAT(0));
+    WRITE_REG(dst, (registers[pc[3]] & cond) | (registers[pc[4]] & ~cond));
+    pc += 5;
+    SPMD_DISPATCH();
+}
+
+spmd_jmp_short8: SPMD_BRANCH(SPLAT(~UINT64_C(0)), 2, (int8_t)pc[1]);
+spmd_jmp_short:  SPMD_BRANCH(SPLAT(~UINT64_C(0)), 3, readImm16(&pc[1]));
+spmd_jmp_long:   SPMD_BRANCH(SPLAT(~UINT64_C(0)), 9, readImm64(&pc[1]));
+spmd_jez_short8: SPMD_BRANCH(CMP_EQ(registers[pc[1]], SPLAT(0)), 3, (int8_t)pc[2]);
+spmd_jez_short:  SPMD_BRANCH(CMP_EQ(registers[pc[1]], SPLAT(0)), 4, readImm16(&pc[2]));
+spmd_jez_long:   SPMD_BRANCH(CMP_EQ(registers[pc[1]], SPLAT(0)), 10, readImm64(&pc[2]));
+spmd_jnz_short8: SPMD_BRANCH(CMP_NE(registers[pc[1]], SPLAT(0)), 3, (int8_t)pc[2]);
+spmd_jnz_short:  SPMD_BRANCH(CMP_NE(registers[pc[1]], SPLAT(0)), 4, readImm16(&pc[2]));
+spmd_jnz_long:   SPMD_BRANCH(CMP_NE(registers[pc[1]], SPLAT(0)), 10, readImm64(&pc[2]));
+
+    SPMD_CMP_BRANCH(jeq, CMP_EQ)
+    SPMD_CMP_BRANCH(jne, CMP_NE)
+    SPMD_CMP_BRANCH(jlt, CMP_LT)
+    SPMD_CMP_BRANCH(jle, CMP_LE)
+    SPMD_CMP_BRANCH(jltu, CMP_LTU)
+    SPMD_CMP_BRANCH(jleu, CMP_LEU)
+
+spmd_ret:
+    for(int l = 0; l < LANES; ++l){
+        if((active >> l) & 1) group->status[l] = KOALA_VM_STATUS_HALTED;
+    }
+    group->running &= ~active;
+    active = 0;
+    goto spmd_schedule;
+
+spmd_scalar:
+    for(int l = 0; l < LANES; ++l){
+        if((active >> l) & 1) spmdFinishScalar(group, l, bytecode, OFFSET(), scalar);
+    }
+    group->running &= ~active;
+    active = 0;
+    goto spmd_schedule;
+
+spmd_park:
+    for(int l = 0; l < LANES; ++l){
+        if((active >> l) & 1) group->pc[l] = OFFSET();
+    }
+    active = 0;
+    //fallthrough
+
+spmd_schedule: {
+    //every running lane is parked now; continue with the lowest pc
+    if(group->running == 0) return;
+
+    uint64_t lowest = UINT64_MAX;
+    for(int l = 0; l < LANES; ++l){
+        if(((group->running >> l) & 1) && group->pc[l] < lowest) lowest = group->pc[l];
+    }
+
+    nextParked = UINT64_MAX;
+    for(int l = 0; l < LANES; ++l){
+        if(!((group->running >> l) & 1)) continue;
+        if(group->pc[l] == lowest) active |= 1u << l;
+        else if(group->pc[l] < nextParked) nextParked = group->pc[l];
+    }
+
+    activeMask = LANE_MASK(active);
+    pc = bytecode + lowest;
+    goto *dispatch_table[*pc];
+}
+
+    #undef OFFSET
+}
+
+void koalaVMRunBatch(uint8_t* bytecode, const uint64_t* inputs, uint64_t* results, KoalaVMStatus* statuses, size_t count, KoalaVMState* scalar){
+    KoalaVMState fallback;
+    if(!scalar){
+        //zero-size memory: loads and stores of the lanes fault instead of reaching the host
+        koalaVMStateInit(&fallback);
+        koalaVMMemoryInit(&fallback, 0);
+        scalar = &fallback;
+    }
+
+    SpmdGroup group;
+    for(size_t first = 0; first < count; first += LANES){
+        size_t lanes = count - first < LANES ? count - first : LANES;
+
+        memset(&group, 0, sizeof(group));
+        group.running = (1u << lanes) - 1;
+        for(size_t l = 0; l < lanes; ++l){
+            for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+                group.registers[r][l] = inputs[(first + l) * KOALA_CORE_VM_REGISTERS_COUNT + r];
+            }
+        }
+
+        spmdRunGroup(&group, bytecode, scalar);
+
+        for(size_t l = 0; l < lanes; ++l){
+            for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+                results[(first + l) * KOALA_CORE_VM_REGISTERS_COUNT + r] = group.registers[r][l];
+            }
+            if(statuses) statuses[first + l] = group.status[l];
+        }
+    }
+
+    if(scalar == &fallback) koalaVMMemoryDestroy(&fallback);
+}
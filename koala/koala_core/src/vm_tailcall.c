@@ -0,0 +1,57 @@
+#include "vm_engine.h"
+
+#include "opcodes.h"
+#include "vm_config.h"
+#include <string.h>
+
+// Tail-call-threaded engine: every handler is its own function and passes pc and the
+// register file on to the next one through a guaranteed tail call, so each handler
+// gets a fresh register allocation and no GNU label-address extension is needed.
+//
+// musttail makes the tail calls mandatory (Clang, GCC >= 15). Without it the engine
+// relies on the optimizer turning them into jumps, so it must not be built at -O0.
+
+#if defined(__has_attribute)
+    #if __has_attribute(musttail)
+        #define MUSTTAIL __attribute__((musttail))
+    #endif
+#endif
+
+#ifndef MUSTTAIL
+    #define MUSTTAIL
+#endif
+
+#define VM_HANDLER_PARAMS uint8_t* pc, uint64_t* registers, KoalaVMState* state, uint8_t* bytecode
+
+typedef KoalaVMStatus (*VMHandler)(VM_HANDLER_PARAMS);
+
+static KoalaVMStatus vm_invalid(VM_HANDLER_PARAMS);
+#define VM_OPCODE(opcode, name, size, operands) static KoalaVMStatus vm_##name(VM_HANDLER_PARAMS);
+#include "vm_opcodes.inc"
+#undef VM_OPCODE
+
+static const VMHandler dispatch_table[256] = {
+    [0 ... 255]                     = vm_invalid,
+
+    #define VM_OPCODE(opcode, name, size, operands) [opcode] = vm_##name,
+    #include "vm_opcodes.inc"
+    #undef VM_OPCODE
+};
+
+#define VM_HANDLER(name) static KoalaVMStatus vm_##name(VM_HANDLER_PARAMS)
+#define DISPATCH() do{ VM_COUNT_OPCODE(state, *pc); MUSTTAIL return dispatch_table[*pc](pc + 1, registers, state, bytecode); } while(0)
+
+//jumps are the only way to loop, so polling host requests there bounds the latency
+#define DISPATCH_JUMP() \
+    if(state->checkpointRequest) { MUSTTAIL return vm_checkpoint(pc, registers, state, bytecode); }\
+    DISPATCH()
+
+#define USE_REG(name) registers[name]
+
+#include "vm_handlers.inc"
+
+KoalaVMStatus vmEngineExecute(KoalaVMState* state, uint8_t* bytecode){
+    uint8_t* pc = &bytecode[state->pc];
+    VM_COUNT_OPCODE(state, *pc);
+    return dispatch_table[*pc](pc + 1, state->registers, state, bytecode);
+}
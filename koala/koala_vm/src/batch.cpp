@@ -0,0 +1,165 @@
+#include "batch.hpp"
+#include "loader.hpp"
+#include "thread_pool.hpp"
+
+#include <KoalaCore>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace koala{
+
+    struct BatchResult{
+        bool Loaded = false;
+        std::string Error;
+        KoalaVMStatus Status = KOALA_VM_STATUS_HALTED;
+        uint64_t TimeNs = 0;
+        bool Cached = false; //reported with time 0
+        uint64_t Registers[KOALA_CORE_VM_REGISTERS_COUNT] = {0};
+    };
+
+    struct alignas(64) WorkerContext{
+        KoalaVMState State;
+        BytecodeImage Image;
+
+        WorkerContext(){ koalaVMStateInit(&State); }
+        ~WorkerContext(){ koalaVMMemoryDestroy(&State); }
+        WorkerContext(const WorkerContext&) = delete;
+        WorkerContext& operator=(const WorkerContext&) = delete;
+    };
+
+    static bool readList(const std::string& listPath, std::vector<std::string>* paths){
+        std::ifstream fs(listPath);
+        if(!fs){
+            std::cerr << "Failed to open batch list: " << listPath << "\n";
+            return false;
+        }
+
+        std::string line;
+        while(std::getline(fs, line)){
+            while(!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.pop_back();
+            if(line.empty() || line[0] == '#') continue;
+            paths->push_back(line);
+        }
+        return true;
+    }
+
+    static void writeResults(std::ostream& os, const std::vector<std::string>& paths, const std::vector<BatchResult>& results){
+        os << "# path\tstatus\ttime_ns\tregisters\n";
+        for(size_t i = 0; i < paths.size(); ++i){
+            const BatchResult& res = results[i];
+            os << paths[i] << '\t';
+
+            if(!res.Loaded){
+                os << "load_error\t0\t" << res.Error << '\n';
+                continue;
+            }
+
+            os << koalaVMStatusString(res.Status)<< '\t' << res.TimeNs << '\t';
+            for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+                if(r != 0) os << ',';
+                os << res.Registers[r];
+            }
+            os << '\n';
+        }
+    }
+
+    int runBatch(const BatchOptions& options){
+        std::vector<std::string> paths;
+        if(!readList(options.ListPath, &paths)) return -1;
+
+        std::vector<BatchResult> results(paths.size());
+
+        KoalaHostRegistry host;
+        koalaHostRegistryInit(&host);
+
+        KoalaMemo* memo = nullptr;
+        if(options.MemoEntries > 0 && !(memo = koalaMemoCreate(options.MemoEntries, 0))){
+            std::cerr << "Failed to allocate the result cache.\n";
+            return -1;
+        }
+
+        auto t1 = std::chrono::steady_clock::now();
+        {
+            WorkStealingPool pool(options.Jobs);
+            std::vector<WorkerContext> contexts(pool.WorkerCount());
+
+            for(size_t i = 0; i < paths.size(); ++i){
+                pool.Submit([&, i](size_t workerIdx){
+                    WorkerContext& ctx = contexts[workerIdx];
+                    BatchResult& res = results[i];
+
+                    if(!ctx.State.memory && koalaVMMemoryInit(&ctx.State, options.MemorySize) != 0){
+                        res.Error = "failed to reserve linear memory";
+                        return;
+                    }
+                    koalaVMBindHost(&ctx.State, &host);
+                    if(!ctx.Image.Load(paths[i], &res.Error)) return;
+                    res.Loaded = true;
+
+                    //memory starts zeroed for every program and is not reported, so it does not
+                    //keep a program out of the cache
+                    bool cacheable = memo && (koalaBytecodeEffects(ctx.Image.Data(), ctx.Image.Size()) & ~KOALA_EFFECT_MEMORY) == 0;
+                    uint64_t bytecodeHash = cacheable ? koalaBytecodeHash(ctx.Image.Data(), ctx.Image.Size()) : 0;
+
+                    if(options.Specialize) koalaVMSpecialize(ctx.Image.Data(), ctx.Image.Size());
+                    auto execute = options.Specialize ? koalaVMExecuteSpecialized : koalaVMExecute;
+
+                    koalaVMStateReset(&ctx.State);
+                    uint64_t inputs[KOALA_CORE_VM_REGISTERS_COUNT];
+                    std::copy(std::begin(ctx.State.registers), std::end(ctx.State.registers), inputs);
+
+                    auto start = std::chrono::steady_clock::now();
+                    if(cacheable && koalaMemoLookup(memo, bytecodeHash, inputs, ctx.State.registers, &ctx.State.pc)){
+                        res.Status = KOALA_VM_STATUS_HALTED;
+                        res.Cached = true;
+                    } else {
+                        do{
+                            res.Status = execute(&ctx.State, ctx.Image.Data());
+                        } while(res.Status == KOALA_VM_STATUS_CHECKPOINT);
+                        if(cacheable && res.Status == KOALA_VM_STATUS_HALTED){
+                            koalaMemoInsert(memo, bytecodeHash, inputs, ctx.State.registers, ctx.State.pc);
+                        }
+                    }
+                    auto end = std::chrono::steady_clock::now();
+
+                    res.TimeNs = res.Cached ? 0 : static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+                    std::copy(std::begin(ctx.State.registers), std::end(ctx.State.registers), res.Registers);
+                    ctx.Image.Reset();
+                });
+            }
+
+            pool.Wait();
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        KoalaMemoStats stats{};
+        if(memo){
+            koalaMemoGetStats(memo, &stats);
+            koalaMemoDestroy(memo);
+        }
+
+        if(options.OutputPath.empty()){
+            writeResults(std::cout, paths, results);
+        } else {
+            std::ofstream outFs(options.OutputPath);
+            if(!outFs){
+                std::cerr << "Failed to open output file for writting: " << options.OutputPath << "\n";
+                return -1;
+            }
+            writeResults(outFs, paths, results);
+        }
+
+        std::cerr << "Batch: " << paths.size() << " programs in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << "ms\n";
+
+        if(options.MemoEntries > 0){
+            std::cerr << "Cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                      << stats.evictions << " evictions, " << stats.entries << "/" << stats.capacity << " entries\n";
+        }
+
+        return 0;
+    }
+
+}
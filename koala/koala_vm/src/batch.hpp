@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace koala{
+
+    struct BatchOptions{
+        std::string ListPath;
+        std::string OutputPath; //stdout when empty
+        size_t Jobs;
+        bool Specialize;
+        uint64_t MemorySize; //linear memory per worker, reused (zeroed) between programs
+        size_t MemoEntries;  //results cached across the batch, 0 disables the cache
+    };
+
+    // Runs every bytecode file listed in ListPath (one path per line, '#' starts a
+    // comment line) on a work-stealing pool and writes one result line per program,
+    // in list order. With a cache, programs without host calls, I/O, channels or
+    // checkpoints that were already run (same bytecode) reuse the first run's result
+    // and report a time of 0.
+    int runBatch(const BatchOptions& options);
+
+}
@@ -0,0 +1,157 @@
+#include "loader.hpp"
+
+#include <KoalaCore>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool hasKoalaMagic(const uint8_t* header){
+    return header[0] == KOALA_MAG_0 &&
+           header[1] == KOALA_MAG_1 &&
+           header[2] == KOALA_MAG_2 &&
+           header[3] == KOALA_MAG_3 &&
+           (header[4] == KOALA_MAG_4 || header[4] == '0');
+}
+
+// Header size of a file that starts with the magic bytes.
+static size_t headerSize(const uint8_t* header){
+    return header[4] == '0' ? KOALA_HEADER_SIZE_V0 : KOALA_HEADER_SIZE;
+}
+
+namespace koala{
+
+    BytecodeImage::~BytecodeImage(){
+        Reset();
+    }
+
+    BytecodeImage::BytecodeImage(BytecodeImage&& other) noexcept{
+        *this = std::move(other);
+    }
+
+    BytecodeImage& BytecodeImage::operator=(BytecodeImage&& other) noexcept{
+        if(this != &other){
+            Reset();
+            m_Mapping = std::exchange(other.m_Mapping, nullptr);
+            m_MappingSize = std::exchange(other.m_MappingSize, 0);
+            m_Buffer = std::move(other.m_Buffer);
+            m_Code = std::exchange(other.m_Code, nullptr);
+            m_CodeSize = std::exchange(other.m_CodeSize, 0);
+            m_Registers = std::exchange(other.m_Registers, 0);
+        }
+        return *this;
+    }
+
+    void BytecodeImage::Reset(){
+        if(m_Mapping){
+            munmap(m_Mapping, m_MappingSize);
+            m_Mapping = nullptr;
+            m_MappingSize = 0;
+        }
+        m_Buffer.clear();
+        m_Code = nullptr;
+        m_CodeSize = 0;
+        m_Registers = 0;
+    }
+
+    bool BytecodeImage::Load(const std::string& path, std::string* error){
+        Reset();
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            *error = "Failed to open file: " + path;
+            return false;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < KOALA_HEADER_SIZE_V0){
+            close(fd);
+            *error = "Not a Koala Bytecode binary: " + path;
+            return false;
+        }
+
+        size_t fileSize = static_cast<size_t>(st.st_size);
+        size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+        if(fileSize % pageSize != 0){
+            //private writable mapping: the kernel zero-fills the rest of the last page
+            void* mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if(mapping != MAP_FAILED){
+                m_Mapping = mapping;
+                m_MappingSize = fileSize;
+                m_Code = static_cast<uint8_t*>(mapping);
+            }
+        }
+
+        if(!m_Mapping){
+            m_Buffer.resize(fileSize + 1, 0);
+            size_t done = 0;
+            while(done < fileSize){
+                ssize_t n = pread(fd, m_Buffer.data() + done, fileSize - done, static_cast<off_t>(done));
+                if(n <= 0){
+                    close(fd);
+                    Reset();
+                    *error = "Failed to read file: " + path;
+                    return false;
+                }
+                done += static_cast<size_t>(n);
+            }
+            m_Code = m_Buffer.data();
+        }
+
+        close(fd);
+
+        return TakeHeader(fileSize, path, error);
+    }
+
+    bool BytecodeImage::TakeHeader(size_t fileSize, const std::string& name, std::string* error){
+        if(fileSize < KOALA_HEADER_SIZE_V0 || !hasKoalaMagic(m_Code) || fileSize < headerSize(m_Code)){
+            Reset();
+            *error = "Invalid magic bytes! Not a Koala Bytecode binary: " + name;
+            return false;
+        }
+
+        size_t header = headerSize(m_Code);
+        size_t registers = header == KOALA_HEADER_SIZE_V0 ? 8 : m_Code[KOALA_HEADER_SIZE - 1];
+        if(registers > KOALA_CORE_VM_REGISTERS_COUNT){
+            Reset();
+            *error = "Program needs " + std::to_string(registers) + " registers, this VM has " + std::to_string(KOALA_CORE_VM_REGISTERS_COUNT) +
+                " (build koala_core with -DKOALA_CORE_VM_REGISTERS_COUNT=" + std::to_string(registers <= 16 ? 16 : registers <= 32 ? 32 : 64) + "): " + name;
+            return false;
+        }
+
+        m_Code += header;
+        m_CodeSize = fileSize - header;
+        m_Registers = registers;
+        return true;
+    }
+
+    bool BytecodeImage::Adopt(std::vector<uint8_t> body, size_t registers, std::string* error){
+        Reset();
+
+        if(registers > KOALA_CORE_VM_REGISTERS_COUNT){
+            *error = "Program needs " + std::to_string(registers) + " registers, this VM has " + std::to_string(KOALA_CORE_VM_REGISTERS_COUNT) + ".";
+            return false;
+        }
+
+        m_Buffer = std::move(body);
+        m_CodeSize = m_Buffer.size();
+        m_Buffer.push_back(0); //same trailing NONE as a loaded file
+        m_Code = m_Buffer.data();
+        m_Registers = registers;
+        return true;
+    }
+
+    bool BytecodeImage::Parse(std::vector<uint8_t> file, const std::string& name, std::string* error){
+        Reset();
+
+        size_t fileSize = file.size();
+        m_Buffer = std::move(file);
+        m_Buffer.push_back(0);
+        m_Code = m_Buffer.data();
+        return TakeHeader(fileSize, name, error);
+    }
+
+}
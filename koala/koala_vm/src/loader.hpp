@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace koala{
+
+    // Bytecode body of a .klbc file (everything after the header). The body is
+    // memory-mapped when the file size allows a zero byte to follow it inside the last
+    // page, otherwise it is read into a buffer with an explicit trailing zero. Either way
+    // a program that runs past its end dispatches NONE instead of reading garbage.
+    // Programs that use more registers than KOALA_CORE_VM_REGISTERS_COUNT are rejected.
+    class BytecodeImage{
+    public:
+        BytecodeImage() = default;
+        ~BytecodeImage();
+
+        BytecodeImage(const BytecodeImage&) = delete;
+        BytecodeImage& operator=(const BytecodeImage&) = delete;
+
+        BytecodeImage(BytecodeImage&& other) noexcept;
+        BytecodeImage& operator=(BytecodeImage&& other) noexcept;
+
+        bool Load(const std::string& path, std::string* error);
+        // Takes over a body compiled in memory (no header), e.g. by koalac::compile.
+        bool Adopt(std::vector<uint8_t> body, size_t registers, std::string* error);
+        // Takes over a whole .klbc file held in memory, header included; `name` only
+        // appears in error messages.
+        bool Parse(std::vector<uint8_t> file, const std::string& name, std::string* error);
+        void Reset();
+
+        inline uint8_t* Data() { return m_Code; }
+        inline const uint8_t* Data() const { return m_Code; }
+        inline size_t Size() const { return m_CodeSize; }
+        inline bool IsMapped() const { return m_Mapping != nullptr; }
+        // Registers the program uses, from the header.
+        inline size_t Registers() const { return m_Registers; }
+    private:
+        void* m_Mapping = nullptr;
+        size_t m_MappingSize = 0;
+        std::vector<uint8_t> m_Buffer;
+
+        uint8_t* m_Code = nullptr;
+        size_t m_CodeSize = 0;
+        size_t m_Registers = 0;
+
+        // Checks the header at m_Code and moves m_Code past it.
+        bool TakeHeader(size_t fileSize, const std::string& name, std::string* error);
+    };
+
+}
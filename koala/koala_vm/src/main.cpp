@@ -1,81 +1,454 @@
 #include <iostream>
-#include <fstream>
-#include <vector>
+#include <cstring>
 #include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <KoalaCore>
+#include <KoalaCompiler>
+#include <KoalaArgs>
 #include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
 
-std::vector<uint8_t> readBytecode(char* filepath){
-    std::ifstream fs(filepath, std::ios::ate | std::ios::binary);
-    if(!fs){
-        std::cerr << "Failed to open file: " << filepath << "\n";
-        return {};
-    }
+#include "loader.hpp"
+#include "batch.hpp"
+#include "spmd.hpp"
+#include "server.hpp"
+#include "pipeline.hpp"
+#include "perf_stats.hpp"
 
-    std::streamsize size = fs.tellg();
-    if(size < 5){
-        return {};
-    }
+static KoalaVMState* volatile g_ActiveState = nullptr;
+static KoalaProfile* g_Profile = nullptr;
 
-    fs.seekg(0, std::ios::beg);
+static void onCheckpointSignal(int){
+    KoalaVMState* state = g_ActiveState;
+    if(state) state->checkpointRequest = 1;
+}
 
-    uint8_t magicHeader[5];
-    if(!fs.read(reinterpret_cast<char*>(magicHeader), 5)){
-        std::cerr << "Failed to read file header.\n";
-        return {};
-    }
-    
-    if(magicHeader[0] != KOALA_MAG_0 ||
-        magicHeader[1] != KOALA_MAG_1 ||
-        magicHeader[2] != KOALA_MAG_2 ||
-        magicHeader[3] != KOALA_MAG_3 ||
-        magicHeader[4] != KOALA_MAG_4){
-        std::cerr << "Error: Invalid magic bytes! Not a Koala Bytecode binary.\n";
-        return {};
-    }
+// Program input/output streams and the files behind them.
+struct ProgramIO{
+    KoalaVMStream Input{};
+    KoalaVMStream Output{};
+    int InputFd = STDIN_FILENO;
+    int OutputFd = STDOUT_FILENO;
 
-    if(static_cast<size_t>(size) < 5){
-        return {};
-    }
+    ProgramIO() = default;
+    ProgramIO(const ProgramIO&) = delete;
+    ProgramIO& operator=(const ProgramIO&) = delete;
 
-    size_t bodySize = static_cast<size_t>(size) - 5;
-    std::vector<uint8_t> bytecode(bodySize);
-    if(!fs.read(reinterpret_cast<char*>(bytecode.data()), bodySize)){
-        std::cerr << "Failed to read file.\n";
-        return {};
+    bool Open(const std::string& inputPath, const std::string& outputPath){
+        if(!inputPath.empty() && (InputFd = open(inputPath.c_str(), O_RDONLY)) < 0){
+            std::cerr << "Failed to open input file: " << inputPath << "\n";
+            return false;
+        }
+        if(!outputPath.empty() && (OutputFd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0){
+            std::cerr << "Failed to open output file for writting: " << outputPath << "\n";
+            return false;
+        }
+        if(koalaVMStreamInitInput(&Input, InputFd, KOALA_CORE_VM_STREAM_BUFFER_SIZE) != 0 ||
+           koalaVMStreamInitOutput(&Output, OutputFd, KOALA_CORE_VM_STREAM_BUFFER_SIZE) != 0){
+            std::cerr << "Failed to allocate stream buffers.\n";
+            return false;
+        }
+        return true;
     }
 
-    fs.close();
-
-    return std::move(bytecode);
-}
+    ~ProgramIO(){
+        koalaVMStreamDestroy(&Input);
+        koalaVMStreamDestroy(&Output);
+        if(InputFd > STDERR_FILENO) close(InputFd);
+        if(OutputFd > STDERR_FILENO) close(OutputFd);
+    }
+};
 
 void printHelp(){
     std::cout << R"(=====Koala Virtual Machine=====
 Version 0.0.1
-Core Version: )" << KOALA_CORE_VERSION
+Core Version: )" << KOALA_CORE_VERSION << R"(
+Registers: )" << KOALA_CORE_VM_REGISTERS_COUNT
 << R"(
 
 Syntax:
 koala <path_to_koala_bytecode.klbc>
+koala run <path_to_source.klasm> [--dense] [-O | -O2]
+koala <path_to_koala_bytecode.klbc> --snapshot <path.klsnap>
+koala --resume <path.klsnap> [path_to_koala_bytecode.klbc]
+koala --batch <list.txt> [-j <threads>] [-o <results.tsv>] [--memoize <entries>]
+koala --serve <socket_path> [-j <workers>] [--time-limit <ms>]
+koala --pipeline <stage0.klbc,stage1.klbc,...> [--channel-capacity <n>] [--mpmc]
+koala <path_to_koala_bytecode.klbc> --spmd <register_sets.txt> [-o <results.tsv>]
+
+Flags
+| --specialize     ; run on the operand-specialized engine (r0..r7 in host
+|                    registers, any higher ones in memory)
+| --memory <MiB>   ; size of the linear memory (default: )" << (KOALA_CORE_VM_MEMORY_DEFAULT_SIZE >> 20) << R"()
+| --input <path>   ; file read by read8/read64/eof (default: stdin)
+| --output <path>  ; file written by write8/write64 (default: stdout)
+| --mpmc           ; connect pipeline stages with MPMC instead of SPSC channels
+| --profile-out <path> ; record branch outcomes for koalac --profile-use
+| --perf-stats     ; report hardware counters (cycles, instructions, branch and
+|                    L1i misses) for the run; per-opcode counts and ratios need a
+|                    core built with -DKOALA_CORE_OPCODE_STATS=ON
+
+'koala run' compiles the source in memory and executes it in the same process, with
+the options of koalac --dense, -O and -O2. It takes the flags of a bytecode run except
+--snapshot and --resume.
+
+With --memoize, --batch caches the results of up to <entries> programs that neither
+call the host nor do I/O, use channels or checkpoint; repeated programs are not run
+again and report a time of 0.
+
+With --spmd, the program runs once per line of initial register values, )" << KOALA_CORE_VM_BATCH_LANES << R"( lines
+at a time in SIMD lockstep.
+
+With --serve, koala stays resident and runs programs for clients of a Unix socket:
+uploaded bytecode is kept by hash, each request carries the hash (or the bytecode)
+and the input registers and is answered with the final registers. Workers are
+warmed up before the first request. Runs longer than --time-limit are stopped at
+their next jump and answered as timed out. SIGINT or SIGTERM stops the server and prints
+the latency histograms (also available as a request). See tools/koala_client.py.
+
+Pipeline stages run on their own threads; each receives from channel 0 and sends
+on channel 1 (default capacity: 1024 words).
+
+With --snapshot, the VM state is saved every time the program executes
+'checkpoint' or the process receives SIGUSR1, then execution continues.
 )";
 }
 
-int main(int argc, char** argv){
-    if(argc != 2){
-        printHelp();
+// Numeric flag `flag` into `out` when given; a malformed or out-of-range value prints
+// the accepted range and the usage.
+static bool readCountFlag(const std::unordered_map<std::string, std::string>& args, const char* flag, uint64_t min, uint64_t max, uint64_t* out){
+    auto it = args.find(flag);
+    if(it == args.end() || koala::parseCount(it->second, min, max, out)) return true;
+
+    std::cerr << "'" << flag << "' expects a number from " << min << " to " << max << ", got '" << it->second << "'.\n";
+    printHelp();
+    return false;
+}
+
+// `koala run`: source to an in-memory image, no .klbc in between.
+static bool compileSource(const std::string& path, const koalac::CompileOptions& options, koala::BytecodeImage* image){
+    std::ifstream fs(path, std::ios::in | std::ios::binary);
+    if(!fs){
+        std::cerr << "Failed to open source file: " << path << "\n";
+        return false;
     }
+    std::string source((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
 
-    std::vector<uint8_t> bytecode = readBytecode(argv[1]);
-    if(bytecode.empty()){
-        std::cerr << "Bytecode is empty.\n";
-        return -1;
+    koalac::CompileResult compiled = koalac::compile(source, options);
+    if(!compiled.IsSuccess()){
+        koalac::printCompileErrors(compiled.Errors);
+        return false;
+    }
+
+    std::string error;
+    if(!image->Adopt(std::move(compiled.Body), compiled.RegistersUsed, &error)){
+        std::cerr << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+using ExecuteFn = KoalaVMStatus (*)(KoalaVMState*, uint8_t*);
+
+static KoalaVMStatus executeProfiled(KoalaVMState* state, uint8_t* bytecode){
+    return koalaVMExecuteProfiled(state, bytecode, g_Profile);
+}
+
+int runProgram(koala::BytecodeImage& image, KoalaVMState* state, ExecuteFn execute, uint64_t bytecodeHash, const std::string& bytecodePath, const std::string& snapshotPath, koala::PerfStats* perf){
+    if(!snapshotPath.empty()){
+        g_ActiveState = state;
+        std::signal(SIGUSR1, onCheckpointSignal);
     }
-    
+
     auto t1 = std::chrono::high_resolution_clock::now();
-    koalaVMRun(bytecode.data());
+    if(perf) perf->Start();
+    KoalaVMStatus status;
+    while((status = execute(state, image.Data())) == KOALA_VM_STATUS_CHECKPOINT){
+        if(snapshotPath.empty()) continue;
+
+        KoalaSnapshot snapshot;
+        KoalaSnapshotResult result = koalaSnapshotCapture(&snapshot, state, image.Data(), image.Size(), bytecodePath.c_str());
+        snapshot.bytecodeHash = bytecodeHash; //the image may have been rewritten since loading
+        if(result == KOALA_SNAPSHOT_OK) result = koalaSnapshotWrite(snapshotPath.c_str(), &snapshot);
+        koalaSnapshotRelease(&snapshot);
+        if(result != KOALA_SNAPSHOT_OK){
+            std::cerr << "Failed to write snapshot: " << snapshotPath << "\n";
+            return -1;
+        }
+        std::cerr << "Snapshot saved to " << snapshotPath << " (pc: " << state->pc << ")\n";
+    }
+    if(perf) perf->Stop();
     auto t2 = std::chrono::high_resolution_clock::now();
+    g_ActiveState = nullptr;
+
+    if(state->output && koalaVMStreamFlush(state->output) != 0){
+        std::cerr << "Failed to write program output.\n";
+        return -1;
+    }
+
+    //DBG
+    koalaVMDumpRegisters(state);
+    /////
+
     std::cout << "Time take: " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << "\n";
+    if(perf) perf->Report(std::cerr, state->opcodeCounts);
 
+    if(status != KOALA_VM_STATUS_HALTED){
+        std::cerr << "Program stopped: " << koalaVMStatusString(status) << "\n";
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        printHelp();
+        return 0;
+    }
+
+    std::unordered_map<std::string, std::string> args;
+    std::string inputPath;
+    bool runSource = std::strcmp(argv[1], "run") == 0; //inputPath is a source file
+
+    { //parsing args
+        bool areArgsFine = true;
+        for(int i = runSource ? 2 : 1; i < argc; ++i){
+            if(argv[i][0] == '-'){
+                if(std::strcmp(argv[i], "--specialize") == 0 ||
+                   std::strcmp(argv[i], "--mpmc") == 0 ||
+                   std::strcmp(argv[i], "--perf-stats") == 0 ||
+                   std::strcmp(argv[i], "--dense") == 0 ||
+                   std::strcmp(argv[i], "-O") == 0 ||
+                   std::strcmp(argv[i], "-O2") == 0){
+                    args[std::string(argv[i])] = "";
+                } else if(std::strcmp(argv[i], "--batch") == 0 ||
+                   std::strcmp(argv[i], "--snapshot") == 0 ||
+                   std::strcmp(argv[i], "--resume") == 0 ||
+                   std::strcmp(argv[i], "-j") == 0 ||
+                   std::strcmp(argv[i], "-o") == 0 ||
+                   std::strcmp(argv[i], "--memory") == 0 ||
+                   std::strcmp(argv[i], "--input") == 0 ||
+                   std::strcmp(argv[i], "--output") == 0 ||
+                   std::strcmp(argv[i], "--pipeline") == 0 ||
+                   std::strcmp(argv[i], "--channel-capacity") == 0 ||
+                   std::strcmp(argv[i], "--profile-out") == 0 ||
+                   std::strcmp(argv[i], "--spmd") == 0 ||
+                   std::strcmp(argv[i], "--memoize") == 0 ||
+                   std::strcmp(argv[i], "--serve") == 0 ||
+                   std::strcmp(argv[i], "--time-limit") == 0
+                ){
+                    if(i + 1 >= argc || argv[i + 1][0] == '-'){
+                        std::cerr << "Wrong argument format for '" << argv[i] << "'. Expected: " << argv[i] << " <arg>.\n";
+                        areArgsFine = false;
+                    } else {
+                        args[std::string(argv[i])] = std::string(argv[i + 1]);
+                        i++;
+                    }
+                } else {
+                    std::cerr << "Unknown argument '" << argv[i] << "'.\n";
+                    areArgsFine = false;
+                }
+            } else if(inputPath.empty()){
+                inputPath = argv[i];
+            } else {
+                std::cerr << "Unexpected argument '" << argv[i] << "'.\n";
+                areArgsFine = false;
+            }
+        }
+
+        if(runSource){
+            for(const char* flag : {"--batch", "--spmd", "--pipeline", "--serve", "--snapshot", "--resume"}){
+                if(args.contains(flag)){
+                    std::cerr << "'" << flag << "' cannot be combined with 'run'.\n";
+                    areArgsFine = false;
+                }
+            }
+        } else if(args.contains("--dense") || args.contains("-O") || args.contains("-O2")){
+            std::cerr << "--dense, -O and -O2 only apply to 'koala run'.\n";
+            areArgsFine = false;
+        }
+
+        if(!areArgsFine) {
+            return -1;
+        }
+    }
+
+    uint64_t memoryMiB = KOALA_CORE_VM_MEMORY_DEFAULT_SIZE >> 20;
+    uint64_t jobs = std::thread::hardware_concurrency();
+    uint64_t memoEntries = 0;
+    uint64_t timeLimitMs = 0;
+    uint64_t channelCapacity = 1024;
+    if(!readCountFlag(args, "--memory", 0, 4096, &memoryMiB) ||
+       !readCountFlag(args, "-j", 1, 1024, &jobs) ||
+       !readCountFlag(args, "--memoize", 0, 1ull << 24, &memoEntries) ||
+       !readCountFlag(args, "--time-limit", 0, UINT32_MAX, &timeLimitMs) ||
+       !readCountFlag(args, "--channel-capacity", 1, 1ull << 31, &channelCapacity)){
+        return -1;
+    }
+    uint64_t memorySize = memoryMiB << 20;
+
+    if(args.contains("--batch")){
+        koala::BatchOptions options;
+        options.ListPath = args["--batch"];
+        options.OutputPath = args.contains("-o") ? args["-o"] : "";
+        options.Jobs = jobs;
+        options.Specialize = args.contains("--specialize");
+        options.MemorySize = memorySize;
+        options.MemoEntries = memoEntries;
+        return koala::runBatch(options);
+    }
+
+    if(args.contains("--serve")){
+        koala::ServeOptions options;
+        options.SocketPath = args["--serve"];
+        options.Workers = jobs;
+        options.Specialize = args.contains("--specialize");
+        options.MemorySize = memorySize;
+        options.TimeLimitMs = timeLimitMs;
+        return koala::runServer(options);
+    }
+
+    if(args.contains("--spmd")){
+        if(inputPath.empty()){
+            printHelp();
+            return -1;
+        }
+        koala::SpmdOptions options;
+        options.BytecodePath = inputPath;
+        options.InputsPath = args["--spmd"];
+        options.OutputPath = args.contains("-o") ? args["-o"] : "";
+        options.MemorySize = memorySize;
+        return koala::runSpmd(options);
+    }
+
+    if(args.contains("--pipeline")){
+        koala::PipelineOptions options;
+        std::string stages = args["--pipeline"];
+        for(size_t start = 0, comma; start <= stages.size(); start = comma + 1){
+            comma = stages.find(',', start);
+            if(comma == std::string::npos) comma = stages.size();
+            if(comma > start) options.Stages.push_back(stages.substr(start, comma - start));
+        }
+        options.ChannelCapacity = static_cast<uint32_t>(channelCapacity);
+        options.Mpmc = args.contains("--mpmc");
+        options.Specialize = args.contains("--specialize");
+        options.MemorySize = memorySize;
+        return koala::runPipeline(options);
+    }
+
+    KoalaSnapshot snapshot;
+    if(args.contains("--resume")){
+        if(koalaSnapshotRead(args["--resume"].c_str(), &snapshot) != KOALA_SNAPSHOT_OK){
+            std::cerr << "Failed to read snapshot: " << args["--resume"] << "\n";
+            return -1;
+        }
+        if(inputPath.empty()) inputPath = snapshot.bytecodePath;
+    }
+
+    if(inputPath.empty()){
+        printHelp();
+        return -1;
+    }
+
+    koala::BytecodeImage image;
+    if(runSource){
+        koalac::CompileOptions compileOptions;
+        compileOptions.Dense = args.contains("--dense");
+        compileOptions.Optimize = args.contains("-O") || args.contains("-O2");
+        if(args.contains("-O2")) compileOptions.UnrollFactor = koalac::DefaultUnrollFactor;
+        if(!compileSource(inputPath, compileOptions, &image)) return -1;
+    } else {
+        std::string error;
+        if(!image.Load(inputPath, &error)){
+            std::cerr << error << "\n";
+            return -1;
+        }
+    }
+    if(image.Size() == 0){
+        std::cerr << "Bytecode is empty.\n";
+        return -1;
+    }
+
+    ProgramIO io;
+    if(!io.Open(args.contains("--input") ? args["--input"] : "", args.contains("--output") ? args["--output"] : "")){
+        return -1;
+    }
+
+    KoalaVMState state;
+    koalaVMStateInit(&state);
+    if(koalaVMMemoryInit(&state, memorySize) != 0){
+        std::cerr << "Failed to reserve " << (memorySize >> 20) << "MiB of linear memory.\n";
+        return -1;
+    }
+
+    KoalaHostRegistry host;
+    koalaHostRegistryInit(&host);
+    koalaVMBindHost(&state, &host);
+    koalaVMBindStreams(&state, &io.Input, &io.Output);
+
+    if(args.contains("--resume")){
+        KoalaSnapshotResult restored = koalaSnapshotRestore(&snapshot, &state, image.Data(), image.Size());
+        koalaSnapshotRelease(&snapshot);
+        if(restored != KOALA_SNAPSHOT_OK){
+            std::cerr << "Snapshot does not belong to bytecode: " << inputPath << "\n";
+            koalaVMMemoryDestroy(&state);
+            return -1;
+        }
+    }
+
+    uint64_t bytecodeHash = koalaBytecodeHash(image.Data(), image.Size());
+    ExecuteFn execute = koalaVMExecute;
+    KoalaProfile profile{};
+    if(args.contains("--profile-out")){
+        if(args.contains("--specialize")){
+            std::cerr << "--profile-out cannot be combined with --specialize.\n";
+            koalaVMMemoryDestroy(&state);
+            return -1;
+        }
+        if(koalaProfileInit(&profile, image.Data(), image.Size()) != 0){
+            std::cerr << "Failed to allocate the branch profile.\n";
+            koalaVMMemoryDestroy(&state);
+            return -1;
+        }
+        g_Profile = &profile;
+        execute = executeProfiled;
+    } else if(args.contains("--specialize")){
+        koalaVMSpecialize(image.Data(), image.Size());
+        execute = koalaVMExecuteSpecialized;
+    }
+
+    std::error_code ec;
+    std::string absolutePath = std::filesystem::absolute(inputPath, ec).string();
+    std::string snapshotPath = args.contains("--snapshot") ? args["--snapshot"] : "";
+
+    koala::PerfStats perf;
+    std::vector<uint64_t> opcodeCounts;
+    if(args.contains("--perf-stats")){
+        perf.Open();
+        if(koalaVMOpcodeStatsEnabled()){
+            opcodeCounts.assign(256, 0);
+            state.opcodeCounts = opcodeCounts.data();
+        }
+    }
+
+    int result = runProgram(image, &state, execute, bytecodeHash, ec ? inputPath : absolutePath, snapshotPath, args.contains("--perf-stats") ? &perf : nullptr);
+    if(g_Profile){
+        //a partial profile from a faulting run is still useful for layout
+        if(koalaProfileWrite(args["--profile-out"].c_str(), &profile) != 0){
+            std::cerr << "Failed to write profile: " << args["--profile-out"] << "\n";
+            result = -1;
+        }
+        koalaProfileDestroy(&profile);
+        g_Profile = nullptr;
+    }
+    koalaVMMemoryDestroy(&state);
+    return result;
+}
@@ -0,0 +1,178 @@
+#include "perf_stats.hpp"
+
+#include <KoalaCore>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <format>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace koala{
+
+    struct EventSpec{
+        const char* Name;
+        uint32_t Type;
+        uint64_t Config;
+    };
+
+    static const EventSpec HardwareEvents[] = {
+        { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { "L1i-misses",    PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1I | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+
+    static const EventSpec SoftwareEvents[] = {
+        { "task-clock-ns",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        { "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    };
+
+    static int perfEventOpen(const EventSpec& spec, int groupFd){
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = spec.Type;
+        attr.config = spec.Config;
+        attr.disabled = groupFd < 0; //members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+    }
+
+    static uint64_t threadCpuTimeNs(){
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    PerfStats::~PerfStats(){
+        CloseGroup();
+    }
+
+    bool PerfStats::OpenGroup(Mode mode){
+        const EventSpec* specs = mode == Mode::Hardware ? HardwareEvents : SoftwareEvents;
+        size_t count = mode == Mode::Hardware ? std::size(HardwareEvents) : std::size(SoftwareEvents);
+
+        for(size_t i = 0; i < count; ++i){
+            int fd = perfEventOpen(specs[i], m_Counters.empty() ? -1 : m_Counters.front().Fd);
+            if(fd < 0){
+                if(i == 0) return false; //no leader, no group
+                continue;                //e.g. no L1i event on this PMU
+            }
+            m_Counters.push_back({ specs[i].Name, fd, 0 });
+        }
+
+        m_Mode = mode;
+        return true;
+    }
+
+    void PerfStats::CloseGroup(){
+        for(const Counter& counter : m_Counters) close(counter.Fd);
+        m_Counters.clear();
+    }
+
+    void PerfStats::Open(){
+        if(OpenGroup(Mode::Hardware) || OpenGroup(Mode::Software)) return;
+        m_Mode = Mode::CpuTime;
+    }
+
+    void PerfStats::Start(){
+        if(m_Mode == Mode::CpuTime){
+            m_CpuTimeNs = threadCpuTimeNs();
+            return;
+        }
+
+        int leader = m_Counters.front().Fd;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    void PerfStats::Stop(){
+        if(m_Mode == Mode::CpuTime){
+            m_CpuTimeNs = threadCpuTimeNs() - m_CpuTimeNs;
+            return;
+        }
+
+        int leader = m_Counters.front().Fd;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        //{ nr, time_enabled, time_running, value[nr] }
+        std::vector<uint64_t> data(3 + m_Counters.size());
+        ssize_t bytes = read(leader, data.data(), data.size() * sizeof(uint64_t));
+        if(bytes < static_cast<ssize_t>(3 * sizeof(uint64_t)) || data[0] != m_Counters.size()) return;
+
+        uint64_t enabled = data[1], running = data[2];
+        m_Scaled = running != 0 && running < enabled;
+        for(size_t i = 0; i < m_Counters.size(); ++i){
+            uint64_t value = data[3 + i];
+            m_Counters[i].Value = m_Scaled ? static_cast<uint64_t>(static_cast<double>(value) * enabled / running) : value;
+        }
+    }
+
+    const PerfStats::Counter* PerfStats::Find(const char* name) const{
+        for(const Counter& counter : m_Counters){
+            if(counter.Name == name) return &counter;
+        }
+        return nullptr;
+    }
+
+    void PerfStats::Report(std::ostream& out, const uint64_t* opcodeCounts) const{
+        switch(m_Mode){
+            case Mode::Hardware: out << "Performance counters (hardware" << (m_Scaled ? ", multiplexed" : "") << "):\n"; break;
+            case Mode::Software: out << "Performance counters (software only, no PMU access):\n"; break;
+            case Mode::CpuTime:  out << "Performance counters unavailable (perf_event_open failed), thread CPU time only:\n"; break;
+        }
+
+        for(const Counter& counter : m_Counters){
+            out << std::format("  {:<22}{:>16}\n", counter.Name, counter.Value);
+        }
+        if(m_Mode == Mode::CpuTime){
+            out << std::format("  {:<22}{:>16}\n", "cpu-time-ns", m_CpuTimeNs);
+        }
+
+        uint64_t dispatches = 0;
+        if(opcodeCounts){
+            for(size_t op = 0; op < 256; ++op) dispatches += opcodeCounts[op];
+        }
+        if(dispatches == 0){
+            out << "  (per-instruction ratios need a core built with -DKOALA_CORE_OPCODE_STATS=ON)\n";
+            return;
+        }
+
+        out << std::format("  {:<22}{:>16}\n", "koala-instructions", dispatches);
+        auto ratio = [&](const char* label, const char* counter){
+            if(const Counter* found = Find(counter)){
+                out << std::format("  {:<22}{:>16.4f}\n", label, static_cast<double>(found->Value) / static_cast<double>(dispatches));
+            }
+        };
+        ratio("cycles/instruction", "cycles");
+        ratio("host-instr/instruction", "instructions");
+        ratio("mispredicts/dispatch", "branch-misses");
+        ratio("L1i-misses/dispatch", "L1i-misses");
+        ratio("ns/instruction", "task-clock-ns");
+        if(m_Mode == Mode::CpuTime){
+            out << std::format("  {:<22}{:>16.4f}\n", "ns/instruction", static_cast<double>(m_CpuTimeNs) / static_cast<double>(dispatches));
+        }
+
+        std::vector<size_t> ops;
+        for(size_t op = 0; op < 256; ++op){
+            if(opcodeCounts[op]) ops.push_back(op);
+        }
+        std::sort(ops.begin(), ops.end(), [&](size_t a, size_t b){ return opcodeCounts[a] > opcodeCounts[b]; });
+
+        out << "Opcode executions:\n";
+        for(size_t op : ops){
+            const char* name = koalaOpcodeName(static_cast<uint8_t>(op));
+            std::string label = name ? name : std::format("engine_op_{}", op); //specialized engine ops
+            out << std::format("  {:<22}{:>16}  {:>6.2f}%\n", label, opcodeCounts[op], 100.0 * static_cast<double>(opcodeCounts[op]) / static_cast<double>(dispatches));
+        }
+    }
+
+}
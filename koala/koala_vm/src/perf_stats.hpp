@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace koala{
+
+    // Counts what the calling thread does between Start and Stop with a
+    // perf_event_open group: cycles, instructions, branch misses and L1i misses when
+    // the hardware PMU is reachable, task clock, context switches and page faults when
+    // only software events are, and thread CPU time when perf events are not
+    // available at all (containers, perf_event_paranoid).
+    class PerfStats{
+    public:
+        PerfStats() = default;
+        PerfStats(const PerfStats&) = delete;
+        PerfStats& operator=(const PerfStats&) = delete;
+        ~PerfStats();
+
+        void Open();
+        void Start();
+        void Stop();
+
+        // Prints the counters, then cycles per Koala instruction and mispredicts per
+        // dispatch when opcodeCounts (KoalaVMState.opcodeCounts, [256]) has the number
+        // of executed instructions.
+        void Report(std::ostream& out, const uint64_t* opcodeCounts) const;
+    private:
+        struct Counter{
+            std::string Name;
+            int Fd;
+            uint64_t Value;
+        };
+
+        enum class Mode{ Hardware, Software, CpuTime };
+
+        Mode m_Mode = Mode::CpuTime;
+        std::vector<Counter> m_Counters;
+        bool m_Scaled = false; //counters were multiplexed and extrapolated
+        uint64_t m_CpuTimeNs = 0;
+
+        bool OpenGroup(Mode mode);
+        void CloseGroup();
+        const Counter* Find(const char* name) const;
+    };
+
+}
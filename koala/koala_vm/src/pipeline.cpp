@@ -0,0 +1,105 @@
+#include "pipeline.hpp"
+#include "loader.hpp"
+
+#include <KoalaCore>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace koala{
+
+    struct StageResult{
+        KoalaVMStatus Status = KOALA_VM_STATUS_HALTED;
+        uint64_t TimeNs = 0;
+        uint64_t Registers[KOALA_CORE_VM_REGISTERS_COUNT] = {0};
+    };
+
+    int runPipeline(const PipelineOptions& options){
+        size_t stagesCount = options.Stages.size();
+
+        std::vector<BytecodeImage> images(stagesCount);
+        for(size_t i = 0; i < stagesCount; ++i){
+            std::string error;
+            if(!images[i].Load(options.Stages[i], &error)){
+                std::cerr << error << "\n";
+                return -1;
+            }
+            if(options.Specialize) koalaVMSpecialize(images[i].Data(), images[i].Size());
+        }
+
+        KoalaChannelKind kind = options.Mpmc ? KOALA_CHANNEL_MPMC : KOALA_CHANNEL_SPSC;
+        std::vector<KoalaChannel*> channels(stagesCount + 1, nullptr); //stage i: [i] in, [i + 1] out
+        for(size_t i = 1; i < stagesCount; ++i){
+            channels[i] = koalaChannelCreate(kind, options.ChannelCapacity);
+            if(!channels[i]){
+                std::cerr << "Failed to allocate channel.\n";
+                for(KoalaChannel* channel : channels) koalaChannelDestroy(channel);
+                return -1;
+            }
+        }
+
+        KoalaHostRegistry host;
+        koalaHostRegistryInit(&host);
+
+        std::vector<StageResult> results(stagesCount);
+        auto t1 = std::chrono::steady_clock::now();
+        {
+            std::vector<std::thread> threads;
+            threads.reserve(stagesCount);
+
+            for(size_t i = 0; i < stagesCount; ++i){
+                threads.emplace_back([&, i](){
+                    StageResult& res = results[i];
+                    KoalaChannel* const* stageChannels = &channels[i];
+
+                    KoalaVMState state;
+                    koalaVMStateInit(&state);
+                    if(koalaVMMemoryInit(&state, options.MemorySize) != 0){
+                        res.Status = KOALA_VM_STATUS_MEMORY_FAULT;
+                    } else {
+                        koalaVMBindHost(&state, &host);
+                        koalaVMBindChannels(&state, stageChannels, 2);
+
+                        auto execute = options.Specialize ? koalaVMExecuteSpecialized : koalaVMExecute;
+                        auto start = std::chrono::steady_clock::now();
+                        do{
+                            res.Status = execute(&state, images[i].Data());
+                        } while(res.Status == KOALA_VM_STATUS_CHECKPOINT);
+                        auto end = std::chrono::steady_clock::now();
+
+                        res.TimeNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+                        std::copy(std::begin(state.registers), std::end(state.registers), res.Registers);
+                        koalaVMMemoryDestroy(&state);
+                    }
+
+                    for(size_t c = 0; c < 2; ++c){
+                        if(stageChannels[c]) koalaChannelClose(stageChannels[c]);
+                    }
+                });
+            }
+
+            for(std::thread& thread : threads) thread.join();
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        for(KoalaChannel* channel : channels) koalaChannelDestroy(channel);
+
+        int exitCode = 0;
+        std::cout << "# stage\tstatus\ttime_ns\tregisters\n";
+        for(size_t i = 0; i < stagesCount; ++i){
+            const StageResult& res = results[i];
+            std::cout << options.Stages[i] << '\t' << koalaVMStatusString(res.Status) << '\t' << res.TimeNs << '\t';
+            for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+                if(r != 0) std::cout << ',';
+                std::cout << res.Registers[r];
+            }
+            std::cout << '\n';
+
+            if(res.Status != KOALA_VM_STATUS_HALTED) exitCode = -1;
+        }
+
+        std::cout << "Time take: " << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << "\n";
+        return exitCode;
+    }
+
+}
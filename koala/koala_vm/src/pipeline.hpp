@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace koala{
+
+    struct PipelineOptions{
+        std::vector<std::string> Stages;
+        uint32_t ChannelCapacity;
+        bool Mpmc;
+        bool Specialize;
+        uint64_t MemorySize;
+    };
+
+    // Runs every stage on its own thread, connected in order by channels: a stage
+    // receives from channel 0 (the previous stage) and sends on channel 1 (the next).
+    // The first stage has no channel 0 and the last has no channel 1. When a stage
+    // stops, both of its channels are closed so its neighbours can drain and finish.
+    int runPipeline(const PipelineOptions& options);
+
+}
@@ -0,0 +1,536 @@
+#include "server.hpp"
+#include "loader.hpp"
+#include "opcodes.h"
+
+#include <KoalaCore>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace koala{
+
+    // Memory prefix every worker keeps faulted in; programs that use memory get it
+    // zeroed after their run and the rest of their pages dropped.
+    static constexpr size_t PrefaultSize = 64 * 1024;
+    static constexpr size_t BufferSize = 64 * 1024;
+
+    // Service time of requests, from a complete frame in the input buffer to its reply in
+    // the output buffer. Bucket b counts times in [2^(b-1), 2^b) ns. Only the owning
+    // worker writes, so counts are bumped without read-modify-write atomics.
+    struct LatencyHistogram{
+        static constexpr size_t BucketsCount = 40;
+        std::atomic<uint64_t> Counts[BucketsCount] = {};
+
+        void Record(uint64_t ns){
+            size_t bucket = ns == 0 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(ns));
+            if(bucket >= BucketsCount) bucket = BucketsCount - 1;
+            Counts[bucket].store(Counts[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    };
+
+    static constexpr size_t KindsCount = static_cast<size_t>(ServeKind::Forget) + 1;
+    static const char* kindName(size_t kind){
+        switch(static_cast<ServeKind>(kind)){
+            case ServeKind::Upload:      return "upload";
+            case ServeKind::Run:         return "run";
+            case ServeKind::RunBytecode: return "run_bytecode";
+            case ServeKind::Stats:       return "stats";
+            case ServeKind::Forget:      return "forget";
+        }
+        return "?";
+    }
+
+    static uint64_t steadyNs(){
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    struct Program{
+        BytecodeImage Image;
+        bool UsesMemory = false;
+    };
+
+    // Uploaded bytecode by hash, shared by every worker.
+    class ProgramStore{
+    public:
+        std::shared_ptr<const Program> Find(uint64_t hash){
+            std::shared_lock lock(m_Mutex);
+            auto it = m_Programs.find(hash);
+            return it == m_Programs.end() ? nullptr : it->second;
+        }
+
+        void Add(uint64_t hash, std::shared_ptr<const Program> program){
+            std::unique_lock lock(m_Mutex);
+            m_Programs[hash] = std::move(program);
+        }
+
+        bool Remove(uint64_t hash){
+            std::unique_lock lock(m_Mutex);
+            return m_Programs.erase(hash) != 0;
+        }
+
+        size_t Size(){
+            std::shared_lock lock(m_Mutex);
+            return m_Programs.size();
+        }
+    private:
+        std::shared_mutex m_Mutex;
+        std::unordered_map<uint64_t, std::shared_ptr<const Program>> m_Programs;
+    };
+
+    // Accepted connections waiting for a worker, and the connection each worker serves
+    // so that shutdown can interrupt it.
+    class ConnectionQueue{
+    public:
+        explicit ConnectionQueue(size_t workers) : m_Active(workers, -1) {}
+
+        void Push(int fd){
+            {
+                std::lock_guard lock(m_Mutex);
+                m_Pending.push_back(fd);
+            }
+            m_Cv.notify_one();
+        }
+
+        // Blocks until a connection is pending; -1 once stopped.
+        int Pop(size_t workerIdx){
+            std::unique_lock lock(m_Mutex);
+            m_Cv.wait(lock, [&]{ return m_Stopped || !m_Pending.empty(); });
+            if(m_Stopped) return -1;
+            int fd = m_Pending.front();
+            m_Pending.pop_front();
+            m_Active[workerIdx] = fd;
+            return fd;
+        }
+
+        void Done(size_t workerIdx){
+            std::lock_guard lock(m_Mutex);
+            close(m_Active[workerIdx]);
+            m_Active[workerIdx] = -1;
+        }
+
+        void Stop(){
+            std::lock_guard lock(m_Mutex);
+            m_Stopped = true;
+            for(int fd : m_Pending) close(fd);
+            m_Pending.clear();
+            for(int fd : m_Active) if(fd >= 0) shutdown(fd, SHUT_RDWR);
+            m_Cv.notify_all();
+        }
+    private:
+        std::mutex m_Mutex;
+        std::condition_variable m_Cv;
+        std::deque<int> m_Pending;
+        std::vector<int> m_Active;
+        bool m_Stopped = false;
+    };
+
+    class Server;
+
+    class Worker{
+    public:
+        Worker(Server* server, ProgramStore* store, const ServeOptions& options)
+        : m_Server(server), m_Store(store), m_Options(options)
+        {
+            koalaVMStateInit(&m_State);
+            koalaHostRegistryInit(&m_Host);
+        }
+
+        ~Worker(){ koalaVMMemoryDestroy(&m_State); }
+
+        Worker(const Worker&) = delete;
+        Worker& operator=(const Worker&) = delete;
+
+        // Faults in memory, buffers and the engine before the first request.
+        bool Warm(){
+            if(koalaVMMemoryInit(&m_State, m_Options.MemorySize) != 0) return false;
+            koalaVMBindHost(&m_State, &m_Host);
+            std::memset(m_State.memory, 0, std::min<uint64_t>(PrefaultSize, m_State.memorySize));
+
+            m_In.resize(BufferSize);
+            m_Out.resize(BufferSize);
+            m_Out.clear(); //keeps the pages
+
+            uint8_t ret[] = {RET, 0};
+            koalaVMExecute(&m_State, ret);
+            return true;
+        }
+
+        void Serve(int fd);
+
+        // From the watchdog: pauses the current run at its next jump once it is past its
+        // deadline, or whenever `interrupt` is set (shutdown).
+        void CheckDeadline(uint64_t now, bool interrupt){
+            if(interrupt) m_Interrupted.store(true, std::memory_order_relaxed);
+            uint64_t deadline = m_Deadline.load(std::memory_order_relaxed);
+            if(interrupt || (deadline && now >= deadline)) m_State.checkpointRequest = 1;
+        }
+
+        const LatencyHistogram& Histogram(size_t kind) const { return m_Histograms[kind]; }
+    private:
+        Server* m_Server;
+        ProgramStore* m_Store;
+        const ServeOptions& m_Options;
+        KoalaVMState m_State;
+        KoalaHostRegistry m_Host;
+
+        std::vector<uint8_t> m_In;
+        std::vector<uint8_t> m_Out;
+        LatencyHistogram m_Histograms[KindsCount];
+
+        std::atomic<uint64_t> m_Deadline{0}; //steady_clock ns, 0 while no run has a limit
+        std::atomic<bool> m_Interrupted{false};
+
+        size_t BeginReply(ServeKind kind, uint8_t status, uint64_t id);
+        void EndReply(size_t start);
+        void Append(const void* data, size_t size);
+        void Reply(ServeKind kind, uint8_t status, uint64_t id, const void* payload = nullptr, size_t size = 0);
+
+        void Handle(const ServeRequestHeader& header, const uint8_t* payload);
+        std::shared_ptr<Program> Parse(const uint8_t* file, size_t size, uint64_t* hash, std::string* error);
+        void Run(const Program& program, const uint8_t* registers, size_t count, uint64_t id, ServeKind kind);
+    };
+
+    class Server{
+    public:
+        Server(const ServeOptions& options, size_t workers) : m_Options(options), m_Queue(workers) {}
+
+        std::string Stats();
+        ConnectionQueue& Queue() { return m_Queue; }
+        ProgramStore& Store() { return m_Store; }
+        std::vector<std::unique_ptr<Worker>>& Workers() { return m_Workers; }
+    private:
+        const ServeOptions& m_Options;
+        ConnectionQueue m_Queue;
+        ProgramStore m_Store;
+        std::vector<std::unique_ptr<Worker>> m_Workers;
+    };
+
+    void Worker::Append(const void* data, size_t size){
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        m_Out.insert(m_Out.end(), bytes, bytes + size);
+    }
+
+    size_t Worker::BeginReply(ServeKind kind, uint8_t status, uint64_t id){
+        size_t start = m_Out.size();
+        ServeReplyHeader header{0, static_cast<uint8_t>(kind), status, 0, id};
+        Append(&header, sizeof(header));
+        return start;
+    }
+
+    void Worker::EndReply(size_t start){
+        uint32_t size = static_cast<uint32_t>(m_Out.size() - start - sizeof(ServeReplyHeader));
+        std::memcpy(m_Out.data() + start, &size, sizeof(size));
+    }
+
+    void Worker::Reply(ServeKind kind, uint8_t status, uint64_t id, const void* payload, size_t size){
+        size_t start = BeginReply(kind, status, id);
+        if(size) Append(payload, size);
+        EndReply(start);
+    }
+
+    std::shared_ptr<Program> Worker::Parse(const uint8_t* file, size_t size, uint64_t* hash, std::string* error){
+        auto program = std::make_shared<Program>();
+        if(!program->Image.Parse(std::vector<uint8_t>(file, file + size), "upload", error)) return nullptr;
+
+        //clients are not trusted: the engines do not check operands or jump targets
+        size_t bad = koalaBytecodeVerify(program->Image.Data(), program->Image.Size());
+        if(bad != program->Image.Size()){
+            *error = "Invalid instruction at offset " + std::to_string(bad) + ": unknown opcode, truncated, register out of range or jump outside the program.";
+            return nullptr;
+        }
+
+        *hash = koalaBytecodeHash(program->Image.Data(), program->Image.Size());
+        program->UsesMemory = koalaBytecodeEffects(program->Image.Data(), program->Image.Size()) & KOALA_EFFECT_MEMORY;
+        if(m_Options.Specialize) koalaVMSpecialize(program->Image.Data(), program->Image.Size());
+        return program;
+    }
+
+    void Worker::Run(const Program& program, const uint8_t* registers, size_t count, uint64_t id, ServeKind kind){
+        std::memset(m_State.registers, 0, sizeof(m_State.registers));
+        std::memset(m_State.spill, 0, sizeof(m_State.spill)); //spill slots of the previous client
+        std::memcpy(m_State.registers, registers, count * sizeof(uint64_t));
+        m_State.pc = 0;
+        m_State.checkpointRequest = 0;
+
+        auto execute = m_Options.Specialize ? koalaVMExecuteSpecialized : koalaVMExecute;
+        uint8_t* code = const_cast<uint8_t*>(program.Image.Data()); //engines only read
+        uint64_t deadline = m_Options.TimeLimitMs ? steadyNs() + m_Options.TimeLimitMs * 1000000 : 0;
+        m_Deadline.store(deadline, std::memory_order_relaxed);
+
+        uint8_t status;
+        while((status = execute(&m_State, code)) == KOALA_VM_STATUS_CHECKPOINT){
+            //a pause requested for an earlier run can land here, so check the clock
+            if(m_Interrupted.load(std::memory_order_relaxed) || (deadline && steadyNs() >= deadline)){
+                status = SERVE_TIME_LIMIT;
+                break;
+            }
+        }
+        m_Deadline.store(0, std::memory_order_relaxed);
+
+        Reply(kind, status, id, m_State.registers, sizeof(m_State.registers));
+
+        if(program.UsesMemory){
+            size_t kept = std::min<uint64_t>(PrefaultSize, m_State.memorySize);
+            std::memset(m_State.memory, 0, kept);
+            if(m_State.memorySize > kept) madvise(m_State.memory + kept, m_State.memorySize - kept, MADV_DONTNEED);
+        }
+    }
+
+    void Worker::Handle(const ServeRequestHeader& header, const uint8_t* payload){
+        size_t size = header.Size;
+        switch(static_cast<ServeKind>(header.Kind)){
+            case ServeKind::Upload: {
+                uint64_t hash;
+                std::string error;
+                std::shared_ptr<Program> program = Parse(payload, size, &hash, &error);
+                if(!program) return Reply(ServeKind::Upload, SERVE_BAD_BYTECODE, header.Id, error.data(), error.size());
+                m_Store->Add(hash, std::move(program));
+                return Reply(ServeKind::Upload, SERVE_OK, header.Id, &hash, sizeof(hash));
+            }
+            case ServeKind::Run: {
+                size_t count = size >= sizeof(uint64_t) ? (size - sizeof(uint64_t)) / sizeof(uint64_t) : 0;
+                if(size < sizeof(uint64_t) || size % sizeof(uint64_t) != 0 || count > KOALA_CORE_VM_REGISTERS_COUNT){
+                    return Reply(ServeKind::Run, SERVE_BAD_REQUEST, header.Id);
+                }
+                uint64_t hash;
+                std::memcpy(&hash, payload, sizeof(hash));
+                std::shared_ptr<const Program> program = m_Store->Find(hash);
+                if(!program) return Reply(ServeKind::Run, SERVE_UNKNOWN_HASH, header.Id);
+                return Run(*program, payload + sizeof(hash), count, header.Id, ServeKind::Run);
+            }
+            case ServeKind::RunBytecode: {
+                uint32_t count = 0;
+                if(size >= sizeof(uint64_t)) std::memcpy(&count, payload, sizeof(count));
+                size_t prefix = sizeof(uint64_t) + count * sizeof(uint64_t);
+                if(size < sizeof(uint64_t) || count > KOALA_CORE_VM_REGISTERS_COUNT || size < prefix){
+                    return Reply(ServeKind::RunBytecode, SERVE_BAD_REQUEST, header.Id);
+                }
+                //one-shot: not added to the store, Upload a program to run it again by hash
+                uint64_t hash;
+                std::string error;
+                std::shared_ptr<const Program> program = Parse(payload + prefix, size - prefix, &hash, &error);
+                if(!program) return Reply(ServeKind::RunBytecode, SERVE_BAD_BYTECODE, header.Id, error.data(), error.size());
+                return Run(*program, payload + sizeof(uint64_t), count, header.Id, ServeKind::RunBytecode);
+            }
+            case ServeKind::Forget: {
+                uint64_t hash;
+                if(size != sizeof(hash)) return Reply(ServeKind::Forget, SERVE_BAD_REQUEST, header.Id);
+                std::memcpy(&hash, payload, sizeof(hash));
+                return Reply(ServeKind::Forget, m_Store->Remove(hash) ? SERVE_OK : SERVE_UNKNOWN_HASH, header.Id);
+            }
+            case ServeKind::Stats: {
+                if(size != 0) return Reply(ServeKind::Stats, SERVE_BAD_REQUEST, header.Id);
+                std::string stats = m_Server->Stats();
+                return Reply(ServeKind::Stats, SERVE_OK, header.Id, stats.data(), stats.size());
+            }
+        }
+        Reply(static_cast<ServeKind>(header.Kind), SERVE_BAD_REQUEST, header.Id);
+    }
+
+    static bool writeAll(int fd, const uint8_t* data, size_t size){
+        while(size > 0){
+            ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void Worker::Serve(int fd){
+        size_t begin = 0, end = 0; //unprocessed input is m_In[begin, end)
+        for(;;){
+            ssize_t n = read(fd, m_In.data() + end, m_In.size() - end);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return;
+            end += static_cast<size_t>(n);
+
+            m_Out.clear();
+            bool hangUp = false;
+            while(end - begin >= sizeof(ServeRequestHeader)){
+                ServeRequestHeader header;
+                std::memcpy(&header, m_In.data() + begin, sizeof(header));
+                if(header.Size > ServeMaxPayload){
+                    Reply(static_cast<ServeKind>(header.Kind), SERVE_BAD_REQUEST, header.Id);
+                    hangUp = true;
+                    break;
+                }
+
+                size_t frame = sizeof(header) + header.Size;
+                if(end - begin < frame){
+                    //make room for the rest of the frame
+                    if(m_In.size() - begin < frame){
+                        std::memmove(m_In.data(), m_In.data() + begin, end - begin);
+                        end -= begin;
+                        begin = 0;
+                        if(m_In.size() < frame) m_In.resize(frame);
+                    }
+                    break;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                Handle(header, m_In.data() + begin + sizeof(header));
+                auto stop = std::chrono::steady_clock::now();
+                if(header.Kind < KindsCount){
+                    m_Histograms[header.Kind].Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()));
+                }
+                begin += frame;
+            }
+            if(begin == end) begin = end = 0;
+            else if(m_In.size() - end < sizeof(ServeRequestHeader)){
+                std::memmove(m_In.data(), m_In.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+            }
+
+            if(!m_Out.empty() && !writeAll(fd, m_Out.data(), m_Out.size())) return;
+            if(hangUp) return;
+        }
+    }
+
+    std::string Server::Stats(){
+        std::ostringstream os;
+        os << "workers " << m_Workers.size() << ", programs " << m_Store.Size() << "\n";
+
+        for(size_t kind = 1; kind < KindsCount; ++kind){
+            uint64_t counts[LatencyHistogram::BucketsCount] = {0};
+            uint64_t total = 0;
+            for(auto& worker : m_Workers){
+                for(size_t b = 0; b < LatencyHistogram::BucketsCount; ++b){
+                    counts[b] += worker->Histogram(kind).Counts[b].load(std::memory_order_relaxed);
+                }
+            }
+            for(uint64_t count : counts) total += count;
+            if(total == 0) continue;
+
+            //percentiles as bucket upper bounds
+            auto percentile = [&](double p){
+                uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1, seen = 0;
+                for(size_t b = 0; b < LatencyHistogram::BucketsCount; ++b){
+                    if((seen += counts[b]) >= rank) return uint64_t{1} << b;
+                }
+                return uint64_t{1} << (LatencyHistogram::BucketsCount - 1);
+            };
+            os << kindName(kind) << ": " << total << " requests, p50 < " << percentile(0.50) << "ns, p90 < " << percentile(0.90)
+               << "ns, p99 < " << percentile(0.99) << "ns, max < " << percentile(1.0) << "ns\n";
+            for(size_t b = 0; b < LatencyHistogram::BucketsCount; ++b){
+                if(counts[b]) os << "  < " << (uint64_t{1} << b) << "ns\t" << counts[b] << "\n";
+            }
+        }
+        return os.str();
+    }
+
+    int runServer(const ServeOptions& options){
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if(options.SocketPath.size() >= sizeof(address.sun_path)){
+            std::cerr << "Socket path is too long: " << options.SocketPath << "\n";
+            return -1;
+        }
+        std::memcpy(address.sun_path, options.SocketPath.c_str(), options.SocketPath.size() + 1);
+
+        //SIGINT/SIGTERM arrive on a descriptor the accept loop polls, in no thread
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+        int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(signalFd < 0 || listenFd < 0 ||
+           bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+           listen(listenFd, SOMAXCONN) != 0){
+            std::cerr << "Failed to listen on " << options.SocketPath << ": " << std::strerror(errno)
+                      << (errno == EADDRINUSE ? " (remove it if no server is running)" : "") << "\n";
+            if(listenFd >= 0) close(listenFd);
+            if(signalFd >= 0) close(signalFd);
+            return -1;
+        }
+
+        size_t workersCount = std::max<size_t>(options.Workers, 1);
+        Server server(options, workersCount);
+
+        for(size_t i = 0; i < workersCount; ++i){
+            server.Workers().push_back(std::make_unique<Worker>(&server, &server.Store(), options));
+            if(!server.Workers().back()->Warm()){
+                std::cerr << "Failed to reserve " << (options.MemorySize >> 20) << "MiB of linear memory.\n";
+                close(listenFd);
+                unlink(options.SocketPath.c_str());
+                return -1;
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for(size_t i = 0; i < workersCount; ++i){
+            threads.emplace_back([&server, i]{
+                for(int fd; (fd = server.Queue().Pop(i)) >= 0;){
+                    server.Workers()[i]->Serve(fd);
+                    server.Queue().Done(i);
+                }
+            });
+        }
+
+        //enforces the time limit and stops runs in progress at shutdown
+        std::atomic<bool> stopping{false};
+        std::thread watchdog([&]{
+            auto period = std::chrono::milliseconds(options.TimeLimitMs ? std::clamp<uint64_t>(options.TimeLimitMs / 4, 1, 10) : 10);
+            for(bool last = false; !last; std::this_thread::sleep_for(period)){
+                last = stopping.load();
+                if(!options.TimeLimitMs && !last) continue;
+                uint64_t now = steadyNs();
+                for(auto& worker : server.Workers()) worker->CheckDeadline(now, last);
+            }
+        });
+
+        std::cerr << "Serving on " << options.SocketPath << " with " << workersCount << " workers\n";
+
+        for(;;){
+            pollfd fds[2] = {{listenFd, POLLIN, 0}, {signalFd, POLLIN, 0}};
+            if(poll(fds, 2, -1) < 0){
+                if(errno == EINTR) continue;
+                break;
+            }
+            if(fds[1].revents) break;
+            if(fds[0].revents & POLLIN){
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if(fd >= 0) server.Queue().Push(fd);
+            }
+        }
+
+        close(listenFd);
+        unlink(options.SocketPath.c_str());
+        server.Queue().Stop();
+        stopping.store(true);
+        watchdog.join();
+        for(auto& thread : threads) thread.join();
+        close(signalFd);
+
+        std::cerr << server.Stats();
+        return 0;
+    }
+
+}
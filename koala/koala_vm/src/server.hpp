@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace koala{
+
+    // Wire format of `koala --serve`, host byte order. Every request and every reply is
+    // a 16-byte header followed by `Size` payload bytes. Clients may pipeline: requests
+    // on one connection are answered in order, each reply echoing the request's Id.
+    //
+    //   Upload      .klbc file                          -> u64 hash
+    //   Run         u64 hash, u64 registers[n]          -> u64 registers[KOALA_CORE_VM_REGISTERS_COUNT]
+    //   RunBytecode u32 n, u32 0, u64 registers[n], .klbc file -> as Run (not kept)
+    //   Stats       (empty)                             -> latency histograms as text
+    //   Forget      u64 hash                            -> (empty)
+    //
+    // n is at most KOALA_CORE_VM_REGISTERS_COUNT, registers not sent start at 0. The
+    // status of a run reply is its KoalaVMStatus, other replies use 0 on success or one
+    // of the ServeStatus errors. The hash is koalaBytecodeHash of the body.
+    enum class ServeKind : uint8_t {
+        Upload = 1,
+        Run = 2,
+        RunBytecode = 3,
+        Stats = 4,
+        Forget = 5,
+    };
+
+    enum ServeStatus : uint8_t {
+        SERVE_OK = 0,
+        SERVE_UNKNOWN_HASH = 0x80, // Run/Forget of bytecode that was never uploaded
+        SERVE_BAD_REQUEST = 0x81,  // unknown kind or malformed payload
+        SERVE_BAD_BYTECODE = 0x82, // not a .klbc file, too many registers or fails koalaBytecodeVerify; payload: message
+        SERVE_TIME_LIMIT = 0x83,   // run stopped at the time limit or shutdown; payload: registers so far
+    };
+
+    struct ServeRequestHeader{
+        uint32_t Size;
+        uint8_t Kind;
+        uint8_t Reserved[3];
+        uint64_t Id;
+    };
+
+    struct ServeReplyHeader{
+        uint32_t Size;
+        uint8_t Kind;
+        uint8_t Status;
+        uint16_t Reserved;
+        uint64_t Id;
+    };
+
+    static_assert(sizeof(ServeRequestHeader) == 16 && sizeof(ServeReplyHeader) == 16);
+
+    // Larger requests are answered with SERVE_BAD_REQUEST and end the connection.
+    inline constexpr uint32_t ServeMaxPayload = 64u << 20;
+
+    struct ServeOptions{
+        std::string SocketPath;
+        size_t Workers;      //connections served at the same time
+        bool Specialize;
+        uint64_t MemorySize; //linear memory per worker
+        uint64_t TimeLimitMs; //per run, 0 for none
+    };
+
+    // Listens on a Unix-domain stream socket until SIGINT or SIGTERM. Each worker owns
+    // a VM state whose memory and buffers are faulted in before the first request and
+    // serves one connection at a time, answering every complete request of a read with
+    // a single write. Uploaded bytecode is shared by all workers. A run that exceeds the
+    // time limit is paused at its next jump like a checkpoint and not resumed.
+    int runServer(const ServeOptions& options);
+
+}
@@ -0,0 +1,115 @@
+#include "spmd.hpp"
+#include "loader.hpp"
+
+#include <KoalaCore>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace koala{
+
+    static bool readInputs(const std::string& inputsPath, std::vector<uint64_t>* inputs, size_t* count){
+        std::ifstream fs(inputsPath);
+        if(!fs){
+            std::cerr << "Failed to open register sets: " << inputsPath << "\n";
+            return false;
+        }
+
+        std::string line;
+        size_t lineNumber = 0;
+        while(std::getline(fs, line)){
+            lineNumber++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if(start == std::string::npos || line[start] == '#') continue;
+
+            size_t set = inputs->size();
+            inputs->resize(set + KOALA_CORE_VM_REGISTERS_COUNT, 0);
+
+            size_t reg = 0;
+            for(size_t pos = start; pos < line.size();){
+                if(line[pos] == ' ' || line[pos] == '\t' || line[pos] == ',' || line[pos] == '\r'){
+                    pos++;
+                    continue;
+                }
+
+                size_t used = 0;
+                uint64_t value = 0;
+                try{
+                    value = std::stoull(line.substr(pos), &used, 0);
+                } catch(const std::exception&){
+                    used = 0;
+                }
+                if(used == 0 || reg >= KOALA_CORE_VM_REGISTERS_COUNT){
+                    std::cerr << inputsPath << ":" << lineNumber << ": expected at most " << KOALA_CORE_VM_REGISTERS_COUNT << " register values.\n";
+                    return false;
+                }
+
+                (*inputs)[set + reg++] = value;
+                pos += used;
+            }
+            (*count)++;
+        }
+        return true;
+    }
+
+    static void writeResults(std::ostream& os, const std::vector<uint64_t>& results, const std::vector<KoalaVMStatus>& statuses){
+        os << "# set\tstatus\tregisters\n";
+        for(size_t i = 0; i < statuses.size(); ++i){
+            os << i << '\t' << koalaVMStatusString(statuses[i]) << '\t';
+            for(size_t r = 0; r < KOALA_CORE_VM_REGISTERS_COUNT; ++r){
+                if(r != 0) os << ',';
+                os << results[i * KOALA_CORE_VM_REGISTERS_COUNT + r];
+            }
+            os << '\n';
+        }
+    }
+
+    int runSpmd(const SpmdOptions& options){
+        BytecodeImage image;
+        std::string error;
+        if(!image.Load(options.BytecodePath, &error)){
+            std::cerr << error << "\n";
+            return -1;
+        }
+
+        std::vector<uint64_t> inputs;
+        size_t count = 0;
+        if(!readInputs(options.InputsPath, &inputs, &count)) return -1;
+
+        KoalaVMState scalar;
+        koalaVMStateInit(&scalar);
+        if(koalaVMMemoryInit(&scalar, options.MemorySize) != 0){
+            std::cerr << "Failed to reserve " << (options.MemorySize >> 20) << "MiB of linear memory.\n";
+            return -1;
+        }
+        KoalaHostRegistry host;
+        koalaHostRegistryInit(&host);
+        koalaVMBindHost(&scalar, &host);
+
+        std::vector<uint64_t> results(inputs.size());
+        std::vector<KoalaVMStatus> statuses(count);
+
+        auto t1 = std::chrono::steady_clock::now();
+        koalaVMRunBatch(image.Data(), inputs.data(), results.data(), statuses.data(), count, &scalar);
+        auto t2 = std::chrono::steady_clock::now();
+        koalaVMMemoryDestroy(&scalar);
+
+        if(options.OutputPath.empty()){
+            writeResults(std::cout, results, statuses);
+        } else {
+            std::ofstream outFs(options.OutputPath);
+            if(!outFs){
+                std::cerr << "Failed to open output file for writting: " << options.OutputPath << "\n";
+                return -1;
+            }
+            writeResults(outFs, results, statuses);
+        }
+
+        std::cerr << "SPMD: " << count << " register sets on " << KOALA_CORE_VM_BATCH_LANES << " lanes in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << "ms\n";
+
+        return 0;
+    }
+
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace koala{
+
+    struct SpmdOptions{
+        std::string BytecodePath;
+        std::string InputsPath;
+        std::string OutputPath; //stdout when empty
+        uint64_t MemorySize;    //linear memory shared by lanes that fall back to the scalar engine
+    };
+
+    // Runs one program over every register set in InputsPath (one set per line: up to
+    // KOALA_CORE_VM_REGISTERS_COUNT values for r0, r1, ... separated by spaces or commas,
+    // missing ones are 0; '#' starts a comment line) with koalaVMRunBatch and writes one
+    // result line per set, in input order.
+    int runSpmd(const SpmdOptions& options);
+
+}
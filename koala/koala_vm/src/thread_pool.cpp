@@ -0,0 +1,104 @@
+#include "thread_pool.hpp"
+
+namespace koala{
+
+    WorkStealingPool::WorkStealingPool(size_t workerCount){
+        if(workerCount == 0) workerCount = 1;
+
+        m_Queues.reserve(workerCount);
+        for(size_t i = 0; i < workerCount; ++i){
+            m_Queues.push_back(std::make_unique<WorkerQueue>());
+        }
+
+        m_Workers.reserve(workerCount);
+        for(size_t i = 0; i < workerCount; ++i){
+            m_Workers.emplace_back([this, i](){ WorkerLoop(i); });
+        }
+    }
+
+    WorkStealingPool::~WorkStealingPool(){
+        {
+            std::lock_guard lock(m_StateMutex);
+            m_Stopping = true;
+        }
+        m_WorkAvailable.notify_all();
+
+        for(std::thread& worker : m_Workers){
+            worker.join();
+        }
+    }
+
+    void WorkStealingPool::Submit(Task task){
+        {
+            //counted under the state mutex so a worker about to sleep cannot miss it
+            std::lock_guard lock(m_StateMutex);
+            m_Pending += 1;
+            m_Queued.fetch_add(1, std::memory_order_release);
+        }
+
+        size_t queueIdx = m_NextQueue.fetch_add(1, std::memory_order_relaxed) % m_Queues.size();
+        {
+            std::lock_guard lock(m_Queues[queueIdx]->Mutex);
+            m_Queues[queueIdx]->Tasks.push_back(std::move(task));
+        }
+
+        m_WorkAvailable.notify_one();
+    }
+
+    void WorkStealingPool::Wait(){
+        std::unique_lock lock(m_StateMutex);
+        m_AllDone.wait(lock, [this](){ return m_Pending == 0; });
+    }
+
+    bool WorkStealingPool::PopLocal(size_t workerIdx, Task* task){
+        WorkerQueue& queue = *m_Queues[workerIdx];
+        std::lock_guard lock(queue.Mutex);
+        if(queue.Tasks.empty()) return false;
+
+        *task = std::move(queue.Tasks.back());
+        queue.Tasks.pop_back();
+        return true;
+    }
+
+    bool WorkStealingPool::Steal(size_t workerIdx, Task* task){
+        size_t count = m_Queues.size();
+        for(size_t i = 1; i < count; ++i){
+            WorkerQueue& victim = *m_Queues[(workerIdx + i) % count];
+            std::lock_guard lock(victim.Mutex);
+            if(victim.Tasks.empty()) continue;
+
+            *task = std::move(victim.Tasks.front());
+            victim.Tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void WorkStealingPool::WorkerLoop(size_t workerIdx){
+        Task task;
+
+        while(true){
+            if(PopLocal(workerIdx, &task) || Steal(workerIdx, &task)){
+                m_Queued.fetch_sub(1, std::memory_order_acq_rel);
+                task(workerIdx);
+                task = nullptr;
+
+                bool finished;
+                {
+                    std::lock_guard lock(m_StateMutex);
+                    m_Pending -= 1;
+                    finished = m_Pending == 0;
+                }
+                if(finished) m_AllDone.notify_all();
+                continue;
+            }
+
+            std::unique_lock lock(m_StateMutex);
+            m_WorkAvailable.wait(lock, [this](){
+                return m_Stopping || m_Queued.load(std::memory_order_acquire) > 0;
+            });
+            if(m_Stopping && m_Queued.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace koala{
+
+    // Fixed-size pool where every worker owns a task deque. Workers pop their own
+    // newest task first and steal the oldest task of another worker when they run dry,
+    // so a single long-running task never holds back the rest of the queue.
+    class WorkStealingPool{
+    public:
+        using Task = std::function<void(size_t workerIdx)>;
+
+        explicit WorkStealingPool(size_t workerCount);
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        void Submit(Task task);
+        void Wait();
+
+        inline size_t WorkerCount() const { return m_Queues.size(); }
+    private:
+        struct alignas(64) WorkerQueue{
+            std::mutex Mutex;
+            std::deque<Task> Tasks;
+        };
+
+        bool PopLocal(size_t workerIdx, Task* task);
+        bool Steal(size_t workerIdx, Task* task);
+        void WorkerLoop(size_t workerIdx);
+
+        std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+        std::vector<std::thread> m_Workers;
+
+        std::atomic<size_t> m_NextQueue{0};
+        std::atomic<size_t> m_Queued{0};
+
+        std::mutex m_StateMutex;
+        std::condition_variable m_WorkAvailable;
+        std::condition_variable m_AllDone;
+        size_t m_Pending = 0;
+        bool m_Stopping = false;
+    };
+
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+# Builds koala_core with every interpreter engine on every available C compiler and
+# reports the best of N runs for each bytecode program.
+#
+# usage: tools/bench_interpreters.sh [program.klasm ...]
+# env:   COMPILERS="gcc clang"  RUNS=5  BUILD_ROOT=/tmp/koala-bench
+
+set -euo pipefail
+
+SOURCE_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+COMPILERS="${COMPILERS:-gcc clang}"
+RUNS="${RUNS:-5}"
+BUILD_ROOT="${BUILD_ROOT:-/tmp/koala-bench}"
+
+PROGRAMS=("$@")
+if [ ${#PROGRAMS[@]} -eq 0 ]; then
+    PROGRAMS=("${SOURCE_DIR}/../test_data/hello.klasm")
+fi
+
+printf "%-8s %-10s %-24s %10s\n" "cc" "engine" "program" "best_ms"
+
+for CC_NAME in ${COMPILERS}; do
+    if ! command -v "${CC_NAME}" >/dev/null; then
+        echo "skipping ${CC_NAME}: not installed" >&2
+        continue
+    fi
+    CXX_NAME="${CC_NAME/gcc/g++}"
+    CXX_NAME="${CXX_NAME/clang/clang++}"
+
+    for ENGINE in goto tailcall; do
+        BUILD_DIR="${BUILD_ROOT}/${CC_NAME}-${ENGINE}"
+        cmake -S "${SOURCE_DIR}" -B "${BUILD_DIR}" \
+            -DCMAKE_BUILD_TYPE=Release \
+            -DCMAKE_C_COMPILER="${CC_NAME}" \
+            -DCMAKE_CXX_COMPILER="${CXX_NAME}" \
+            -DKOALA_CORE_INTERPRETER="${ENGINE}" >/dev/null
+        cmake --build "${BUILD_DIR}" -j"$(nproc)" >/dev/null
+
+        for PROGRAM in "${PROGRAMS[@]}"; do
+            BYTECODE="${BUILD_DIR}/$(basename "${PROGRAM%.*}").klbc"
+            "${BUILD_DIR}/bin/koalac" "${PROGRAM}" -o "${BYTECODE}" >/dev/null
+
+            BEST=""
+            for _ in $(seq "${RUNS}"); do
+                MS="$("${BUILD_DIR}/bin/koala" "${BYTECODE}" | sed -n 's/^Time take: \([0-9]*\)ms$/\1/p')"
+                if [ -z "${BEST}" ] || [ "${MS}" -lt "${BEST}" ]; then BEST="${MS}"; fi
+            done
+
+            printf "%-8s %-10s %-24s %10s\n" "${CC_NAME}" "${ENGINE}" "$(basename "${PROGRAM}")" "${BEST}"
+        done
+    done
+done
@@ -0,0 +1,87 @@
+#!/usr/bin/env bash
+# Splits a fixed amount of work per item across 1..N pipeline stages connected by
+# channels and reports throughput, which should grow with the stage count until
+# the stages outnumber the cores.
+#
+# usage: tools/bench_pipeline.sh
+# env:   STAGES="1 2 4 8"  ITEMS=200000  WORK=256  RUNS=3  BUILD_DIR=/tmp/koala-bench/pipeline
+#        KOALA_FLAGS="--mpmc"   (extra flags for `koala --pipeline`)
+
+set -euo pipefail
+
+SOURCE_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+STAGES="${STAGES:-1 2 4 8}"
+ITEMS="${ITEMS:-200000}"
+WORK="${WORK:-256}"
+RUNS="${RUNS:-3}"
+BUILD_DIR="${BUILD_DIR:-/tmp/koala-bench/pipeline}"
+KOALA_FLAGS="${KOALA_FLAGS:-}"
+
+cmake -S "${SOURCE_DIR}" -B "${BUILD_DIR}" -DCMAKE_BUILD_TYPE=Release >/dev/null
+cmake --build "${BUILD_DIR}" -j"$(nproc)" >/dev/null
+
+# source -> work x K -> sink; every item costs WORK iterations in total
+cat > "${BUILD_DIR}/source.klasm" <<KLASM
+_start:
+    mov r0, ${ITEMS}
+    .loop:
+        send r0, 1
+        dec r0
+        jnz r0, .loop
+    close 1
+    ret
+KLASM
+
+cat > "${BUILD_DIR}/sink.klasm" <<KLASM
+_start:
+    mov r0, 0
+    .loop:
+        recv r1, r2, 0
+        jez r2, .done
+        add r0, r0, r1
+        jmp .loop
+    .done:
+    ret
+KLASM
+
+"${BUILD_DIR}/bin/koalac" "${BUILD_DIR}/source.klasm" -o "${BUILD_DIR}/source.klbc" >/dev/null
+"${BUILD_DIR}/bin/koalac" "${BUILD_DIR}/sink.klasm" -o "${BUILD_DIR}/sink.klbc" >/dev/null
+
+printf "%-8s %-12s %10s %14s\n" "stages" "work/stage" "best_ms" "items_per_s"
+
+for K in ${STAGES}; do
+    PER_STAGE=$(( WORK / K > 0 ? WORK / K : 1 ))
+    WORKER="${BUILD_DIR}/work_${PER_STAGE}"
+
+    cat > "${WORKER}.klasm" <<KLASM
+_start:
+    .loop:
+        recv r1, r2, 0
+        jez r2, .done
+        mov r3, ${PER_STAGE}
+        .spin:
+            mul r1, r1, 3
+            add r1, r1, 1
+            dec r3
+            jnz r3, .spin
+        send r1, 1
+        jmp .loop
+    .done:
+    close 1
+    ret
+KLASM
+    "${BUILD_DIR}/bin/koalac" "${WORKER}.klasm" -o "${WORKER}.klbc" >/dev/null
+
+    PIPELINE="${BUILD_DIR}/source.klbc"
+    for _ in $(seq "${K}"); do PIPELINE="${PIPELINE},${WORKER}.klbc"; done
+    PIPELINE="${PIPELINE},${BUILD_DIR}/sink.klbc"
+
+    BEST=""
+    for _ in $(seq "${RUNS}"); do
+        # shellcheck disable=SC2086
+        MS="$("${BUILD_DIR}/bin/koala" --pipeline "${PIPELINE}" ${KOALA_FLAGS} | sed -n 's/^Time take: \([0-9]*\)ms$/\1/p')"
+        if [ -z "${BEST}" ] || [ "${MS}" -lt "${BEST}" ]; then BEST="${MS}"; fi
+    done
+
+    printf "%-8s %-12s %10s %14s\n" "${K}" "${PER_STAGE}" "${BEST}" "$(( ITEMS * 1000 / (BEST > 0 ? BEST : 1) ))"
+done
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Client for `koala --serve <socket>` (wire format: koala_vm/src/server.hpp).
+
+usage: tools/koala_client.py <socket> upload <program.klbc>
+       tools/koala_client.py <socket> run <hash|program.klbc> [r0 r1 ...]
+       tools/koala_client.py <socket> forget <hash>
+       tools/koala_client.py <socket> stats
+       tools/koala_client.py <socket> bench <program.klbc> [--requests N] [--depth D] [r0 r1 ...]
+
+`bench` uploads the program once and sends Run requests keeping D of them in flight,
+then prints round-trip times as seen by this client and the server's histograms.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+UPLOAD, RUN, RUN_BYTECODE, STATS, FORGET = 1, 2, 3, 4, 5
+
+REQUEST = struct.Struct("=IB3xQ")
+REPLY = struct.Struct("=IBBHQ")
+
+VM_STATUSES = ["halted", "invalid_opcode", "checkpoint", "memory_fault", "invalid_host_call", "io_error", "channel_error", "divide_by_zero"]
+SERVE_STATUSES = {0x80: "unknown_hash", 0x81: "bad_request", 0x82: "bad_bytecode", 0x83: "time_limit"}
+
+
+def status_name(status):
+    if status in SERVE_STATUSES:
+        return SERVE_STATUSES[status]
+    return VM_STATUSES[status] if status < len(VM_STATUSES) else f"status {status}"
+
+
+class Client:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.buffer = b""
+        self.next_id = 1
+
+    def send(self, kind, payload=b""):
+        request_id = self.next_id
+        self.next_id += 1
+        self.sock.sendall(REQUEST.pack(len(payload), kind, request_id) + payload)
+        return request_id
+
+    def receive(self):
+        while True:
+            if len(self.buffer) >= REPLY.size:
+                size, kind, status, _, request_id = REPLY.unpack_from(self.buffer)
+                if len(self.buffer) >= REPLY.size + size:
+                    payload = self.buffer[REPLY.size:REPLY.size + size]
+                    self.buffer = self.buffer[REPLY.size + size:]
+                    return request_id, kind, status, payload
+            chunk = self.sock.recv(1 << 16)
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            self.buffer += chunk
+
+    def call(self, kind, payload=b""):
+        self.send(kind, payload)
+        _, _, status, reply = self.receive()
+        return status, reply
+
+
+def registers_payload(values):
+    return b"".join(struct.pack("=Q", v & 0xFFFFFFFFFFFFFFFF) for v in values)
+
+
+def upload(client, path):
+    with open(path, "rb") as f:
+        status, reply = client.call(UPLOAD, f.read())
+    if status != 0:
+        raise RuntimeError(f"upload failed: {status_name(status)} {reply.decode(errors='replace')}")
+    return struct.unpack("=Q", reply)[0]
+
+
+def print_run(status, reply):
+    if status in SERVE_STATUSES and status != 0x83:
+        print(status_name(status), reply.decode(errors="replace"))
+        return
+    registers = struct.unpack(f"={len(reply) // 8}Q", reply)
+    print(status_name(status))
+    for i, value in enumerate(registers):
+        print(f"R{i} S: {value - (1 << 64) if value >> 63 else value} | U: {value}")
+
+
+def bench(client, args):
+    program_hash = upload(client, args.program)
+    payload = struct.pack("=Q", program_hash) + registers_payload(args.registers)
+
+    times, sent_at = [], {}
+    sent = received = 0
+    start = time.perf_counter()
+    while received < args.requests:
+        while sent < args.requests and sent - received < args.depth:
+            sent_at[client.send(RUN, payload)] = time.perf_counter_ns()
+            sent += 1
+        request_id, _, status, _ = client.receive()
+        times.append(time.perf_counter_ns() - sent_at.pop(request_id))
+        if status != 0:
+            raise RuntimeError(f"run failed: {status_name(status)}")
+        received += 1
+    elapsed = time.perf_counter() - start
+
+    times.sort()
+    pick = lambda p: times[min(len(times) - 1, int(p * len(times)))] / 1000
+    print(f"{args.requests} requests, depth {args.depth}: {args.requests / elapsed:.0f} requests/s, "
+          f"round trip p50 {pick(0.5):.1f}us p99 {pick(0.99):.1f}us (client side)")
+    print(client.call(STATS)[1].decode())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("socket")
+    parser.add_argument("command", choices=["upload", "run", "forget", "stats", "bench"])
+    parser.add_argument("program", nargs="?")
+    parser.add_argument("registers", nargs="*", type=lambda v: int(v, 0))
+    parser.add_argument("--requests", type=int, default=100000)
+    parser.add_argument("--depth", type=int, default=1, help="requests in flight (pipelining)")
+    args = parser.parse_intermixed_args()
+
+    client = Client(args.socket)
+    if args.command == "upload":
+        print(f"{upload(client, args.program):#018x}")
+    elif args.command == "run":
+        try:
+            payload = struct.pack("=Q", int(args.program, 0)) + registers_payload(args.registers)
+            print_run(*client.call(RUN, payload))
+        except ValueError:
+            with open(args.program, "rb") as f:
+                file = f.read()
+            payload = struct.pack("=II", len(args.registers), 0) + registers_payload(args.registers) + file
+            print_run(*client.call(RUN_BYTECODE, payload))
+    elif args.command == "forget":
+        status = client.call(FORGET, struct.pack("=Q", int(args.program, 0)))[0]
+        print("ok" if status == 0 else status_name(status))
+    elif args.command == "stats":
+        print(client.call(STATS)[1].decode(), end="")
+    elif args.command == "bench":
+        bench(client, args)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Compiles and runs every kernel of the workload corpus, checks the final registers
+against the `; expect: rN = value` lines of each kernel and compares wall time and
+executed Koala instructions with a committed baseline.
+
+Two trees are built: one for timing and one with -DKOALA_CORE_OPCODE_STATS=ON that
+counts instructions (`koala --perf-stats`), so counting never skews the times.
+Exits non-zero when a kernel computes a wrong result or is slower / executes more
+instructions than the baseline by more than the tolerance.
+
+usage: tools/run_corpus.py [kernel.klasm ...]
+       tools/run_corpus.py --update-baseline     (after an intended change)
+       tools/run_corpus.py --koalac-flags="--dense -O" --koala-flags="--specialize"
+
+Values that start with '-' (--koalac-flags, --koala-flags, --cmake-args) must be given
+with '=', otherwise argparse reads them as options of their own.
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import shlex
+import subprocess
+import sys
+
+SOURCE_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+KERNELS_DIR = os.path.normpath(os.path.join(SOURCE_DIR, "..", "test_data", "kernels"))
+
+EXPECT_RE = re.compile(r"^\s*;\s*expect:\s*r(\d+)\s*=\s*(\d+)\s*$")
+REGISTER_RE = re.compile(r"^R(\d+) S: -?\d+ \| U: (\d+) \|")
+TIME_RE = re.compile(r"^Time take: (\d+)ms$")
+INSTRUCTIONS_RE = re.compile(r"^\s*koala-instructions\s*(\d+)\s*$")
+
+# Times are whole milliseconds, so short kernels get this much slack on top of the tolerance.
+TIME_SLACK_MS = 2
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("kernels", nargs="*", help="kernels to run (default: every test_data/kernels/*.klasm)")
+    parser.add_argument("--baseline", default=os.path.join(KERNELS_DIR, "baseline.json"))
+    parser.add_argument("--update-baseline", action="store_true", help="record this run as the new baseline")
+    parser.add_argument("--time-tolerance", type=float, default=0.10, help="allowed slowdown (default 0.10 = 10%%)")
+    parser.add_argument("--count-tolerance", type=float, default=0.0, help="allowed growth of the instruction count")
+    parser.add_argument("--runs", type=int, default=3, help="best of N timed runs")
+    parser.add_argument("--build-dir", default="/tmp/koala-bench/corpus")
+    parser.add_argument("--no-build", action="store_true", help="use the trees already in --build-dir")
+    parser.add_argument("--cmake-args", default="", help="extra arguments for both cmake configurations, as --cmake-args=\"-D...\"")
+    parser.add_argument("--koalac-flags", default="", help="extra koalac flags, as --koalac-flags=\"--dense -O\"")
+    parser.add_argument("--koala-flags", default="", help="extra koala flags, as --koala-flags=\"--specialize\"")
+    return parser.parse_args()
+
+
+def build(build_dir, cmake_args):
+    subprocess.run(["cmake", "-S", SOURCE_DIR, "-B", build_dir, "-DCMAKE_BUILD_TYPE=Release", *cmake_args],
+                   check=True, stdout=subprocess.DEVNULL)
+    subprocess.run(["cmake", "--build", build_dir, f"-j{os.cpu_count()}"], check=True, stdout=subprocess.DEVNULL)
+
+
+def read_expectations(path):
+    expected = {}
+    with open(path) as f:
+        for line in f:
+            match = EXPECT_RE.match(line)
+            if match:
+                expected[int(match.group(1))] = int(match.group(2))
+    return expected
+
+
+def compile_kernel(bin_dir, source, output, flags):
+    result = subprocess.run([os.path.join(bin_dir, "koalac"), source, "-o", output, *flags],
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"koalac failed:\n{result.stdout}{result.stderr}")
+    return os.path.getsize(output) - 6  # without the header
+
+
+def run_kernel(bin_dir, bytecode, flags):
+    result = subprocess.run([os.path.join(bin_dir, "koala"), bytecode, *flags], capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"koala failed:\n{result.stdout}{result.stderr}")
+
+    registers, ms, instructions = {}, None, None
+    for line in result.stdout.splitlines():
+        if match := REGISTER_RE.match(line):
+            registers[int(match.group(1))] = int(match.group(2))
+        elif match := TIME_RE.match(line):
+            ms = int(match.group(1))
+    for line in result.stderr.splitlines():
+        if match := INSTRUCTIONS_RE.match(line):
+            instructions = int(match.group(1))
+    return registers, ms, instructions
+
+
+def machine():
+    model = platform.processor() or platform.machine()
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return model
+
+
+def change(value, base):
+    if value is None or not base:
+        return "-"
+    return f"{100.0 * (value - base) / base:+.1f}%"
+
+
+def main():
+    args = parse_args()
+    koalac_flags = shlex.split(args.koalac_flags)
+    koala_flags = shlex.split(args.koala_flags)
+
+    kernels = args.kernels or sorted(os.path.join(KERNELS_DIR, name) for name in os.listdir(KERNELS_DIR) if name.endswith(".klasm"))
+
+    timing_dir = os.path.join(args.build_dir, "timing")
+    counting_dir = os.path.join(args.build_dir, "counting")
+    if not args.no_build:
+        cmake_args = shlex.split(args.cmake_args)
+        build(timing_dir, [*cmake_args, "-DKOALA_CORE_OPCODE_STATS=OFF"])
+        build(counting_dir, [*cmake_args, "-DKOALA_CORE_OPCODE_STATS=ON"])
+
+    baseline = {"kernels": {}}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("machine") != machine():
+            print(f"note: baseline was recorded on '{baseline.get('machine')}', times are not comparable", file=sys.stderr)
+        if baseline.get("koalac_flags", "") != args.koalac_flags or baseline.get("koala_flags", "") != args.koala_flags:
+            print("note: baseline was recorded with different compiler/VM flags", file=sys.stderr)
+    elif not args.update_baseline:
+        print(f"note: no baseline at {args.baseline}, only checking results", file=sys.stderr)
+
+    print(f"{'kernel':<14} {'result':<8} {'best_ms':>8} {'base_ms':>8} {'time':>8} {'instructions':>14} {'instr':>8} {'bytes':>6}  verdict")
+
+    results, failed, broken = {}, False, False
+    for source in kernels:
+        name = os.path.splitext(os.path.basename(source))[0]
+        base = baseline["kernels"].get(name, {})
+        verdict = []
+        try:
+            expected = read_expectations(source)
+            timed = os.path.join(timing_dir, name + ".klbc")
+            counted = os.path.join(counting_dir, name + ".klbc")
+            size = compile_kernel(os.path.join(timing_dir, "bin"), source, timed, koalac_flags)
+            compile_kernel(os.path.join(counting_dir, "bin"), source, counted, koalac_flags)
+
+            registers, _, instructions = run_kernel(os.path.join(counting_dir, "bin"), counted, [*koala_flags, "--perf-stats"])
+            wrong = [f"r{reg}={registers.get(reg)} (expected {value})" for reg, value in expected.items() if registers.get(reg) != value]
+
+            best_ms = None
+            for _ in range(args.runs):
+                timed_registers, ms, _ = run_kernel(os.path.join(timing_dir, "bin"), timed, koala_flags)
+                wrong += [f"r{reg}={timed_registers.get(reg)} (expected {value}, timing build)"
+                          for reg, value in expected.items() if timed_registers.get(reg) != value]
+                if ms is not None and (best_ms is None or ms < best_ms):
+                    best_ms = ms
+        except RuntimeError as error:
+            print(f"{name:<14} {'error':<8}\n{error}")
+            failed = broken = True
+            continue
+
+        status = "ok" if expected and not wrong else ("no-check" if not wrong else "WRONG")
+        if wrong:
+            verdict.append("wrong result: " + ", ".join(sorted(set(wrong))))
+        if base.get("ms") is not None and best_ms is not None:
+            if best_ms > base["ms"] * (1.0 + args.time_tolerance) + TIME_SLACK_MS:
+                verdict.append("slower")
+            elif best_ms < base["ms"] * (1.0 - args.time_tolerance) - TIME_SLACK_MS:
+                verdict.append("faster")
+        if base.get("instructions") and instructions is not None:
+            if instructions > base["instructions"] * (1.0 + args.count_tolerance):
+                verdict.append("more instructions")
+            elif instructions < base["instructions"]:
+                verdict.append("fewer instructions")
+        broken |= bool(wrong)
+        failed |= bool(wrong) or "slower" in verdict or "more instructions" in verdict
+
+        print(f"{name:<14} {status:<8} {best_ms if best_ms is not None else '-':>8} {base.get('ms', '-'):>8} "
+              f"{change(best_ms, base.get('ms')):>8} {instructions if instructions is not None else '-':>14} "
+              f"{change(instructions, base.get('instructions')):>8} {size:>6}  {'; '.join(verdict)}")
+        results[name] = {"ms": best_ms, "instructions": instructions, "bytecode_bytes": size}
+
+    if args.update_baseline:
+        if broken:
+            print("not updating the baseline: some kernels failed or computed wrong results", file=sys.stderr)
+            return 1
+        baseline = {
+            "machine": machine(),
+            "koalac_flags": args.koalac_flags,
+            "koala_flags": args.koala_flags,
+            "kernels": {**baseline.get("kernels", {}), **results},
+        }
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=4, sort_keys=True)
+            f.write("\n")
+        print(f"baseline written to {args.baseline}")
+        return 0
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())